@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Result-producing job on a worker thread, polled by the UI loop once per frame.
+// Starting a new job cancels the running one: superseded jobs see their cancel flag, finish in the background and
+// their results are dropped, only the latest job ever delivers a result.
+template <typename Result>
+class BackgroundJob
+{
+public:
+    using CancelFlag = std::atomic<bool>;
+
+    BackgroundJob() = default;
+    BackgroundJob(BackgroundJob const&) = delete;
+    BackgroundJob& operator=(BackgroundJob const&) = delete;
+
+    ~BackgroundJob()
+    {
+        Cancel();
+        for (auto& task : Retired)
+            task.Thread.join();
+    }
+
+    // fn(CancelFlag const&) -> Result runs on a new thread, it should check the flag between steps and return early
+    template <typename Fn>
+    void Start(Fn&& fn)
+    {
+        Cancel();
+        Current.State = std::make_unique<JobState>();
+        JobState* state = Current.State.get();
+        Current.Thread = std::thread([state, fn = std::forward<Fn>(fn)]() mutable {
+            try {
+                state->Value = fn(state->Cancelled);
+            }
+            catch (...) {
+                state->Value = Result();
+            }
+            state->Done = true;
+        });
+    }
+
+    // cancel the running job, if any
+    void Cancel()
+    {
+        if (!Current.State)
+            return;
+        Current.State->Cancelled = true;
+        Retired.push_back(std::move(Current));
+        Current = Task();
+    }
+
+    bool IsRunning() const { return Current.State != nullptr; }
+
+    // true exactly once, when the latest job has finished, `result` then holds its return value
+    bool Poll(Result& result)
+    {
+        for (auto it = Retired.begin(); it != Retired.end();)
+        {
+            if (it->State->Done)
+            {
+                it->Thread.join();
+                it = Retired.erase(it);
+            }
+            else
+                ++it;
+        }
+
+        if (!Current.State || !Current.State->Done)
+            return false;
+        Current.Thread.join();
+        result = std::move(Current.State->Value);
+        Current = Task();
+        return true;
+    }
+
+private:
+    struct JobState
+    {
+        CancelFlag Cancelled{ false };
+        std::atomic<bool> Done{ false };
+        Result Value;
+    };
+
+    struct Task
+    {
+        std::thread Thread;
+        std::unique_ptr<JobState> State;
+    };
+
+    Task Current;
+    std::vector<Task> Retired;  // cancelled jobs still winding down, joined once done
+};
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "volume_raycast.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Volume kept in BrickSize^3 voxel bricks (smaller at the upper borders), each compressed on its own: a brick of a
+// single value is stored as that constant, any other as runs of equal voxels in x-fastest order. Mesh voxelizations
+// are mostly empty or solid space, binary ones shrink by orders of magnitude.
+// It is filled one layer of bricks at a time, so a voxelization never needs the dense volume, and decompressed per
+// index extent, touching only the bricks that overlap it, or per brick, which is how VolumeRayCaster renders it
+class BrickedVolume
+{
+public:
+    static constexpr int BrickSize = 32;
+
+    // every brick the constant 0
+    BrickedVolume(RayCastScalar scalar, int const dim[3], double const origin[3], double const spacing[3]);
+
+    // Compress the bricks of slices [z0, z0 + BrickSize), fewer in the last layer, from `slab` holding these slices in
+    // x-fastest order. z0 is a multiple of BrickSize; different layers may be set concurrently
+    void SetBrickLayer(int z0, void const* slab);
+
+    // voxels of the inclusive index extent { x0, x1, y0, y1, z0, z1 } into `out`, x fastest
+    void Decompress(int const extent[6], void* out) const;
+
+    RayCastScalar GetScalar() const { return Scalar; }
+    int const* GetDimensions() const { return Dim; }
+    double const* GetOrigin() const { return Origin; }
+    double const* GetSpacing() const { return Spacing; }
+    void GetScalarRange(double range[2]) const;
+
+    // Bricks are numbered x fastest, brick b covers voxels [b * BrickSize, min((b + 1) * BrickSize, dim)) on every axis
+    int const* GetBrickDimensions() const { return BrickDim; }
+    void GetBrickRange(std::size_t brick, float range[2]) const;
+    bool IsBrickConstant(std::size_t brick) const { return Bricks[brick].Runs.empty(); }
+    // the voxels of one brick into `out`, x fastest with the brick's own row and slice sizes
+    void DecompressBrick(std::size_t brick, void* out) const;
+
+    std::size_t GetCompressedSize() const;    // bytes of all bricks
+    std::size_t GetDecompressedSize() const;  // bytes of the dense volume
+    int GetNumberOfBricks() const { return static_cast<int>(Bricks.size()); }
+    int GetNumberOfConstantBricks() const;
+
+private:
+    struct Brick
+    {
+        std::uint32_t Constant = 0;      // bytes of the value when there are no runs
+        std::vector<std::uint8_t> Runs;  // (std::uint16_t length - 1, value) pairs
+        float Min = 0, Max = 0;          // of its voxels
+    };
+
+    template <typename T>
+    void CompressLayer(int z0, T const* slab);
+    template <typename T>
+    void DecompressExtent(int const extent[6], T* out) const;
+
+    RayCastScalar Scalar;
+    int Dim[3];
+    double Origin[3], Spacing[3];
+    int BrickDim[3];  // bricks along x, y, z
+    std::vector<Brick> Bricks;
+};
\ No newline at end of file
@@ -0,0 +1,78 @@
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMGUIVTK_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#endif
+
+// Functions using wider instruction sets than the build baseline are tagged with the ISA,
+// MSVC accepts all intrinsics without it
+#if defined(IMGUIVTK_X86) && !defined(_MSC_VER)
+#define IMGUIVTK_TARGET(isa) __attribute__((target(isa)))
+#else
+#define IMGUIVTK_TARGET(isa)
+#endif
+
+enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+inline char const* SimdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::SSE2: return "SSE2";
+    case SimdLevel::AVX2: return "AVX2";
+    case SimdLevel::AVX512: return "AVX-512";
+    default: return "Scalar";
+    }
+}
+
+// Widest instruction set supported by both the CPU and the OS (saved register state)
+inline SimdLevel DetectSimdLevel()
+{
+#if defined(IMGUIVTK_X86)
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuidex(info, 1, 0);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool ymmState = (xcr0 & 0x6) == 0x6;
+    bool zmmState = (xcr0 & 0xe6) == 0xe6;
+
+    bool avx2 = false, avx512f = false;
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        avx512f = (info[1] & (1 << 16)) != 0;
+    }
+
+    if (avx && avx512f && zmmState)
+        return SimdLevel::AVX512;
+    if (avx && avx2 && ymmState)
+        return SimdLevel::AVX2;
+    if (sse2)
+        return SimdLevel::SSE2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+#endif
+#endif
+    return SimdLevel::Scalar;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "cpu_features.h"
+
+#include <cstdint>
+#include <vector>
+
+class vtkCamera;
+class vtkMatrix4x4;
+
+// Model to image pixel projection of a camera, built once and then used from any thread without touching a renderer.
+// The camera sees the image as the background renderer shows it, the image height filling the vertical view angle.
+// Pixel coordinates start at the lower left image corner, x right and y up like vtkImageData, pixel centers at i + 0.5
+struct ImageProjection
+{
+    double ModelToClip[16];  // row-major, clip w is the distance along the view direction
+    int ImageSize[2];
+};
+
+// actorMatrix places the points in the world, nullptr for world points
+ImageProjection GetImageProjection(vtkCamera* camera, vtkMatrix4x4* actorMatrix, int const img_extent[6]);
+
+// false for points not in front of the camera
+bool ProjectPoint(ImageProjection const& projection, double const point[3], double pixel[2], double* depth = nullptr);
+
+// pixel offset of a point from the image center, the principal point of CameraParameters
+void GetPrincipalPoint(ImageProjection const& projection, double const point[3], int principal_point[2]);
+
+struct ProjectedPoints
+{
+    std::vector<float> X, Y;   // pixel coordinates, 0 for points not in front of the camera
+    std::vector<float> Depth;  // distance along the view direction, <= 0 for points not in front of the camera
+    float Box[4];              // x0, y0, x1, y1 of the points in front of the camera, x0 > x1 when there are none
+};
+
+// xyz points in parallel chunks, 8 at a time with AVX2
+void ProjectPoints(ImageProjection const& projection, float const* points, std::int64_t count, ProjectedPoints& projected,
+                   SimdLevel level = DetectSimdLevel());
\ No newline at end of file
@@ -0,0 +1,473 @@
+#pragma once
+
+// Background images too large for one texture, shown as a pyramid of tiles. A base level small enough for one image
+// actor is read when the image is opened, finer levels are decoded tile by tile in the background, only where the
+// background camera looks and only as fine as it shows them, and the recently shown tiles stay decoded.
+// Formats that can only be decoded whole are decoded once, cut into tiles on a disk cache and released
+
+#include <vtkSmartPointer.h>
+#include <vtkNew.h>
+#include <vtkImageData.h>
+#include <vtkImageActor.h>
+#include <vtkImageMapper3D.h>
+#include <vtkImageReader2.h>
+#include <vtkImageReader2Factory.h>
+#include <vtkRenderer.h>
+#include <vtkCamera.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "background_job.h"
+
+// images with a longer side are tiled instead of read whole
+constexpr int TiledBackgroundMinSize = 8192;
+
+struct ImageTileKey
+{
+    int Level = 0;   // 0 is the full resolution, every level halves it
+    int X = 0, Y = 0;  // tile column and row, from the lower left
+
+    bool operator<(ImageTileKey const& other) const { return std::tie(Level, X, Y) < std::tie(other.Level, other.X, other.Y); }
+};
+
+// 8 bit image of level pixels [x0, x0 + width) x [y0, y0 + height) at `level`, placed in the pixel coordinates of the
+// full resolution: spacing 2^level and every pixel centered on the ones of the full resolution it covers
+vtkSmartPointer<vtkImageData> NewImageLevelRegion(int components, int level, int x0, int y0, int width, int height)
+{
+    int scale = 1 << level;
+    auto image = vtkSmartPointer<vtkImageData>::New();
+    image->SetExtent(x0, x0 + width - 1, y0, y0 + height - 1, 0, 0);
+    image->SetSpacing(scale, scale, 1);
+    image->SetOrigin((scale - 1) / 2.0, (scale - 1) / 2.0, 0);
+    image->AllocateScalars(VTK_UNSIGNED_CHAR, components);
+    return image;
+}
+
+// Box filtered region of an 8 bit image at `level`, see NewImageLevelRegion.
+// read(extent) returns an image holding the requested extent of the full resolution, ~4M pixels are read at a time
+template <typename Read>
+vtkSmartPointer<vtkImageData> ReadImageLevelRegion(Read&& read, int const imageSize[2], int components, int level, int x0, int y0,
+                                                   int width, int height)
+{
+    int scale = 1 << level;
+    auto image = NewImageLevelRegion(components, level, x0, y0, width, height);
+
+    int columns[2] = { x0 * scale, std::min((x0 + width) * scale, imageSize[0]) - 1 };
+    int rowsPerRead = std::max(1, (1 << 22) / ((columns[1] - columns[0] + 1) * scale));
+    std::vector<std::uint64_t> sums(static_cast<std::size_t>(width) * components);
+    std::vector<std::uint64_t> counts(width);
+    for (int row = 0; row < height; row += rowsPerRead)
+    {
+        int last = std::min(row + rowsPerRead, height) - 1;
+        int extent[6] = { columns[0], columns[1], (y0 + row) * scale, std::min((y0 + last + 1) * scale, imageSize[1]) - 1, 0, 0 };
+        vtkImageData* source = read(extent);
+        for (int y = row; y <= last; ++y)
+        {
+            std::fill(sums.begin(), sums.end(), 0);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (int sy = (y0 + y) * scale; sy < std::min((y0 + y + 1) * scale, imageSize[1]); ++sy)
+            {
+                auto pixel = static_cast<std::uint8_t const*>(source->GetScalarPointer(columns[0], sy, 0));
+                for (int sx = columns[0]; sx <= columns[1]; ++sx, pixel += components)
+                {
+                    int x = sx / scale - x0;
+                    for (int c = 0; c < components; ++c)
+                        sums[x * components + c] += pixel[c];
+                    ++counts[x];
+                }
+            }
+            auto out = static_cast<std::uint8_t*>(image->GetScalarPointer(x0, y0 + y, 0));
+            for (int x = 0; x < width; ++x)
+                for (int c = 0; c < components; ++c)
+                    out[x * components + c] = static_cast<std::uint8_t>((sums[x * components + c] + counts[x] / 2) / counts[x]);
+        }
+    }
+    return image;
+}
+
+// the pixels of a region as they are in memory, a tile cache file
+bool WriteImageRegionFile(std::filesystem::path const& path, vtkImageData* image)
+{
+    int const* dim = image->GetDimensions();
+    std::ofstream file(path, std::ios::binary);
+    file.write(static_cast<char const*>(image->GetScalarPointer()),
+               static_cast<std::streamsize>(dim[0]) * dim[1] * image->GetNumberOfScalarComponents());
+    return static_cast<bool>(file);
+}
+
+// a region written by WriteImageRegionFile, nullptr when the file is missing or short
+vtkSmartPointer<vtkImageData> ReadImageRegionFile(std::filesystem::path const& path, int components, int level, int x0, int y0,
+                                                  int width, int height)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return nullptr;
+    auto image = NewImageLevelRegion(components, level, x0, y0, width, height);
+    auto bytes = static_cast<std::streamsize>(width) * height * components;
+    file.read(static_cast<char*>(image->GetScalarPointer()), bytes);
+    return file.gcount() == bytes ? image : nullptr;
+}
+
+// A tiled background image. The base level, the finest whose longer side fits BaseSize, is read when it is opened and
+// shown by the background actor; Update shows tiles of the finer levels over it where the background camera needs them.
+// Readers that honor update extents read only the rows of a tile. PNG and JPEG decoders always produce the whole image:
+// it is decoded once when the image is opened, and the memory for it is needed then (4 bytes a pixel for RGBA, 4 GB for
+// a gigapixel image). A background job cuts the tiles of all finer levels from it into an uncompressed disk cache and
+// releases it; tiles are read from the cache once it is complete, and opening the image again reads only the cache
+class TiledBackground
+{
+public:
+    static constexpr int TileSize = 512;
+    static constexpr int BaseSize = 2048;
+    static constexpr std::size_t MaxTiles = 192;  // decoded tiles kept, 150 MB of RGB
+
+    TiledBackground() = default;
+    TiledBackground(TiledBackground const&) = delete;
+    TiledBackground& operator=(TiledBackground const&) = delete;
+
+    // reads the header and the base level, false for images that are not 8 bit with 1 - 4 components
+    bool Open(std::string const& fileName)
+    {
+        Close();
+        auto reader = CreateReader(fileName);
+        if (reader == nullptr)
+            return false;
+        reader->UpdateInformation();
+        int const* extent = reader->GetDataExtent();
+        int components = reader->GetNumberOfScalarComponents();
+        if (extent[0] != 0 || extent[2] != 0 || extent[1] < 0 || extent[3] < 0 || reader->GetDataScalarType() != VTK_UNSIGNED_CHAR ||
+            components < 1 || components > 4)
+            return false;
+
+        FileName = fileName;
+        Size[0] = extent[1] + 1;
+        Size[1] = extent[3] + 1;
+        Components = components;
+        Streamed = !reader->IsA("vtkPNGReader") && !reader->IsA("vtkJPEGReader");
+        BaseLevel = 0;
+        while (std::max(GetLevelSize(BaseLevel, 0), GetLevelSize(BaseLevel, 1)) > BaseSize)
+            ++BaseLevel;
+        int baseWidth = GetLevelSize(BaseLevel, 0), baseHeight = GetLevelSize(BaseLevel, 1);
+
+        if (Streamed)
+        {
+            auto read = [reader](int const* regionExtent) -> vtkImageData* {
+                reader->UpdateExtent(regionExtent);
+                return reader->GetOutput();
+            };
+            Base = ReadImageLevelRegion(read, Size, Components, BaseLevel, 0, 0, baseWidth, baseHeight);
+            return true;
+        }
+
+        CacheDirectory = GetCacheDirectory(fileName);
+        std::error_code error;
+        if (std::filesystem::exists(CacheDirectory / "complete", error))
+            Base = ReadImageRegionFile(CacheDirectory / "base", Components, BaseLevel, 0, 0, baseWidth, baseHeight);
+        if (Base != nullptr)
+        {
+            Cached = true;
+            return true;
+        }
+
+        // the only time the whole image is in memory, the cache job holds the last reference and drops it when done
+        reader->Update();
+        vtkSmartPointer<vtkImageData> whole = reader->GetOutput();
+        auto read = [&whole](int const*) -> vtkImageData* { return whole; };
+        Base = ReadImageLevelRegion(read, Size, Components, BaseLevel, 0, 0, baseWidth, baseHeight);
+        StartCaching(std::move(whole));
+        return true;
+    }
+
+    // forget the image, its tiles leave the renderer they were shown in
+    void Close()
+    {
+        Job.Cancel();
+        CacheJob.Cancel();
+        if (Renderer != nullptr)
+            for (auto const& shown : Shown)
+                Renderer->RemoveActor(shown.second);
+        Shown.clear();
+        Renderer = nullptr;
+        Tiles.clear();
+        Recent.clear();
+        Base = nullptr;
+        Cached = CacheFailed = false;
+        CacheDirectory.clear();
+        FileName.clear();
+    }
+
+    bool IsOpen() const { return Base != nullptr; }
+    // the base level in the pixel coordinates of the full resolution, for the background actor and the locked layers
+    vtkImageData* GetBase() const { return Base; }
+    // the image without its pixels: the extent, origin and spacing ReadImageData would give
+    vtkSmartPointer<vtkImageData> GetGeometry() const
+    {
+        auto geometry = vtkSmartPointer<vtkImageData>::New();
+        geometry->SetExtent(0, Size[0] - 1, 0, Size[1] - 1, 0, 0);
+        return geometry;
+    }
+    // the level the background camera asked for last, BaseLevel when the base is fine enough
+    int GetShownLevel() const { return ShownLevel; }
+    int GetBaseLevel() const { return BaseLevel; }
+    // a PNG or JPEG image whose tiles are cut from one decode into the disk cache, not read from the file
+    bool IsCachedFormat() const { return IsOpen() && !Streamed; }
+    // the finer levels show once the disk cache is written; if it could not be, only the base level shows
+    bool IsCaching() const { return CacheJob.IsRunning(); }
+    bool HasCacheFailed() const { return CacheFailed; }
+
+    // Once per frame: the tiles of the level whose pixels are not larger than the screen pixels where the background
+    // camera looks, coarser decoded tiles where they are missing yet, and the missing one nearest the view center
+    // decoded in the background
+    void Update(vtkRenderer* backgroundRenderer)
+    {
+        if (!IsOpen())
+            return;
+        Renderer = backgroundRenderer;
+
+        vtkSmartPointer<vtkImageData> loaded;
+        if (Job.Poll(loaded) && loaded != nullptr)
+            Insert(Loading, loaded);
+        bool cached = false;
+        if (CacheJob.Poll(cached))
+        {
+            Cached = cached;
+            CacheFailed = !cached;
+        }
+
+        auto camera = backgroundRenderer->GetActiveCamera();
+        int const* viewport = backgroundRenderer->GetSize();
+        double scale = camera->GetParallelScale();
+        if (viewport[0] <= 0 || viewport[1] <= 0 || !(scale > 0))
+            return;
+        double perScreenPixel = 2 * scale / viewport[1];
+        ShownLevel = std::clamp(static_cast<int>(std::floor(std::log2(perScreenPixel))), 0, BaseLevel);
+        double focal[3];
+        camera->GetFocalPoint(focal);
+        double halfWidth = scale * viewport[0] / viewport[1];
+        double view[4] = { focal[0] - halfWidth, focal[1] - scale, focal[0] + halfWidth, focal[1] + scale };
+
+        std::set<ImageTileKey> show;
+        std::vector<ImageTileKey> missing;
+        if (ShownLevel < BaseLevel)
+        {
+            double span = static_cast<double>(TileSize) * (1 << ShownLevel);  // full resolution pixels per tile
+            int first[2], last[2];
+            for (int i = 0; i < 2; ++i)
+            {
+                int tiles = (GetLevelSize(ShownLevel, i) + TileSize - 1) / TileSize;
+                first[i] = std::clamp(static_cast<int>(std::floor((view[i] + 0.5) / span)), 0, tiles - 1);
+                last[i] = std::clamp(static_cast<int>(std::floor((view[2 + i] + 0.5) / span)), 0, tiles - 1);
+            }
+            for (int y = first[1]; y <= last[1]; ++y)
+                for (int x = first[0]; x <= last[0]; ++x)
+                {
+                    ImageTileKey key{ ShownLevel, x, y };
+                    if (Tiles.count(key) != 0)
+                    {
+                        show.insert(key);
+                        continue;
+                    }
+                    missing.push_back(key);
+                    // the nearest coarser tile decoded before covers it meanwhile, the base otherwise
+                    for (auto parent = key; ++parent.Level < BaseLevel;)
+                    {
+                        parent.X /= 2;
+                        parent.Y /= 2;
+                        if (Tiles.count(parent) != 0)
+                        {
+                            show.insert(parent);
+                            break;
+                        }
+                    }
+                }
+            for (auto const& key : show)
+                Touch(key);
+
+            if (!Job.IsRunning() && !missing.empty() && (Streamed || Cached))
+            {
+                auto distance = [&](ImageTileKey const& key) {
+                    double dx = (key.X + 0.5) * span - focal[0], dy = (key.Y + 0.5) * span - focal[1];
+                    return dx * dx + dy * dy;
+                };
+                Loading = *std::min_element(missing.begin(), missing.end(),
+                                            [&](ImageTileKey const& a, ImageTileKey const& b) { return distance(a) < distance(b); });
+                StartLoading(Loading);
+            }
+        }
+
+        for (auto it = Shown.begin(); it != Shown.end();)
+        {
+            if (show.count(it->first) == 0)
+            {
+                backgroundRenderer->RemoveActor(it->second);
+                it = Shown.erase(it);
+            }
+            else
+                ++it;
+        }
+        for (auto const& key : show)
+        {
+            if (Shown.count(key) != 0)
+                continue;
+            auto actor = vtkSmartPointer<vtkImageActor>::New();
+            actor->SetInputData(Tiles[key].first);
+            actor->GetMapper()->BorderOn();  // tiles cover whole pixels, so neighbors meet
+            // between the base (z = 0) and the locked layers (z = 0.5), finer tiles in front
+            actor->SetPosition(0, 0, 0.25 + 0.2 * (BaseLevel - key.Level) / BaseLevel);
+            backgroundRenderer->AddActor(actor);
+            Shown[key] = actor;
+        }
+    }
+
+private:
+    static vtkSmartPointer<vtkImageReader2> CreateReader(std::string const& fileName)
+    {
+        vtkNew<vtkImageReader2Factory> readerFactory;
+        vtkSmartPointer<vtkImageReader2> reader;
+        reader.TakeReference(readerFactory->CreateImageReader2(fileName.c_str()));
+        if (reader != nullptr)
+            reader->SetFileName(fileName.c_str());
+        return reader;
+    }
+
+    // pixels of `level` along axis `axis`, rounded up
+    int GetLevelSize(int level, int axis) const { return (Size[axis] + (1 << level) - 1) >> level; }
+
+    // temp/image_tiles/<hash of the path, size and modification time>, a changed file gets a new cache
+    static std::filesystem::path GetCacheDirectory(std::string const& fileName)
+    {
+        std::error_code error;
+        auto size = std::filesystem::file_size(fileName, error);
+        auto time = std::filesystem::last_write_time(fileName, error).time_since_epoch().count();
+        auto hash = std::hash<std::string>()(fileName + "|" + std::to_string(size) + "|" + std::to_string(time));
+        return std::filesystem::temp_directory_path(error) / "image_tiles" / std::to_string(hash);
+    }
+
+    static std::string GetTileFileName(ImageTileKey const& key)
+    {
+        return std::to_string(key.Level) + "_" + std::to_string(key.X) + "_" + std::to_string(key.Y);
+    }
+
+    // pixel region of `key` at its level: x0, y0, width, height
+    void GetTileRegion(ImageTileKey const& key, int region[4]) const
+    {
+        region[0] = key.X * TileSize;
+        region[1] = key.Y * TileSize;
+        region[2] = std::min(TileSize, GetLevelSize(key.Level, 0) - region[0]);
+        region[3] = std::min(TileSize, GetLevelSize(key.Level, 1) - region[1]);
+    }
+
+    // Cut every tile of the levels finer than the base from `whole` into the cache, coarse levels first, then the base
+    // and the "complete" marker last, so an interrupted cache is written again on the next open
+    void StartCaching(vtkSmartPointer<vtkImageData> whole)
+    {
+        std::vector<std::pair<ImageTileKey, std::array<int, 4>>> tiles;
+        for (int level = BaseLevel - 1; level >= 0; --level)
+            for (int y = 0; y * TileSize < GetLevelSize(level, 1); ++y)
+                for (int x = 0; x * TileSize < GetLevelSize(level, 0); ++x)
+                {
+                    ImageTileKey key{ level, x, y };
+                    std::array<int, 4> region;
+                    GetTileRegion(key, region.data());
+                    tiles.emplace_back(key, region);
+                }
+        Cached = CacheFailed = false;
+        CacheJob.Start([whole = std::move(whole), base = Base, tiles = std::move(tiles), directory = CacheDirectory, size0 = Size[0],
+                        size1 = Size[1], components = Components](BackgroundJob<bool>::CancelFlag const& cancel) mutable {
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+            std::filesystem::remove(directory / "complete", error);
+            auto read = [&whole](int const*) -> vtkImageData* { return whole; };
+            int const imageSize[2] = { size0, size1 };
+            for (auto const& tile : tiles)
+            {
+                if (cancel)
+                    return false;
+                auto const& region = tile.second;
+                auto image = ReadImageLevelRegion(read, imageSize, components, tile.first.Level, region[0], region[1], region[2], region[3]);
+                if (!WriteImageRegionFile(directory / GetTileFileName(tile.first), image))
+                    return false;
+            }
+            whole = nullptr;
+            return WriteImageRegionFile(directory / "base", base) && static_cast<bool>(std::ofstream(directory / "complete"));
+        });
+    }
+
+    // decode `key` on a worker thread with a reader of its own, or read it from the disk cache
+    void StartLoading(ImageTileKey const& key)
+    {
+        vtkSmartPointer<vtkImageReader2> reader;
+        if (Streamed)
+        {
+            reader = CreateReader(FileName);
+            if (reader == nullptr)
+                return;
+        }
+        int region[4];
+        GetTileRegion(key, region);
+        Job.Start([reader, path = CacheDirectory / GetTileFileName(key), size0 = Size[0], size1 = Size[1], components = Components, key,
+                   x0 = region[0], y0 = region[1], width = region[2], height = region[3]](
+                      BackgroundJob<vtkSmartPointer<vtkImageData>>::CancelFlag const&) {
+            if (reader == nullptr)
+                return ReadImageRegionFile(path, components, key.Level, x0, y0, width, height);
+            auto read = [&](int const* extent) -> vtkImageData* {
+                reader->UpdateExtent(extent);
+                return reader->GetOutput();
+            };
+            int const imageSize[2] = { size0, size1 };
+            return ReadImageLevelRegion(read, imageSize, components, key.Level, x0, y0, width, height);
+        });
+    }
+
+    // the least recently shown tiles make room
+    void Insert(ImageTileKey const& key, vtkSmartPointer<vtkImageData> tile)
+    {
+        if (Tiles.count(key) != 0)
+            return;
+        Recent.push_front(key);
+        Tiles[key] = { tile, Recent.begin() };
+        while (Tiles.size() > MaxTiles)
+        {
+            Tiles.erase(Recent.back());
+            Recent.pop_back();
+        }
+    }
+
+    void Touch(ImageTileKey const& key)
+    {
+        auto& entry = Tiles[key];
+        Recent.splice(Recent.begin(), Recent, entry.second);
+    }
+
+    std::string FileName;
+    int Size[2]{ 0, 0 };
+    int Components = 0;
+    int BaseLevel = 0, ShownLevel = 0;
+    bool Streamed = false;
+    vtkSmartPointer<vtkImageData> Base;
+
+    std::filesystem::path CacheDirectory;  // tiles of formats that are not streamed
+    BackgroundJob<bool> CacheJob;
+    bool Cached = false, CacheFailed = false;
+
+    std::map<ImageTileKey, std::pair<vtkSmartPointer<vtkImageData>, std::list<ImageTileKey>::iterator>> Tiles;
+    std::list<ImageTileKey> Recent;  // most recently shown first
+    BackgroundJob<vtkSmartPointer<vtkImageData>> Job;
+    ImageTileKey Loading;  // the tile of Job
+
+    vtkRenderer* Renderer = nullptr;  // where the tiles in Shown are
+    std::map<ImageTileKey, vtkSmartPointer<vtkImageActor>> Shown;
+};
\ No newline at end of file
@@ -12,9 +12,27 @@ vtkSmartPointer<vtkImageData> ReadImageData(const char* fileName)
     vtkNew<vtkImageReader2Factory> readerFactory;
     vtkSmartPointer<vtkImageReader2> imageReader;
     imageReader.TakeReference(readerFactory->CreateImageReader2(fileName));
+    if (imageReader == nullptr)  // missing file or unknown format
+        return nullptr;
     imageReader->SetFileName(fileName);
     imageReader->Update();
     vtkSmartPointer<vtkImageData> imageData;
     imageData = imageReader->GetOutput();
     return imageData;
 }
+
+// width and height from the file header, without reading the pixels
+bool ReadImageSize(const char* fileName, int size[2])
+{
+    vtkNew<vtkImageReader2Factory> readerFactory;
+    vtkSmartPointer<vtkImageReader2> imageReader;
+    imageReader.TakeReference(readerFactory->CreateImageReader2(fileName));
+    if (imageReader == nullptr)
+        return false;
+    imageReader->SetFileName(fileName);
+    imageReader->UpdateInformation();
+    int const* extent = imageReader->GetDataExtent();
+    size[0] = extent[1] - extent[0] + 1;
+    size[1] = extent[3] - extent[2] + 1;
+    return size[0] > 0 && size[1] > 0;
+}
@@ -0,0 +1,525 @@
+#pragma once
+
+// Headless batch mode of MappingMeshToImg: renders every (image, mesh, camera) entry of a manifest offscreen with the
+// same scene setup as the GUI, and writes its Metrics JSON and overlay PNG. Entries are shared by worker threads, each
+// with its own offscreen render window that keeps its scene and only swaps the image / mesh when they change.
+// usage: MappingMeshToImg --batch manifest.json [more manifests ...] [--out dir] [--size WxH] [--jobs N] [--masks | --masks-only]
+// --masks also writes the silhouette mask and depth map of every entry at the image resolution, --masks-only writes
+// nothing else and needs neither OpenGL nor the images' pixels, e.g. to re-export the masks of a whole dataset.
+//
+// A manifest is a JSON array of entries (or { "entries": [...] }), relative paths are relative to the manifest:
+//   { "image": "img/0001.jpg", "mesh": "mesh/mouse.stl", "category": "Mouse", "truncated": false, "occluded": false,
+//     "output": "0001_mouse", "camera": { ... } }
+// The camera is either absolute, with the camera_position, camera_focal_point, model_mass_center_position,
+// inplane_rotation and view_angle (30 when missing) of saved camera parameters, so earlier metrics replay, or relative
+// to the camera the GUI starts with: reset to the mesh and focused on its mass center, then "azimuth", "elevation",
+// "roll", "zoom" and a world "model_offset" of the mesh, all optional.
+// A metrics file written by the GUI or this mode is a manifest as well, with an entry per saved model.
+
+#include <vtkSmartPointer.h>
+#include <vtkNew.h>
+#include <vtkCamera.h>
+#include <vtkMatrix4x4.h>
+#include <vtkRenderer.h>
+#include <vtkRenderWindow.h>
+#include <vtkPNGWriter.h>
+#include <vtkImageReader2Collection.h>
+#include <vtkImageReader2Factory.h>
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "load3d.h"
+#include "loadimg.h"
+#include "mapping_mesh_to_img.h"
+#include "metric.h"
+
+struct BatchEntry
+{
+    std::string image_path;
+    std::string mesh_path;
+    std::string model_category;
+    bool truncated = false;
+    bool occluded = false;
+    std::string output_name;  // file stem of the outputs
+
+    bool absolute_camera = false;
+    // absolute camera
+    double camera_position[3]{ 0, 0, 0 };
+    double camera_focal_point[3]{ 0, 0, 0 };
+    double model_mass_center_position[3]{ 0, 0, 0 };
+    double inplane_rotation = 0;
+    double view_angle = 30;
+    // relative camera
+    double azimuth = 0, elevation = 0, roll = 0, zoom = 1;
+    double model_offset[3]{ 0, 0, 0 };
+};
+
+struct BatchOptions
+{
+    std::vector<std::string> manifests;
+    std::string out = "batch_output";
+    int size[2] = { 1280, 720 };  // of the scene viewport, the render window is twice as high like the GUI one
+    int jobs = 0;                 // 0: all cores
+    bool masks = false;
+    bool masks_only = false;
+};
+
+// throws std::exception on unreadable manifests or entries without image / mesh
+std::vector<BatchEntry> ReadBatchManifest(std::string const& filepath)
+{
+    using json = nlohmann::json;
+
+    std::ifstream in(filepath);
+    if (!in)
+        throw std::runtime_error("cannot open " + filepath);
+    json manifest;
+    in >> manifest;
+
+    auto base = std::filesystem::path(filepath).parent_path();
+    auto resolve = [&base](std::string const& path) {
+        auto p = std::filesystem::path(path);
+        return (p.is_relative() ? base / p : p).string();
+    };
+
+    std::vector<BatchEntry> entries;
+    if (manifest.is_object() && manifest.contains("metrics"))
+    {
+        auto metrics = ReadMetricsFromFile(filepath);
+        for (size_t k = 0; k < metrics.metrics.size(); ++k)
+        {
+            auto const& metric = metrics.metrics[k];
+            auto const& camera = metric.camera_parameters;
+            BatchEntry entry;
+            entry.image_path = resolve(metrics.image_path);
+            entry.mesh_path = resolve(metric.model_path);
+            entry.model_category = metric.model_category;
+            entry.truncated = metric.truncated;
+            entry.occluded = metric.occluded;
+            entry.output_name = metrics.image_name + "_" + std::to_string(k) + "_" + metric.model_name;
+            entry.absolute_camera = true;
+            std::copy_n(camera.camera_position, 3, entry.camera_position);
+            std::copy_n(camera.camera_focal_point, 3, entry.camera_focal_point);
+            std::copy_n(camera.model_mass_center_position, 3, entry.model_mass_center_position);
+            entry.inplane_rotation = camera.inplane_rotation;
+            entry.view_angle = camera.view_angle;
+            entries.push_back(std::move(entry));
+        }
+        return entries;
+    }
+
+    json const& items = manifest.is_object() ? manifest.at("entries") : manifest;
+    auto get_vec3 = [](json const& j, char const* key, double v[3]) {
+        if (j.contains(key))
+            for (int i = 0; i < 3; ++i)
+                v[i] = j.at(key).at(i).get<double>();
+    };
+
+    entries.reserve(items.size());
+    for (auto const& item : items)
+    {
+        BatchEntry entry;
+        entry.image_path = resolve(item.at("image").get<std::string>());
+        entry.mesh_path = resolve(item.at("mesh").get<std::string>());
+        entry.model_category = item.value("category", std::string{});
+        entry.truncated = item.value("truncated", false);
+        entry.occluded = item.value("occluded", false);
+        entry.output_name = item.value("output", std::string{});
+
+        if (item.contains("camera"))
+        {
+            json const& camera = item.at("camera");
+            entry.absolute_camera = camera.contains("camera_position");
+            get_vec3(camera, "camera_position", entry.camera_position);
+            get_vec3(camera, "camera_focal_point", entry.camera_focal_point);
+            std::copy_n(entry.camera_focal_point, 3, entry.model_mass_center_position);
+            get_vec3(camera, "model_mass_center_position", entry.model_mass_center_position);
+            entry.inplane_rotation = camera.value("inplane_rotation", 0.0);
+            entry.view_angle = camera.value("view_angle", 30.0);
+            entry.azimuth = camera.value("azimuth", 0.0);
+            entry.elevation = camera.value("elevation", 0.0);
+            entry.roll = camera.value("roll", 0.0);
+            entry.zoom = camera.value("zoom", 1.0);
+            get_vec3(camera, "model_offset", entry.model_offset);
+        }
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+// the camera of saved camera parameters, any view up not along the view direction, the roll fixes the in-plane rotation
+// and the view angle the zoom
+void SetupSavedCamera(vtkCamera* camera, BatchEntry const& entry)
+{
+    camera->SetViewAngle(entry.view_angle);
+    camera->SetFocalPoint(entry.camera_focal_point);
+    camera->SetPosition(entry.camera_position);
+    double const* direction = camera->GetDirectionOfProjection();
+    if (std::abs(direction[1]) > 0.999)
+        camera->SetViewUp(0, 0, 1);
+    camera->OrthogonalizeViewUp();
+    camera->SetRoll(entry.inplane_rotation);
+}
+
+// like vtkRenderer::ResetCameraClippingRange with the mesh, moved by `offset`, as the only prop
+void SetClippingRangeToMesh(vtkCamera* camera, vtkPolyData* meshData, double const offset[3])
+{
+    double bounds[6];
+    meshData->GetBounds(bounds);
+    double position[3], direction[3];
+    camera->GetPosition(position);
+    camera->GetDirectionOfProjection(direction);
+    double range[2] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::lowest() };
+    for (int k = 0; k < 8; ++k)
+    {
+        double corner[3] = { bounds[k & 1], bounds[2 + (k >> 1 & 1)], bounds[4 + (k >> 2)] };
+        double d = 0;
+        for (int i = 0; i < 3; ++i)
+            d += (corner[i] + offset[i] - position[i]) * direction[i];
+        range[0] = std::min(range[0], d);
+        range[1] = std::max(range[1], d);
+    }
+    double near_plane = std::max(range[0] * 0.99, camera->GetDistance() * 1e-3);
+    camera->SetClippingRange(near_plane, std::max(range[1] * 1.01, 2 * near_plane));
+}
+
+// one offscreen scene per worker, the image / mesh loaded last stay until an entry needs others
+struct BatchWorker
+{
+    vtkSmartPointer<vtkRenderWindow> RenderWindow;
+    SceneAndBackground SceneAndImg{};
+    LockedOverlay Overlay{};
+    std::string ImgFileName, MeshFileName;
+    vtkSmartPointer<vtkImageData> ImgData;
+    vtkSmartPointer<vtkPolyData> PolyData;
+    double MassCenter[3]{ 0, 0, 0 };
+    int ImgSize[2]{ 0, 0 };  // --masks-only reads only the image size
+};
+
+// false with `error` set when the mesh cannot be read
+bool LoadBatchMesh(BatchWorker& worker, BatchEntry const& entry, std::string& error)
+{
+    if (worker.MeshFileName == entry.mesh_path)
+        return true;
+    // ReadPolyData falls back to a sphere for unknown formats, but not for missing files
+    if (!std::filesystem::exists(entry.mesh_path))
+    {
+        error = "cannot read mesh " + entry.mesh_path;
+        return false;
+    }
+    worker.PolyData = ReadPolyData(entry.mesh_path.c_str());
+    worker.MeshFileName = entry.mesh_path;
+    GetCenterOfMass(worker.PolyData, worker.MassCenter);
+    return true;
+}
+
+// --masks-only: rasterizes saved cameras without any render window
+bool ExportBatchMasks(BatchWorker& worker, BatchEntry const& entry, std::filesystem::path const& out_dir, std::string& error)
+{
+    if (!entry.absolute_camera)
+    {
+        error = "masks only work with saved cameras, not relative ones";
+        return false;
+    }
+    if (worker.ImgFileName != entry.image_path)
+    {
+        if (!ReadImageSize(entry.image_path.c_str(), worker.ImgSize))
+        {
+            error = "cannot read image " + entry.image_path;
+            return false;
+        }
+        worker.ImgFileName = entry.image_path;
+    }
+    if (!LoadBatchMesh(worker, entry, error))
+        return false;
+
+    vtkNew<vtkCamera> camera;
+    SetupSavedCamera(camera, entry);
+    double offset[3];
+    vtkNew<vtkMatrix4x4> actorMatrix;
+    for (int i = 0; i < 3; ++i)
+    {
+        offset[i] = entry.model_mass_center_position[i] - worker.MassCenter[i];
+        actorMatrix->SetElement(i, 3, offset[i]);
+    }
+    SetClippingRangeToMesh(camera, worker.PolyData, offset);
+
+    MeshRaster raster;
+    RasterizeModel(worker.PolyData, camera, actorMatrix, worker.ImgSize, raster);
+    if (!WriteMeshRaster(raster, (out_dir / entry.output_name).string()))
+    {
+        error = "cannot write masks of " + entry.output_name;
+        return false;
+    }
+    return true;
+}
+
+// `error` is set when false is returned
+bool RenderBatchEntry(BatchWorker& worker, BatchEntry const& entry, BatchOptions const& options, std::string& error)
+{
+    std::filesystem::path out_dir = options.out;
+    if (options.masks_only)
+        return ExportBatchMasks(worker, entry, out_dir, error);
+
+    bool image_changed = worker.ImgFileName != entry.image_path;
+    if (image_changed)
+    {
+        auto img_data = ReadImageData(entry.image_path.c_str());
+        if (img_data == nullptr)
+        {
+            error = "cannot read image " + entry.image_path;
+            return false;
+        }
+        worker.ImgData = img_data;
+        worker.ImgFileName = entry.image_path;
+    }
+    bool mesh_changed = worker.MeshFileName != entry.mesh_path;
+    if (!LoadBatchMesh(worker, entry, error))
+        return false;
+
+    auto& scene = worker.SceneAndImg;
+    if (scene.SceneRenderer == nullptr)
+        scene = SetupSceneAndBackgroundRenders(worker.RenderWindow, worker.ImgData, worker.PolyData);
+    else
+    {
+        if (mesh_changed)
+            ChangeTheModel(scene, worker.PolyData);
+        if (image_changed)
+            ChangeTheBackgroundImage(scene, worker.ImgData);
+    }
+
+    // every entry starts from the state of a freshly loaded model
+    scene.SceneActor->SetPosition(0, 0, 0);
+    vtkNew<vtkCamera> camera;
+    scene.SceneRenderer->SetActiveCamera(camera);
+
+    double scene_movement[3];
+    if (entry.absolute_camera)
+    {
+        SetupSavedCamera(camera, entry);
+        // the actor moves the mesh mass center onto the saved one
+        double position[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            scene_movement[i] = entry.model_mass_center_position[i] - entry.camera_focal_point[i];
+            position[i] = entry.model_mass_center_position[i] - worker.MassCenter[i];
+        }
+        scene.SceneActor->SetPosition(position);
+    }
+    else
+    {
+        // like SetupModelRender, before the model moves
+        scene.SceneRenderer->ResetCamera();
+        camera->SetFocalPoint(worker.MassCenter);
+        camera->Azimuth(entry.azimuth);
+        camera->Elevation(entry.elevation);
+        camera->OrthogonalizeViewUp();
+        camera->Roll(entry.roll);
+        camera->Zoom(entry.zoom);
+        scene.SceneActor->AddPosition(entry.model_offset);
+        std::copy_n(entry.model_offset, 3, scene_movement);
+    }
+    scene.SceneRenderer->ResetCameraClippingRange();
+    worker.RenderWindow->Render();
+
+    Metrics metrics;
+    auto image_path = std::filesystem::path(entry.image_path);
+    metrics.image_name = image_path.stem().string();
+    metrics.image_path = entry.image_path;
+    metrics.metrics.push_back(Metric{
+        std::filesystem::path(entry.mesh_path).stem().string(),
+        entry.model_category,
+        entry.truncated,
+        entry.occluded,
+        GetCameraParameters(scene.SceneRenderer, scene_movement, worker.ImgData->GetExtent()),
+        entry.mesh_path
+    });
+    WriteMetricsToFile((out_dir / (entry.output_name + ".json")).string(), metrics);
+
+    // the overlay at the image resolution like locked models in the GUI, the screenshot only for other image types
+    ResetLockedOverlay(scene, worker.Overlay, worker.ImgData);
+    LockModelIntoOverlay(scene, worker.Overlay);
+    auto overlaid = GetOverlaidImageData(worker.ImgData, worker.Overlay);
+    if (overlaid == nullptr)
+    {
+        worker.Overlay.Actor->VisibilityOff();  // the scene model is on screen already
+        worker.RenderWindow->Render();
+        overlaid = GetScreenShotImageData(scene, false);
+        worker.Overlay.Actor->VisibilityOn();
+    }
+
+    vtkNew<vtkPNGWriter> writer;
+    writer->SetFileName((out_dir / (entry.output_name + ".png")).string().c_str());
+    writer->SetInputData(overlaid);
+    writer->Write();
+    if (writer->GetErrorCode() != 0)
+    {
+        error = "cannot write overlay of " + entry.output_name;
+        return false;
+    }
+
+    if (options.masks)
+    {
+        MeshRaster raster;
+        RasterizeModel(worker.PolyData, camera, scene.SceneActor->GetMatrix(), worker.ImgData->GetDimensions(), raster);
+        if (!WriteMeshRaster(raster, (out_dir / entry.output_name).string()))
+        {
+            error = "cannot write masks of " + entry.output_name;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParseBatchOptions(int argc, char* argv[], BatchOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            options.manifests.emplace_back(argv[++i]);
+        else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+            options.out = argv[++i];
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+            sscanf(argv[++i], "%dx%d", &options.size[0], &options.size[1]);
+        else if (!strcmp(argv[i], "--jobs") && i + 1 < argc)
+            options.jobs = std::max(0, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--masks"))
+            options.masks = true;
+        else if (!strcmp(argv[i], "--masks-only"))
+            options.masks_only = true;
+        else if (argv[i][0] != '-')
+            options.manifests.emplace_back(argv[i]);
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return false;
+        }
+    }
+    return !options.manifests.empty() && options.size[0] > 0 && options.size[1] > 0;
+}
+
+// returns the process exit code: 0 when every entry was written
+int RunBatch(int argc, char* argv[])
+{
+    BatchOptions options;
+    if (!ParseBatchOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: %s --batch manifest.json [more manifests ...] [--out dir] [--size WxH] [--jobs N] [--masks | --masks-only]\n",
+                argv[0]);
+        return 1;
+    }
+
+    std::vector<BatchEntry> entries;
+    for (auto const& manifest : options.manifests)
+    {
+        try
+        {
+            auto manifest_entries = ReadBatchManifest(manifest);
+            entries.insert(entries.end(), manifest_entries.begin(), manifest_entries.end());
+        }
+        catch (std::exception const& e)
+        {
+            fprintf(stderr, "invalid manifest %s: %s\n", manifest.c_str(), e.what());
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        auto& entry = entries[i];
+        if (entry.output_name.empty())
+        {
+            char index[16];
+            snprintf(index, sizeof(index), "%06zu", i);
+            entry.output_name = std::string(index) + "_" + std::filesystem::path(entry.image_path).stem().string() + "_" +
+                                std::filesystem::path(entry.mesh_path).stem().string();
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(options.out, ec);
+    if (ec)
+    {
+        fprintf(stderr, "cannot create %s: %s\n", options.out.c_str(), ec.message().c_str());
+        return 1;
+    }
+
+    // the reader factory registers its readers on first use, not thread-safe, so do it before the workers start
+    vtkNew<vtkImageReader2Collection> readers;
+    vtkImageReader2Factory::GetRegisteredReaders(readers);
+
+    unsigned jobs = options.jobs > 0 ? static_cast<unsigned>(options.jobs) : std::max(1u, std::thread::hardware_concurrency());
+    jobs = std::min<unsigned>(jobs, static_cast<unsigned>(std::max<size_t>(entries.size(), 1)));
+
+    // windows are created here, their OpenGL contexts on the first render in their worker
+    std::vector<BatchWorker> workers(jobs);
+    for (auto& worker : workers)
+    {
+        if (options.masks_only)
+            break;
+        worker.RenderWindow = vtkSmartPointer<vtkRenderWindow>::New();
+        worker.RenderWindow->SetOffScreenRendering(1);
+        worker.RenderWindow->SetSize(options.size[0], 2 * options.size[1]);
+    }
+
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> done{ 0 }, failed{ 0 };
+    std::mutex log_mutex;
+    auto start = std::chrono::steady_clock::now();
+    auto work = [&](BatchWorker& worker) {
+        for (size_t i = next++; i < entries.size(); i = next++)
+        {
+            std::string error;
+            bool ok = false;
+            try
+            {
+                ok = RenderBatchEntry(worker, entries[i], options, error);
+            }
+            catch (std::exception const& e)
+            {
+                error = e.what();
+            }
+            if (!ok)
+                ++failed;
+            auto count = ++done;
+            std::lock_guard<std::mutex> lock(log_mutex);
+            if (!ok)
+                fprintf(stderr, "entry %zu (%s) failed: %s\n", i, entries[i].output_name.c_str(), error.c_str());
+            if (count % 100 == 0 || count == entries.size())
+                printf("%zu / %zu done\n", count, entries.size());
+        }
+        // release the contexts in the thread that made them current
+        if (worker.Overlay.RenderWindow != nullptr)
+            worker.Overlay.RenderWindow->Finalize();
+        worker.Overlay = LockedOverlay{};
+        if (worker.RenderWindow != nullptr)
+            worker.RenderWindow->Finalize();
+        worker.RenderWindow = nullptr;
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < jobs; ++t)
+        threads.emplace_back(work, std::ref(workers[t]));
+    work(workers[0]);
+    for (auto& thread : threads)
+        thread.join();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%zu entries, %zu failed, %u workers, %.1f s, written to %s\n", entries.size(), failed.load(), jobs, seconds,
+           options.out.c_str());
+    return failed == 0 ? 0 : 1;
+}
\ No newline at end of file
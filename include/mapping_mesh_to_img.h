@@ -9,11 +9,33 @@
 #include <vtkNamedColors.h>
 #include <vtkCamera.h>
 #include <vtkRenderer.h>
+#include <vtkRenderWindow.h>
 #include <vtkRenderWindowInteractor.h>
 #include <vtkCommand.h>
 #include <vtkRendererCollection.h>
 #include <vtkWindowToImageFilter.h>
 #include <vtkCenterOfMass.h>
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkCellArray.h>
+#include <vtkPNGWriter.h>
+#include <vtkTIFFWriter.h>
+#include <vtkFloatArray.h>
+#include <vtkUnsignedCharArray.h>
+#include <vtkPointData.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+
+#include <string>
+#include <vector>
+
+#include "image_projection.h"
+#include "mesh_raster.h"
+#include "parallel_for.h"
 
 
 void GetCenterOfMass(vtkSmartPointer<vtkPolyData> meshData, double* center)
@@ -76,7 +98,8 @@ struct SceneAndBackground
 };
 
 // scene: render 2, background: render 1
-SceneAndBackground SetupSceneAndBackgroundRenders(vtkSmartPointer<vtkGenericOpenGLRenderWindow> renderWindow, vtkSmartPointer<vtkImageData> imgData, vtkSmartPointer<vtkPolyData> meshData)
+// any render window works, the GUI passes its vtkGenericOpenGLRenderWindow and the batch mode an offscreen one
+SceneAndBackground SetupSceneAndBackgroundRenders(vtkRenderWindow* renderWindow, vtkSmartPointer<vtkImageData> imgData, vtkSmartPointer<vtkPolyData> meshData)
 {
     // Create an image actor to display the image
     vtkNew<vtkImageActor> imgActor;
@@ -202,8 +225,39 @@ void ChangeTheBackgroundImage(SceneAndBackground& SceneAndImg, vtkSmartPointer<v
 }
 
 
+// Look closer at the background: `zoom` times around image pixel `center`, zoom 1 fits the image height around its center
+// like SetupSceneAndBackgroundRenders. The scene camera keeps its pose, so the live scene model would not match the
+// zoomed image and is hidden meanwhile; locked models are in the background renderer and zoom with the image
+void SetBackgroundZoom(SceneAndBackground& SceneAndImg, vtkImageData* imgData, double zoom, double const center[2])
+{
+    double origin[3];
+    double spacing[3];
+    int extent[6];
+    imgData->GetOrigin(origin);
+    imgData->GetSpacing(spacing);
+    imgData->GetExtent(extent);
+
+    double xc = origin[0] + 0.5 * (extent[0] + extent[1]) * spacing[0];
+    double yc = origin[1] + 0.5 * (extent[2] + extent[3]) * spacing[1];
+    double yd = (extent[3] - extent[2] + 1) * spacing[1];
+    zoom = std::max(zoom, 1.0);
+    if (zoom > 1)
+    {
+        xc = center[0];
+        yc = center[1];
+    }
+
+    vtkCamera* camera = SceneAndImg.BackgroundRenderer->GetActiveCamera();
+    double d = camera->GetDistance();
+    camera->SetParallelScale(0.5 * yd / zoom);
+    camera->SetFocalPoint(xc, yc, 0.0);
+    camera->SetPosition(xc, yc, d);
+    SceneAndImg.SceneRenderer->SetDraw(zoom == 1);
+}
+
 // this way not perfect, since the screenshot resolution is much lower than the original one
-vtkSmartPointer<vtkImageData> GetScreenShotImageData(SceneAndBackground& SceneAndImg)
+// offscreen render windows have no front buffer to read, pass `read_front_buffer` false for them
+vtkSmartPointer<vtkImageData> GetScreenShotImageData(SceneAndBackground& SceneAndImg, bool read_front_buffer = true)
 {
     auto renderWindow = SceneAndImg.BackgroundRenderer->GetRenderWindow();
     
@@ -213,8 +267,399 @@ vtkSmartPointer<vtkImageData> GetScreenShotImageData(SceneAndBackground& SceneAn
     windowToImageFilter->SetViewport(0, 0.5, 1, 1);  // only capture the scene
     windowToImageFilter->SetScale(1); // image quality
     windowToImageFilter->SetInputBufferTypeToRGB(); // without alpha channel, the black image problem will disappear
-    windowToImageFilter->ReadFrontBufferOn();       // read from the front buffer
+    windowToImageFilter->SetReadFrontBuffer(read_front_buffer);  // read from the front buffer
     windowToImageFilter->Update();
     
     return windowToImageFilter->GetOutput();
 }
+
+
+
+// Locked models in their own RGBA layer at the resolution of the background image, shown by a second image actor
+// above the background one. Every lock renders only the scene model offscreen at that resolution and blends it into
+// the layer, the background image itself is never resampled
+struct LockedOverlay
+{
+    vtkSmartPointer<vtkRenderWindow> RenderWindow;  // offscreen, image sized
+    vtkSmartPointer<vtkRenderer> Renderer;
+    vtkSmartPointer<vtkImageData> Layer;            // straight (not premultiplied) RGBA
+    vtkSmartPointer<vtkImageActor> Actor;
+};
+
+// empty layer matching `imgData`, call it whenever the background image changes
+void ResetLockedOverlay(SceneAndBackground& SceneAndImg, LockedOverlay& overlay, vtkImageData* imgData)
+{
+    if (overlay.Layer == nullptr)
+    {
+        overlay.Layer = vtkSmartPointer<vtkImageData>::New();
+        overlay.Actor = vtkSmartPointer<vtkImageActor>::New();
+        overlay.Actor->SetInputData(overlay.Layer);
+        // just in front of the background image, the parallel background camera looks along -z
+        overlay.Actor->SetPosition(0, 0, 0.5);
+    }
+    if (!SceneAndImg.BackgroundRenderer->HasViewProp(overlay.Actor))
+        SceneAndImg.BackgroundRenderer->AddActor(overlay.Actor);
+
+    overlay.Layer->SetExtent(imgData->GetExtent());
+    overlay.Layer->SetOrigin(imgData->GetOrigin());
+    overlay.Layer->SetSpacing(imgData->GetSpacing());
+    overlay.Layer->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+    auto size = static_cast<size_t>(overlay.Layer->GetNumberOfPoints()) * 4;
+    std::memset(overlay.Layer->GetScalarPointer(), 0, size);
+    overlay.Layer->Modified();
+}
+
+// Blend a model seen by `camera` into the layer. The offscreen window has the aspect of the image and the vertical view
+// angle of the camera, the background camera fits the image height to the viewport, so the model lands on the same
+// image pixels as on screen. It makes its own OpenGL context current, the caller restores the one it renders with.
+// `mapper` draws the model mesh in the offscreen window, a temporary one when it is nullptr
+void LockModelIntoOverlay(vtkCamera* camera, vtkActor* sceneActor, LockedOverlay& overlay, vtkPolyDataMapper* mapper = nullptr)
+{
+    int const* dim = overlay.Layer->GetDimensions();
+    if (overlay.RenderWindow == nullptr)
+    {
+        overlay.RenderWindow = vtkSmartPointer<vtkRenderWindow>::New();
+        overlay.RenderWindow->SetOffScreenRendering(1);
+        overlay.RenderWindow->SetAlphaBitPlanes(1);
+        overlay.Renderer = vtkSmartPointer<vtkRenderer>::New();
+        overlay.Renderer->SetBackground(0, 0, 0);
+        overlay.Renderer->SetBackgroundAlpha(0);
+        overlay.RenderWindow->AddRenderer(overlay.Renderer);
+    }
+    overlay.RenderWindow->SetSize(dim[0], dim[1]);
+
+    // a copy of the scene model with a mapper of the offscreen window, graphics resources are per window
+    vtkSmartPointer<vtkPolyDataMapper> offscreenMapper = mapper;
+    if (offscreenMapper == nullptr)
+    {
+        offscreenMapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+        offscreenMapper->SetInputData(vtkPolyData::SafeDownCast(sceneActor->GetMapper()->GetInput()));
+    }
+    vtkNew<vtkMatrix4x4> matrix;
+    matrix->DeepCopy(sceneActor->GetMatrix());
+    vtkNew<vtkActor> actor;
+    actor->SetMapper(offscreenMapper);
+    actor->SetProperty(sceneActor->GetProperty());
+    actor->SetUserMatrix(matrix);
+
+    overlay.Renderer->RemoveAllViewProps();
+    overlay.Renderer->AddActor(actor);
+    overlay.Renderer->GetActiveCamera()->DeepCopy(camera);
+    overlay.Renderer->ResetCameraClippingRange();
+    overlay.RenderWindow->Render();
+
+    vtkNew<vtkWindowToImageFilter> windowToImageFilter;
+    windowToImageFilter->SetInput(overlay.RenderWindow);
+    windowToImageFilter->SetInputBufferTypeToRGBA();
+    windowToImageFilter->SetReadFrontBuffer(false);
+    windowToImageFilter->Update();
+    overlay.Renderer->RemoveAllViewProps();
+
+    // the render is premultiplied by its alpha (blended over transparent black), the layer is straight alpha
+    auto src = static_cast<std::uint8_t const*>(windowToImageFilter->GetOutput()->GetScalarPointer());
+    auto dst = static_cast<std::uint8_t*>(overlay.Layer->GetScalarPointer());
+    ParallelFor(0, dim[1], 64, [&](std::int64_t begin, std::int64_t end) {
+        for (std::int64_t i = begin * dim[0]; i < end * dim[0]; ++i)
+        {
+            auto s = src + 4 * i;
+            auto d = dst + 4 * i;
+            if (s[3] == 0)
+                continue;
+            float sa = s[3] / 255.0f, da = d[3] / 255.0f;
+            float a = sa + da * (1 - sa);
+            for (int c = 0; c < 3; ++c)
+                d[c] = static_cast<std::uint8_t>(std::min(255.0f, (s[c] + d[c] * da * (1 - sa)) / a + 0.5f));
+            d[3] = static_cast<std::uint8_t>(a * 255 + 0.5f);
+        }
+    });
+    overlay.Layer->Modified();  // re-uploads the texture of the overlay actor
+}
+
+// the current scene model
+void LockModelIntoOverlay(SceneAndBackground& SceneAndImg, LockedOverlay& overlay)
+{
+    LockModelIntoOverlay(SceneAndImg.SceneRenderer->GetActiveCamera(), SceneAndImg.SceneActor, overlay);
+}
+
+// the background image with the layer blended over it as RGB, at the image resolution; nullptr for images that are not
+// 8 bit gray / RGB / RGBA
+vtkSmartPointer<vtkImageData> GetOverlaidImageData(vtkImageData* imgData, LockedOverlay const& overlay)
+{
+    int components = imgData->GetNumberOfScalarComponents();
+    if (imgData->GetScalarType() != VTK_UNSIGNED_CHAR || components > 4 || components == 2)
+        return nullptr;
+
+    vtkNew<vtkImageData> result;
+    result->SetExtent(imgData->GetExtent());
+    result->SetOrigin(imgData->GetOrigin());
+    result->SetSpacing(imgData->GetSpacing());
+    result->AllocateScalars(VTK_UNSIGNED_CHAR, 3);
+
+    auto img = static_cast<std::uint8_t const*>(imgData->GetScalarPointer());
+    auto layer = static_cast<std::uint8_t const*>(overlay.Layer->GetScalarPointer());
+    auto out = static_cast<std::uint8_t*>(result->GetScalarPointer());
+    int const* dim = result->GetDimensions();
+    ParallelFor(0, dim[1], 64, [&](std::int64_t begin, std::int64_t end) {
+        for (std::int64_t i = begin * dim[0]; i < end * dim[0]; ++i)
+        {
+            auto l = layer + 4 * i;
+            for (int c = 0; c < 3; ++c)
+            {
+                int background = img[components * i + (components == 1 ? 0 : c)];
+                out[3 * i + c] = static_cast<std::uint8_t>((l[c] * l[3] + background * (255 - l[3]) + 127) / 255);
+            }
+        }
+    });
+    return result;
+}
+
+
+// One object annotated on the image: its own actor and camera and, once saved, its metric
+struct SceneModel
+{
+    std::string MeshFileName;
+    vtkSmartPointer<vtkActor> Actor;
+    vtkSmartPointer<vtkCamera> Camera;    // the pose while another model is selected
+    int MetricIndex = -1;                 // into Metrics::metrics once saved
+    double OriginalCenter[3]{ 0, 0, 0 };  // actor center at zero position for its mesh, the scene movement starts there
+};
+
+// the center the model's actor has at zero position: an actor added at the pose of the selected one or given another
+// mesh is already moved, and the metric's scene movement (actor center minus this) has to include that
+void SetOriginalCenter(SceneModel& model)
+{
+    double const* center = model.Actor->GetCenter();
+    double const* position = model.Actor->GetPosition();
+    for (int i = 0; i < 3; ++i)
+        model.OriginalCenter[i] = center[i] - position[i];
+}
+
+// Independently posed models of one image, the actors of one mesh share a mapper. Only the selected model is in the
+// scene renderer and re-renders while it is edited, the others are locked into the Parked layer at the image
+// resolution, which is rebuilt only when the selection or the set of models changes
+struct SceneModels
+{
+    std::vector<SceneModel> Models;
+    int Selected = -1;
+    LockedOverlay Parked;
+    std::map<vtkPolyData*, vtkSmartPointer<vtkPolyDataMapper>> Mappers;        // of the scene render window
+    std::map<vtkPolyData*, vtkSmartPointer<vtkPolyDataMapper>> ParkedMappers;  // of the offscreen window of Parked
+};
+
+vtkPolyData* GetModelMesh(SceneModel const& model)
+{
+    return vtkPolyData::SafeDownCast(model.Actor->GetMapper()->GetInput());
+}
+
+vtkPolyDataMapper* GetSharedMapper(std::map<vtkPolyData*, vtkSmartPointer<vtkPolyDataMapper>>& mappers, vtkPolyData* meshData)
+{
+    auto& mapper = mappers[meshData];
+    if (mapper == nullptr)
+    {
+        mapper = vtkSmartPointer<vtkPolyDataMapper>::New();
+        mapper->SetInputData(meshData);
+    }
+    return mapper;
+}
+
+// drop the mappers of meshes no model shows anymore
+void PruneSharedMappers(SceneModels& models)
+{
+    for (auto mappers : { &models.Mappers, &models.ParkedMappers })
+        for (auto it = mappers->begin(); it != mappers->end();)
+        {
+            bool used = std::any_of(models.Models.begin(), models.Models.end(),
+                                    [&](SceneModel const& model) { return GetModelMesh(model) == it->first; });
+            it = used ? std::next(it) : mappers->erase(it);
+        }
+}
+
+// The parked layer again from every model but the selected one, one offscreen render each; like LockModelIntoOverlay
+// the caller restores its OpenGL context
+void RebuildParkedModels(SceneAndBackground& SceneAndImg, SceneModels& models, vtkImageData* imgData)
+{
+    ResetLockedOverlay(SceneAndImg, models.Parked, imgData);
+    for (int i = 0; i < static_cast<int>(models.Models.size()); ++i)
+    {
+        auto const& model = models.Models[i];
+        if (i != models.Selected)
+            LockModelIntoOverlay(model.Camera, model.Actor, models.Parked, GetSharedMapper(models.ParkedMappers, GetModelMesh(model)));
+    }
+}
+
+// start over with the scene actor as the only model, selected, whenever the image changes
+void ResetSceneModels(SceneAndBackground& SceneAndImg, SceneModels& models, std::string const& meshFileName, vtkImageData* imgData)
+{
+    for (auto const& model : models.Models)
+        if (model.Actor != SceneAndImg.SceneActor)
+            SceneAndImg.SceneRenderer->RemoveActor(model.Actor);
+
+    SceneModel model;
+    model.MeshFileName = meshFileName;
+    model.Actor = SceneAndImg.SceneActor;
+    model.Camera = vtkSmartPointer<vtkCamera>::New();
+    model.Camera->DeepCopy(SceneAndImg.SceneRenderer->GetActiveCamera());
+    auto meshData = vtkPolyData::SafeDownCast(model.Actor->GetMapper()->GetInput());
+    models.Mappers.clear();
+    model.Actor->SetMapper(GetSharedMapper(models.Mappers, meshData));
+    SetOriginalCenter(model);
+
+    models.Models = { model };
+    models.Selected = 0;
+    PruneSharedMappers(models);
+    RebuildParkedModels(SceneAndImg, models, imgData);
+}
+
+// a new model of `meshData` at the pose and with the look of the selected one, not selected yet; returns its index
+int AddSceneModel(SceneAndBackground& SceneAndImg, SceneModels& models, vtkPolyData* meshData, std::string const& meshFileName)
+{
+    SceneModel model;
+    model.MeshFileName = meshFileName;
+    model.Actor = vtkSmartPointer<vtkActor>::New();
+    model.Actor->SetMapper(GetSharedMapper(models.Mappers, meshData));
+    vtkNew<vtkProperty> property;
+    property->DeepCopy(SceneAndImg.SceneActor->GetProperty());
+    model.Actor->SetProperty(property);
+    model.Actor->SetPosition(SceneAndImg.SceneActor->GetPosition());
+    model.Camera = vtkSmartPointer<vtkCamera>::New();
+    model.Camera->DeepCopy(SceneAndImg.SceneRenderer->GetActiveCamera());
+    SetOriginalCenter(model);
+    models.Models.push_back(model);
+    return static_cast<int>(models.Models.size()) - 1;
+}
+
+// Park the selected model with the pose of the scene camera and put model `index` into the scene renderer with its
+// camera, which becomes the scene camera
+void SelectSceneModel(SceneAndBackground& SceneAndImg, SceneModels& models, int index, vtkImageData* imgData)
+{
+    if (index == models.Selected)
+        return;
+    auto sceneCamera = SceneAndImg.SceneRenderer->GetActiveCamera();
+    if (models.Selected >= 0)
+    {
+        auto& previous = models.Models[models.Selected];
+        if (previous.Camera != sceneCamera)
+            previous.Camera->DeepCopy(sceneCamera);
+        SceneAndImg.SceneRenderer->RemoveActor(previous.Actor);
+    }
+
+    auto& model = models.Models[index];
+    SceneAndImg.SceneRenderer->AddActor(model.Actor);
+    SceneAndImg.SceneRenderer->SetActiveCamera(model.Camera);
+    SceneAndImg.SceneActor = model.Actor;
+    models.Selected = index;
+    RebuildParkedModels(SceneAndImg, models, imgData);
+}
+
+// remove model `index`, the last one stays; the selection moves to its neighbor when it was selected
+void RemoveSceneModel(SceneAndBackground& SceneAndImg, SceneModels& models, int index, vtkImageData* imgData)
+{
+    if (models.Models.size() < 2)
+        return;
+    if (index == models.Selected)
+    {
+        SceneAndImg.SceneRenderer->RemoveActor(models.Models[index].Actor);
+        models.Models.erase(models.Models.begin() + index);
+        models.Selected = -1;
+        SelectSceneModel(SceneAndImg, models, std::min(index, static_cast<int>(models.Models.size()) - 1), imgData);
+    }
+    else
+    {
+        models.Models.erase(models.Models.begin() + index);
+        if (index < models.Selected)
+            --models.Selected;
+        RebuildParkedModels(SceneAndImg, models, imgData);
+    }
+    PruneSharedMappers(models);
+}
+
+// show `meshData` as the selected model, its pose and look stay
+void ChangeSceneModelMesh(SceneModels& models, vtkPolyData* meshData, std::string const& meshFileName)
+{
+    auto& model = models.Models[models.Selected];
+    model.MeshFileName = meshFileName;
+    model.Actor->SetMapper(GetSharedMapper(models.Mappers, meshData));
+    SetOriginalCenter(model);
+    PruneSharedMappers(models);
+}
+
+
+// points and triangles of a mesh for RasterizeMesh, polygons as fans and strips as their triangles
+struct RasterMeshData
+{
+    std::vector<float> Points;  // xyz
+    std::vector<std::uint32_t> Triangles;
+};
+
+RasterMeshData GetRasterMeshData(vtkPolyData* meshData)
+{
+    RasterMeshData data;
+    auto points = meshData->GetPoints();
+    data.Points.resize(static_cast<size_t>(meshData->GetNumberOfPoints()) * 3);
+    for (vtkIdType i = 0; i < meshData->GetNumberOfPoints(); ++i)
+    {
+        double p[3];
+        points->GetPoint(i, p);
+        for (int c = 0; c < 3; ++c)
+            data.Points[3 * i + c] = static_cast<float>(p[c]);
+    }
+
+    auto& triangles = data.Triangles;
+    vtkIdType n;
+    vtkIdType const* ids;
+    auto polys = meshData->GetPolys();
+    for (polys->InitTraversal(); polys->GetNextCell(n, ids);)
+        for (vtkIdType k = 2; k < n; ++k)
+            triangles.insert(triangles.end(), { static_cast<std::uint32_t>(ids[0]), static_cast<std::uint32_t>(ids[k - 1]),
+                                                static_cast<std::uint32_t>(ids[k]) });
+    auto strips = meshData->GetStrips();
+    for (strips->InitTraversal(); strips->GetNextCell(n, ids);)
+        for (vtkIdType k = 2; k < n; ++k)
+            triangles.insert(triangles.end(), { static_cast<std::uint32_t>(ids[k - 2]), static_cast<std::uint32_t>(ids[k - 1]),
+                                                static_cast<std::uint32_t>(ids[k]) });
+    return data;
+}
+
+// Silhouette mask and depth of a mesh seen by `camera` at the image size, through the ImageProjection of the image
+// like the locked overlay. `actorMatrix` places the mesh in the world (nullptr: identity); the camera clipping range
+// must enclose the mesh, the near plane clips it
+void RasterizeModel(vtkPolyData* meshData, vtkCamera* camera, vtkMatrix4x4* actorMatrix, int const img_size[2], MeshRaster& raster)
+{
+    auto mesh = GetRasterMeshData(meshData);
+    int img_extent[6] = { 0, img_size[0] - 1, 0, img_size[1] - 1, 0, 0 };
+    auto projection = GetImageProjection(camera, actorMatrix, img_extent);
+    RasterizeMesh(mesh.Points.data(), static_cast<std::int64_t>(mesh.Points.size() / 3), mesh.Triangles.data(),
+                  static_cast<std::int64_t>(mesh.Triangles.size() / 3), projection.ModelToClip, img_size, raster);
+}
+
+// `<stem>_mask.png` (8 bit) and `<stem>_depth.tif` (32 bit float), false when either cannot be written
+bool WriteMeshRaster(MeshRaster const& raster, std::string const& stem)
+{
+    auto size = static_cast<vtkIdType>(raster.Mask.size());
+
+    vtkNew<vtkImageData> mask;
+    mask->SetDimensions(raster.Size[0], raster.Size[1], 1);
+    vtkNew<vtkUnsignedCharArray> maskScalars;
+    maskScalars->SetNumberOfValues(size);
+    std::copy(raster.Mask.begin(), raster.Mask.end(), maskScalars->GetPointer(0));
+    mask->GetPointData()->SetScalars(maskScalars);
+
+    vtkNew<vtkImageData> depth;
+    depth->SetDimensions(raster.Size[0], raster.Size[1], 1);
+    vtkNew<vtkFloatArray> depthScalars;
+    depthScalars->SetNumberOfValues(size);
+    std::copy(raster.Depth.begin(), raster.Depth.end(), depthScalars->GetPointer(0));
+    depth->GetPointData()->SetScalars(depthScalars);
+
+    vtkNew<vtkPNGWriter> maskWriter;
+    maskWriter->SetFileName((stem + "_mask.png").c_str());
+    maskWriter->SetInputData(mask);
+    maskWriter->Write();
+
+    vtkNew<vtkTIFFWriter> depthWriter;
+    depthWriter->SetFileName((stem + "_depth.tif").c_str());
+    depthWriter->SetInputData(depth);
+    depthWriter->Write();
+
+    return maskWriter->GetErrorCode() == 0 && depthWriter->GetErrorCode() == 0;
+}
\ No newline at end of file
@@ -0,0 +1,376 @@
+#pragma once
+
+// Thumbnail gallery of the meshes of a directory: worker threads read every mesh, rasterize a small shaded view of it
+// on the CPU and cache it on disk under the hash of the file contents, the panel shows each thumbnail once it is done.
+// Workers start at the thumbnails on screen, the panel keeps textures only for those, so thousands of meshes scroll
+// smoothly
+
+#include <vtkSmartPointer.h>
+#include <vtkNew.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkUnsignedCharArray.h>
+#include <vtkPNGReader.h>
+#include <vtkPNGWriter.h>
+#include <vtkMath.h>
+
+#include <glad/glad.h>  // after Windows.h, like in the GUI
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "load3d.h"
+#include "mapping_mesh_to_img.h"
+#include "mesh_raster.h"
+
+// FNV-1a of the file contents, 8 bytes at a time and the tail bytewise; 0 when the file cannot be read
+std::uint64_t HashFileContents(std::string const& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return 0;
+    std::uint64_t hash = 14695981039346656037ull;
+    std::vector<char> buffer(1 << 20);
+    while (in)
+    {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        auto n = static_cast<std::size_t>(in.gcount());
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, buffer.data() + i, sizeof(word));
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+        for (; i < n; ++i)
+            hash = (hash ^ static_cast<unsigned char>(buffer[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Gray levels 1 - 255 where the mesh is and 0 elsewhere, row 0 at the bottom: the mesh seen from the front right above
+// by a perspective camera fitting its bounding sphere, lit by normals taken from the depth map. Needs no OpenGL
+// context, any thread
+std::vector<std::uint8_t> RenderMeshThumbnail(vtkPolyData* meshData, int size)
+{
+    std::vector<std::uint8_t> pixels(static_cast<std::size_t>(size) * size, 0);
+    auto mesh = GetRasterMeshData(meshData);
+    auto pointCount = static_cast<std::int64_t>(mesh.Points.size() / 3);
+    if (pointCount == 0 || mesh.Triangles.empty())
+        return pixels;
+
+    double bounds[6];
+    meshData->GetBounds(bounds);
+    double center[3] = { (bounds[0] + bounds[1]) / 2, (bounds[2] + bounds[3]) / 2, (bounds[4] + bounds[5]) / 2 };
+    double corner[3] = { bounds[1], bounds[3], bounds[5] };
+    double radius = std::sqrt(vtkMath::Distance2BetweenPoints(center, corner));
+    if (!(radius > 0))
+        return pixels;
+
+    // view of azimuth 30 and elevation 20 degrees, 30 degrees view angle
+    double a = vtkMath::RadiansFromDegrees(30.0), e = vtkMath::RadiansFromDegrees(20.0), half = vtkMath::RadiansFromDegrees(15.0);
+    double back[3] = { std::sin(a) * std::cos(e), std::sin(e), std::cos(a) * std::cos(e) };
+    double right[3] = { std::cos(a), 0, -std::sin(a) };
+    double up[3];
+    vtkMath::Cross(back, right, up);
+    double distance = radius / std::sin(half), focal = 1 / std::tan(half), nearest = 0.01 * distance;
+    double eye[3] = { center[0] + distance * back[0], center[1] + distance * back[1], center[2] + distance * back[2] };
+
+    // clip x, y = focal * view x, y, w = distance along the view direction, z + w >= 0 in front of the near plane
+    double modelToClip[16];
+    for (int i = 0; i < 3; ++i)
+    {
+        modelToClip[i] = focal * right[i];
+        modelToClip[4 + i] = focal * up[i];
+        modelToClip[8 + i] = modelToClip[12 + i] = -back[i];
+    }
+    modelToClip[3] = -focal * vtkMath::Dot(right, eye);
+    modelToClip[7] = -focal * vtkMath::Dot(up, eye);
+    modelToClip[15] = vtkMath::Dot(back, eye);
+    modelToClip[11] = modelToClip[15] - 2 * nearest;
+
+    MeshRaster raster;
+    int const rasterSize[2] = { size, size };
+    RasterizeMesh(mesh.Points.data(), pointCount, mesh.Triangles.data(), static_cast<std::int64_t>(mesh.Triangles.size() / 3),
+                  modelToClip, rasterSize, raster, false);
+
+    // the smaller one-sided depth difference, so silhouette and occlusion steps do not darken their neighbors
+    auto slope = [&](int x, int y, int dx, int dy) {
+        auto i = static_cast<std::size_t>(y) * size + x;
+        bool before = x - dx >= 0 && y - dy >= 0 && raster.Mask[i - dx - dy * size] != 0;
+        bool after = x + dx < size && y + dy < size && raster.Mask[i + dx + dy * size] != 0;
+        double backward = before ? raster.Depth[i] - raster.Depth[i - dx - dy * size] : 0;
+        double forward = after ? raster.Depth[i + dx + dy * size] - raster.Depth[i] : 0;
+        if (!before)
+            return forward;
+        if (!after)
+            return backward;
+        return std::abs(backward) < std::abs(forward) ? backward : forward;
+    };
+    double light[3] = { -0.4, 0.6, 0.7 };
+    vtkMath::Normalize(light);
+    for (int y = 0; y < size; ++y)
+        for (int x = 0; x < size; ++x)
+        {
+            auto i = static_cast<std::size_t>(y) * size + x;
+            if (raster.Mask[i] == 0)
+                continue;
+            double pixel = 2 * raster.Depth[i] / (focal * size);  // world size of a pixel at this depth
+            double normal[3] = { slope(x, y, 1, 0) / pixel, slope(x, y, 0, 1) / pixel, 1 };
+            vtkMath::Normalize(normal);
+            double lit = std::max(0.0, vtkMath::Dot(normal, light));
+            pixels[i] = static_cast<std::uint8_t>(std::min(255.0, std::max(1.0, 48 + 207 * lit)));
+        }
+    return pixels;
+}
+
+// Thumbnails of one directory, rendered or read from the disk cache by background threads
+class MeshGallery
+{
+public:
+    static constexpr int ThumbnailSize = 96;
+    enum class ThumbnailState { Pending, Ready, Failed };
+
+    MeshGallery() = default;
+    MeshGallery(MeshGallery const&) = delete;
+    MeshGallery& operator=(MeshGallery const&) = delete;
+    ~MeshGallery() { Close(); }
+
+    // every mesh file ReadPolyData reads in `directory`, sorted by name; starts the workers
+    void Open(std::string const& directory)
+    {
+        Close();
+        std::vector<std::filesystem::path> files;
+        std::error_code error;
+        for (auto const& entry : std::filesystem::directory_iterator(directory, error))
+        {
+            auto extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (entry.is_regular_file(error) && IsMeshExtension(extension))
+                files.push_back(entry.path());
+        }
+        std::sort(files.begin(), files.end());
+
+        Items = std::vector<Item>(files.size());
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            Items[i].Path = files[i].string();
+            Items[i].Name = files[i].stem().string();
+        }
+        Directory = directory;
+        CacheDirectory = std::filesystem::temp_directory_path(error) / "mesh_thumbnails";
+        std::filesystem::create_directories(CacheDirectory, error);
+
+        // one thread less than the hardware has, the UI keeps one
+        Stop = false;
+        unsigned threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        for (unsigned i = 0; i < threads && i < Items.size(); ++i)
+            Workers.emplace_back([this]() { Work(); });
+    }
+
+    // stop and join the workers, the thumbnails are dropped
+    void Close()
+    {
+        Stop = true;
+        for (auto& worker : Workers)
+            worker.join();
+        Workers.clear();
+        Items.clear();
+        Finished = 0;
+        VisibleStart = 0;
+        Directory.clear();
+    }
+
+    std::string const& GetDirectory() const { return Directory; }
+    int GetCount() const { return static_cast<int>(Items.size()); }
+    int GetFinishedCount() const { return Finished; }
+    std::string const& GetPath(int index) const { return Items[index].Path; }
+    std::string const& GetName(int index) const { return Items[index].Name; }
+    ThumbnailState GetState(int index) const { return Items[index].State.load(std::memory_order_acquire); }
+    // ThumbnailSize^2 gray levels as RenderMeshThumbnail makes them, once the state is Ready
+    std::uint8_t const* GetThumbnail(int index) const { return Items[index].Pixels.data(); }
+
+    // first thumbnail on screen, the workers take the next pending ones from there
+    void SetVisibleStart(int index) { VisibleStart = index; }
+
+private:
+    struct Item
+    {
+        std::string Path, Name;
+        std::atomic<bool> Claimed{ false };
+        std::atomic<ThumbnailState> State{ ThumbnailState::Pending };
+        std::vector<std::uint8_t> Pixels;  // written by the worker before State
+    };
+
+    static bool IsMeshExtension(std::string const& extension)
+    {
+        for (auto known : { ".ply", ".vtp", ".obj", ".stl", ".vtk", ".g" })
+            if (extension == known)
+                return true;
+        return false;
+    }
+
+    void Work()
+    {
+        for (int index = Claim(); index >= 0 && !Stop; index = Claim())
+        {
+            auto& item = Items[index];
+            bool ready = false;
+            try {
+                ready = LoadThumbnail(item);
+            }
+            catch (...) {
+            }
+            item.State.store(ready ? ThumbnailState::Ready : ThumbnailState::Failed, std::memory_order_release);
+            ++Finished;
+        }
+    }
+
+    // next unclaimed item from VisibleStart on, wrapping around; -1 when all are taken
+    int Claim()
+    {
+        int count = GetCount(), start = std::min(std::max(0, VisibleStart.load()), std::max(0, count - 1));
+        for (int k = 0; k < count; ++k)
+        {
+            int index = (start + k) % count;
+            if (!Items[index].Claimed.load(std::memory_order_relaxed) && !Items[index].Claimed.exchange(true))
+                return index;
+        }
+        return -1;
+    }
+
+    // from the cache when a file of the same contents was seen before, rendered and cached otherwise
+    bool LoadThumbnail(Item& item)
+    {
+        auto hash = HashFileContents(item.Path);
+        if (hash == 0)
+            return false;
+        auto cached = (CacheDirectory / (std::to_string(hash) + "_" + std::to_string(ThumbnailSize) + ".png")).string();
+        if (ReadCachedThumbnail(cached, item.Pixels))
+            return true;
+
+        auto polyData = ReadPolyData(item.Path.c_str());
+        if (polyData == nullptr || polyData->GetNumberOfPoints() == 0)
+            return false;
+        item.Pixels = RenderMeshThumbnail(polyData, ThumbnailSize);
+
+        vtkNew<vtkImageData> image;
+        image->SetDimensions(ThumbnailSize, ThumbnailSize, 1);
+        vtkNew<vtkUnsignedCharArray> scalars;
+        scalars->SetNumberOfValues(static_cast<vtkIdType>(item.Pixels.size()));
+        std::copy(item.Pixels.begin(), item.Pixels.end(), scalars->GetPointer(0));
+        image->GetPointData()->SetScalars(scalars);
+        vtkNew<vtkPNGWriter> writer;
+        writer->SetFileName(cached.c_str());
+        writer->SetInputData(image);
+        writer->Write();  // without a cache the thumbnail is rendered again next time
+        return true;
+    }
+
+    static bool ReadCachedThumbnail(std::string const& path, std::vector<std::uint8_t>& pixels)
+    {
+        std::error_code error;
+        if (!std::filesystem::exists(path, error))
+            return false;
+        vtkNew<vtkPNGReader> reader;
+        reader->SetFileName(path.c_str());
+        reader->Update();
+        auto image = reader->GetOutput();
+        int const* dim = image->GetDimensions();
+        if (dim[0] != ThumbnailSize || dim[1] != ThumbnailSize || image->GetScalarType() != VTK_UNSIGNED_CHAR ||
+            image->GetNumberOfScalarComponents() != 1)
+            return false;
+        auto data = static_cast<std::uint8_t const*>(image->GetScalarPointer());
+        pixels.assign(data, data + ThumbnailSize * ThumbnailSize);
+        return true;
+    }
+
+    std::vector<Item> Items;
+    std::string Directory;
+    std::filesystem::path CacheDirectory;
+    std::atomic<bool> Stop{ false };
+    std::atomic<int> VisibleStart{ 0 }, Finished{ 0 };
+    std::vector<std::thread> Workers;
+};
+
+// OpenGL textures of the thumbnails on screen: at most MaxTextures, the least recently shown are deleted beyond that,
+// and at most MaxUploadsPerFrame new ones per frame. UI thread with the GUI context current; Clear them before the
+// context is destroyed
+class ThumbnailTextures
+{
+public:
+    static constexpr std::size_t MaxTextures = 512;
+    static constexpr int MaxUploadsPerFrame = 32;
+
+    void BeginFrame()
+    {
+        ++Frame;
+        Uploads = 0;
+    }
+
+    // texture of thumbnail `index` (gray levels, 0 transparent), 0 while the uploads of this frame are used up
+    GLuint Get(int index, std::uint8_t const* pixels, int size)
+    {
+        auto found = Textures.find(index);
+        if (found != Textures.end())
+        {
+            found->second.LastUsed = Frame;
+            return found->second.Id;
+        }
+        if (Uploads >= MaxUploadsPerFrame)
+            return 0;
+        ++Uploads;
+
+        if (Textures.size() >= MaxTextures)
+        {
+            auto oldest = std::min_element(Textures.begin(), Textures.end(),
+                                           [](auto const& a, auto const& b) { return a.second.LastUsed < b.second.LastUsed; });
+            glDeleteTextures(1, &oldest->second.Id);
+            Textures.erase(oldest);
+        }
+
+        std::vector<std::uint8_t> rgba(static_cast<std::size_t>(size) * size * 4);
+        for (std::size_t i = 0; i < static_cast<std::size_t>(size) * size; ++i)
+        {
+            std::fill_n(rgba.begin() + 4 * i, 3, pixels[i]);
+            rgba[4 * i + 3] = pixels[i] != 0 ? 255 : 0;
+        }
+        GLuint id = 0;
+        glGenTextures(1, &id);
+        glBindTexture(GL_TEXTURE_2D, id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+        Textures[index] = Texture{ id, Frame };
+        return id;
+    }
+
+    void Clear()
+    {
+        for (auto const& texture : Textures)
+            glDeleteTextures(1, &texture.second.Id);
+        Textures.clear();
+    }
+
+private:
+    struct Texture
+    {
+        GLuint Id;
+        std::uint64_t LastUsed;  // frame
+    };
+
+    std::unordered_map<int, Texture> Textures;  // by thumbnail index
+    std::uint64_t Frame = 0;
+    int Uploads = 0;
+};
\ No newline at end of file
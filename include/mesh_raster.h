@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Silhouette mask and depth map of a mesh at image resolution, x fastest with row 0 at the bottom like vtkImageData
+struct MeshRaster
+{
+    int Size[2] = { 0, 0 };
+    std::vector<std::uint8_t> Mask;  // 255 where the mesh covers the pixel center, 0 elsewhere
+    std::vector<float> Depth;        // distance of the nearest surface along the view direction, 0 where the mask is 0
+};
+
+// Rasterize triangles (three point indices each) of xyz points. `modelToClip` (row-major) maps the points to homogeneous
+// clip coordinates whose w is the distance along the view direction, like camera projection * view * actor matrix in
+// VTK; the clip x, y range [-w, w] covers the image. Triangles are clipped at the near plane z = -w and drawn without
+// culling.
+// The image is split into 64x64 pixel tiles, the triangles are set up and binned into the tiles they overlap in
+// parallel chunks, and the tiles are rasterized in parallel in chunk order, so the result does not depend on threading.
+// `parallel` false runs it all on the calling thread, for callers that rasterize many small views in parallel
+void RasterizeMesh(float const* points, std::int64_t pointCount, std::uint32_t const* triangles, std::int64_t triangleCount,
+                   double const modelToClip[16], int const size[2], MeshRaster& raster, bool parallel = true);
\ No newline at end of file
@@ -10,6 +10,7 @@ struct CameraParameters
     double elevation;
     double distance;
     double inplane_rotation;
+    double view_angle;  // vertical, degrees; files written before it was saved read as the VTK default 30
     int principal_point[2];
 
     double camera_position[3];
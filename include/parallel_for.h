@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Run fn(begin, end) over [first, last) in chunks of `grain` items on all hardware threads,
+// chunks are handed out through an atomic counter so uneven chunks balance themselves out
+template <typename Fn>
+void ParallelFor(std::int64_t first, std::int64_t last, std::int64_t grain, Fn&& fn)
+{
+    if (last <= first)
+        return;
+    grain = std::max<std::int64_t>(grain, 1);
+    std::int64_t chunks = (last - first + grain - 1) / grain;
+    auto workers = static_cast<std::int64_t>(std::max(1u, std::thread::hardware_concurrency()));
+    workers = std::min(workers, chunks);
+
+    std::atomic<std::int64_t> next{ 0 };
+    auto work = [&]() {
+        for (std::int64_t chunk = next++; chunk < chunks; chunk = next++)
+        {
+            std::int64_t begin = first + chunk * grain;
+            fn(begin, std::min(begin + grain, last));
+        }
+    };
+
+    // the calling thread is one of the workers
+    std::vector<std::thread> threads;
+    threads.reserve(static_cast<size_t>(workers - 1));
+    for (std::int64_t i = 1; i < workers; ++i)
+        threads.emplace_back(work);
+    work();
+    for (auto& t : threads)
+        t.join();
+}
+
+// Run fn(item) for every item of [0, count) on all hardware threads, count < 2^32. Every thread starts on its own
+// contiguous share of the items and once that is done steals the back half of the fullest other share, so neighboring
+// items (e.g. image tiles) mostly stay on one thread while uneven items still balance out
+template <typename Fn>
+void WorkStealingFor(std::int64_t count, Fn&& fn)
+{
+    if (count <= 0)
+        return;
+    auto workers = static_cast<std::int64_t>(std::max(1u, std::thread::hardware_concurrency()));
+    workers = std::min(workers, count);
+
+    // [begin, end) of a share packed into one word, the owner takes from the front and thieves from the back
+    struct alignas(64) Share
+    {
+        std::atomic<std::uint64_t> Range;
+    };
+    auto pack = [](std::uint64_t begin, std::uint64_t end) { return begin << 32 | end; };
+    std::vector<Share> shares(static_cast<size_t>(workers));
+    for (std::int64_t i = 0; i < workers; ++i)
+        shares[i].Range = pack(count * i / workers, count * (i + 1) / workers);
+
+    auto work = [&](std::int64_t self) {
+        auto& own = shares[self].Range;
+        for (;;)
+        {
+            auto range = own.load();
+            auto begin = range >> 32, end = range & 0xffffffffu;
+            if (begin < end)
+            {
+                if (own.compare_exchange_weak(range, pack(begin + 1, end)))
+                    fn(static_cast<std::int64_t>(begin));
+                continue;
+            }
+
+            // items are never added, so once every share is empty the work is done
+            for (;;)
+            {
+                Share* victim = nullptr;
+                std::uint64_t most = 0;
+                for (auto& share : shares)
+                {
+                    auto r = share.Range.load();
+                    auto left = (r & 0xffffffffu) - std::min(r >> 32, r & 0xffffffffu);
+                    if (left > most)
+                    {
+                        most = left;
+                        victim = &share;
+                    }
+                }
+                if (victim == nullptr)
+                    return;
+                auto r = victim->Range.load();
+                auto vb = r >> 32, ve = r & 0xffffffffu;
+                if (vb >= ve)
+                    continue;
+                auto take = (ve - vb + 1) / 2;
+                if (victim->Range.compare_exchange_weak(r, pack(vb, ve - take)))
+                {
+                    own.store(pack(ve - take, ve));
+                    break;
+                }
+            }
+        }
+    };
+
+    // the calling thread is one of the workers
+    std::vector<std::thread> threads;
+    threads.reserve(static_cast<size_t>(workers - 1));
+    for (std::int64_t i = 1; i < workers; ++i)
+        threads.emplace_back(work, i);
+    work(0);
+    for (auto& t : threads)
+        t.join();
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+
+// Undo / redo of pose edits in the Overlay: every edit stores the pose from before it as a few doubles, restoring one
+// only sets the camera and model position again, no VTK object is rebuilt
+
+#include <vtkCamera.h>
+#include <vtkActor.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+
+// everything the pose controls change: the scene camera, whose roll is part of the view up and whose zoom is the view
+// angle, and the model position
+struct PoseSnapshot
+{
+    double Position[3], FocalPoint[3], ViewUp[3];
+    double ViewAngle;
+    double ModelPosition[3];
+
+    bool operator==(PoseSnapshot const& other) const
+    {
+        return std::equal(Position, Position + 3, other.Position) && std::equal(FocalPoint, FocalPoint + 3, other.FocalPoint) &&
+               std::equal(ViewUp, ViewUp + 3, other.ViewUp) && ViewAngle == other.ViewAngle &&
+               std::equal(ModelPosition, ModelPosition + 3, other.ModelPosition);
+    }
+};
+
+PoseSnapshot CapturePose(vtkCamera* camera, vtkActor* actor)
+{
+    PoseSnapshot pose;
+    camera->GetPosition(pose.Position);
+    camera->GetFocalPoint(pose.FocalPoint);
+    camera->GetViewUp(pose.ViewUp);
+    pose.ViewAngle = camera->GetViewAngle();
+    actor->GetPosition(pose.ModelPosition);
+    return pose;
+}
+
+void RestorePose(PoseSnapshot const& pose, vtkCamera* camera, vtkActor* actor)
+{
+    camera->SetPosition(pose.Position);
+    camera->SetFocalPoint(pose.FocalPoint);
+    camera->SetViewUp(pose.ViewUp);
+    camera->SetViewAngle(pose.ViewAngle);
+    actor->SetPosition(pose.ModelPosition);
+}
+
+// Poses before the recent edits and the ones undone since, the oldest are dropped beyond MaxEntries
+class PoseHistory
+{
+public:
+    static constexpr std::size_t MaxEntries = 256;
+
+    // the pose before an edit; edits over many frames (a slider drag, a held button) record once, when they start
+    void Record(PoseSnapshot const& pose)
+    {
+        Redone.clear();
+        if (!Undone.empty() && Undone.back() == pose)
+            return;
+        Undone.push_back(pose);
+        if (Undone.size() > MaxEntries)
+            Undone.pop_front();
+    }
+
+    // the pose to go back to from `current`, false when there is none different from it
+    bool Undo(PoseSnapshot const& current, PoseSnapshot& pose) { return Step(Undone, Redone, current, pose); }
+    bool Redo(PoseSnapshot const& current, PoseSnapshot& pose) { return Step(Redone, Undone, current, pose); }
+
+    bool CanUndo() const { return !Undone.empty(); }
+    bool CanRedo() const { return !Redone.empty(); }
+
+    void Clear()
+    {
+        Undone.clear();
+        Redone.clear();
+    }
+
+private:
+    // entries equal to `current` were edits that changed nothing, they are skipped
+    static bool Step(std::deque<PoseSnapshot>& from, std::deque<PoseSnapshot>& to, PoseSnapshot const& current, PoseSnapshot& pose)
+    {
+        while (!from.empty() && from.back() == current)
+            from.pop_back();
+        if (from.empty())
+            return false;
+        pose = from.back();
+        from.pop_back();
+        to.push_back(current);
+        return true;
+    }
+
+    std::deque<PoseSnapshot> Undone, Redone;
+};
\ No newline at end of file
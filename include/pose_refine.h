@@ -0,0 +1,486 @@
+#pragma once
+
+// Automatic pose refinement: moves the scene camera and model so the silhouette of the model lines up with the edges
+// of the background image. The image is reduced to an edge distance map once, every candidate pose is scored by the
+// mean distance from the contour of its rasterized silhouette to the nearest image edge, and a pattern search over the
+// camera rotations, distance and model offset evaluates its candidates in parallel on a worker thread.
+// A starting pose comes from silhouette templates of the mesh: the view whose silhouette contour lies best on the edges
+// of the image crop the model currently covers, with the camera dollied and the model moved onto that crop
+
+#include <vtkSmartPointer.h>
+#include <vtkNew.h>
+#include <vtkCamera.h>
+#include <vtkMatrix4x4.h>
+#include <vtkImageData.h>
+#include <vtkPolyData.h>
+#include <vtkPointData.h>
+#include <vtkDataArray.h>
+#include <vtkActor.h>
+#include <vtkMath.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "image_projection.h"
+#include "mapping_mesh_to_img.h"
+#include "mesh_raster.h"
+#include "parallel_for.h"
+#include "silhouette_templates.h"
+
+// change from the pose a refinement starts at: camera rotations in degrees like the Overlay sliders, the dolly factor
+// (the camera distance divided by it, the view angle is kept) and the model moved along the camera's right / up axes
+// in world units
+struct PoseDelta
+{
+    double Azimuth = 0, Elevation = 0, Roll = 0, Dolly = 1;
+    double Right = 0, Up = 0;
+};
+
+// change `camera` (at the start pose) by `delta`, `offset` is the world translation to add to the model position
+void ApplyPoseDelta(vtkCamera* camera, PoseDelta const& delta, double offset[3])
+{
+    camera->Azimuth(delta.Azimuth);
+    camera->Elevation(delta.Elevation);
+    camera->OrthogonalizeViewUp();
+    camera->Roll(delta.Roll);
+    // the clipping range moves with the camera so a closer camera does not cut the model at the near plane
+    double range[2];
+    camera->GetClippingRange(range);
+    double closer = camera->GetDistance();
+    camera->Dolly(delta.Dolly);
+    closer -= camera->GetDistance();
+    camera->SetClippingRange(std::max(range[0] - closer, camera->GetDistance() * 1e-3), range[1] - closer);
+
+    double direction[3], up[3], right[3];
+    camera->GetDirectionOfProjection(direction);
+    camera->GetViewUp(up);
+    right[0] = direction[1] * up[2] - direction[2] * up[1];
+    right[1] = direction[2] * up[0] - direction[0] * up[2];
+    right[2] = direction[0] * up[1] - direction[1] * up[0];
+    for (int i = 0; i < 3; ++i)
+        offset[i] = delta.Right * right[i] + delta.Up * up[i];
+}
+
+// best pose so far, published by the search and taken by the UI once per frame
+class PoseRefineProgress
+{
+public:
+    void Publish(PoseDelta const& delta, double score, int iteration)
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Best = delta;
+        Score = score;
+        Iteration = iteration;
+        Changed = true;
+    }
+
+    // true when a pose was published since the last call
+    bool Take(PoseDelta& delta, double& score, int& iteration)
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (!Changed)
+            return false;
+        delta = Best;
+        score = Score;
+        iteration = Iteration;
+        Changed = false;
+        return true;
+    }
+
+private:
+    std::mutex Mutex;
+    PoseDelta Best;
+    double Score = 0;
+    int Iteration = 0;
+    bool Changed = false;
+};
+
+// Everything a refinement reads, copied on the UI thread, so scoring never touches the scene objects
+class PoseRefineProblem
+{
+public:
+    static constexpr int MaxEdgeMapSide = 320;       // pixels of the longer side of the edge distance map
+    static constexpr double EdgePercentile = 0.85;   // gradient magnitudes above it count as edges
+    static constexpr double MaxDistance = 0.05;      // of the longer side, distances are truncated to it
+
+    PoseRefineProblem(vtkImageData* image, vtkPolyData* mesh, vtkCamera* camera, vtkMatrix4x4* actorMatrix)
+        : Mesh(GetRasterMeshData(mesh))
+    {
+        camera->GetPosition(Position);
+        camera->GetFocalPoint(FocalPoint);
+        camera->GetViewUp(ViewUp);
+        ViewAngle = camera->GetViewAngle();
+        camera->GetClippingRange(ClippingRange);
+        std::copy_n(&actorMatrix->Element[0][0], 16, ActorMatrix);
+        BuildEdgeDistance(image);
+    }
+
+    // mean truncated distance in edge map pixels from the silhouette contour to the image edges, +inf when the
+    // silhouette has no contour inside the image; single-threaded, any number of poses can be scored concurrently
+    double Score(PoseDelta const& delta) const
+    {
+        vtkNew<vtkCamera> camera;
+        SetupStartCamera(camera);
+        double offset[3];
+        ApplyPoseDelta(camera, delta, offset);
+        vtkNew<vtkMatrix4x4> actorMatrix;
+        actorMatrix->DeepCopy(ActorMatrix);
+        for (int i = 0; i < 3; ++i)
+            actorMatrix->SetElement(i, 3, ActorMatrix[4 * i + 3] + offset[i]);
+
+        int extent[6] = { 0, Size[0] - 1, 0, Size[1] - 1, 0, 0 };
+        auto projection = GetImageProjection(camera, actorMatrix, extent);
+        MeshRaster raster;
+        RasterizeMesh(Mesh.Points.data(), static_cast<std::int64_t>(Mesh.Points.size() / 3), Mesh.Triangles.data(),
+                      static_cast<std::int64_t>(Mesh.Triangles.size() / 3), projection.ModelToClip, Size, raster, false);
+
+        // mask pixels next to a pixel of the image outside the mask, the image border is no contour
+        double sum = 0;
+        std::int64_t count = 0;
+        auto const& mask = raster.Mask;
+        for (int y = 0; y < Size[1]; ++y)
+            for (int x = 0; x < Size[0]; ++x)
+            {
+                auto i = static_cast<std::size_t>(y) * Size[0] + x;
+                if (mask[i] == 0)
+                    continue;
+                bool contour = (x > 0 && mask[i - 1] == 0) || (x + 1 < Size[0] && mask[i + 1] == 0) ||
+                               (y > 0 && mask[i - Size[0]] == 0) || (y + 1 < Size[1] && mask[i + Size[0]] == 0);
+                if (contour)
+                {
+                    sum += Distance[i];
+                    ++count;
+                }
+            }
+        return count > 0 ? sum / count : std::numeric_limits<double>::infinity();
+    }
+
+    void SetupStartCamera(vtkCamera* camera) const
+    {
+        camera->SetPosition(Position);
+        camera->SetFocalPoint(FocalPoint);
+        camera->SetViewUp(ViewUp);
+        camera->SetViewAngle(ViewAngle);
+        camera->SetClippingRange(ClippingRange);
+    }
+
+    double GetDistance() const
+    {
+        double d[3] = { FocalPoint[0] - Position[0], FocalPoint[1] - Position[1], FocalPoint[2] - Position[2] };
+        return std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    }
+
+    int const* GetEdgeMapSize() const { return Size; }
+
+private:
+    // gray image reduced to the edge map size, Sobel magnitude, the strongest gradients as edges, and their exact
+    // Euclidean distance transform
+    void BuildEdgeDistance(vtkImageData* image)
+    {
+        int const* dim = image->GetDimensions();
+        double scale = std::min(1.0, double(MaxEdgeMapSide) / std::max(dim[0], dim[1]));
+        Size[0] = std::max(1, static_cast<int>(std::lround(dim[0] * scale)));
+        Size[1] = std::max(1, static_cast<int>(std::lround(dim[1] * scale)));
+        auto pixels = static_cast<std::size_t>(Size[0]) * Size[1];
+
+        // box average of at most 4x4 samples per edge map pixel
+        vtkDataArray* scalars = image->GetPointData()->GetScalars();
+        int components = std::min(3, scalars->GetNumberOfComponents());
+        std::vector<float> gray(pixels);
+        ParallelFor(0, Size[1], 16, [&](std::int64_t begin, std::int64_t end) {
+            for (std::int64_t y = begin; y < end; ++y)
+                for (int x = 0; x < Size[0]; ++x)
+                {
+                    int x0 = static_cast<int>(std::int64_t(x) * dim[0] / Size[0]), x1 = static_cast<int>(std::int64_t(x + 1) * dim[0] / Size[0]);
+                    int y0 = static_cast<int>(y * dim[1] / Size[1]), y1 = static_cast<int>((y + 1) * dim[1] / Size[1]);
+                    int sx = std::max(1, (x1 - x0) / 4), sy = std::max(1, (y1 - y0) / 4);
+                    double sum = 0;
+                    int n = 0;
+                    for (int v = y0; v < std::max(y1, y0 + 1); v += sy)
+                        for (int u = x0; u < std::max(x1, x0 + 1); u += sx)
+                        {
+                            vtkIdType id = u + static_cast<vtkIdType>(v) * dim[0];
+                            for (int c = 0; c < components; ++c)
+                                sum += scalars->GetComponent(id, c);
+                            n += components;
+                        }
+                    gray[y * Size[0] + x] = static_cast<float>(sum / n);
+                }
+        });
+
+        std::vector<float> magnitude(pixels, 0.0f);
+        for (int y = 1; y + 1 < Size[1]; ++y)
+            for (int x = 1; x + 1 < Size[0]; ++x)
+            {
+                auto g = [&](int dx, int dy) { return gray[(y + dy) * Size[0] + x + dx]; };
+                float gx = g(1, -1) + 2 * g(1, 0) + g(1, 1) - g(-1, -1) - 2 * g(-1, 0) - g(-1, 1);
+                float gy = g(-1, 1) + 2 * g(0, 1) + g(1, 1) - g(-1, -1) - 2 * g(0, -1) - g(1, -1);
+                magnitude[y * Size[0] + x] = std::sqrt(gx * gx + gy * gy);
+            }
+        auto sorted = magnitude;
+        auto nth = sorted.begin() + static_cast<std::ptrdiff_t>(EdgePercentile * (pixels - 1));
+        std::nth_element(sorted.begin(), nth, sorted.end());
+        float threshold = std::max(*nth, std::numeric_limits<float>::min());
+
+        // separable squared distance transform (Felzenszwalb & Huttenlocher), columns then rows
+        constexpr double Far = 1e20;
+        std::vector<double> squared(pixels);
+        for (std::size_t i = 0; i < pixels; ++i)
+            squared[i] = magnitude[i] >= threshold ? 0 : Far;
+        int longest = std::max(Size[0], Size[1]);
+        std::vector<double> f(longest), d(longest), z(longest + 1);
+        std::vector<int> v(longest);
+        auto transform = [&](int n) {
+            int k = 0;
+            v[0] = 0;
+            z[0] = -Far;
+            z[1] = Far;
+            for (int q = 1; q < n; ++q)
+            {
+                double s;
+                while ((s = ((f[q] + double(q) * q) - (f[v[k]] + double(v[k]) * v[k])) / (2.0 * q - 2.0 * v[k])) <= z[k])
+                    --k;
+                ++k;
+                v[k] = q;
+                z[k] = s;
+                z[k + 1] = Far;
+            }
+            k = 0;
+            for (int q = 0; q < n; ++q)
+            {
+                while (z[k + 1] < q)
+                    ++k;
+                d[q] = double(q - v[k]) * (q - v[k]) + f[v[k]];
+            }
+        };
+        for (int x = 0; x < Size[0]; ++x)
+        {
+            for (int y = 0; y < Size[1]; ++y)
+                f[y] = squared[y * Size[0] + x];
+            transform(Size[1]);
+            for (int y = 0; y < Size[1]; ++y)
+                squared[y * Size[0] + x] = d[y];
+        }
+        double maxDistance = MaxDistance * longest;
+        Distance.resize(pixels);
+        for (int y = 0; y < Size[1]; ++y)
+        {
+            std::copy_n(squared.begin() + static_cast<std::ptrdiff_t>(y) * Size[0], Size[0], f.begin());
+            transform(Size[0]);
+            for (int x = 0; x < Size[0]; ++x)
+                Distance[y * Size[0] + x] = static_cast<float>(std::min(std::sqrt(d[x]), maxDistance));
+        }
+    }
+
+    RasterMeshData Mesh;
+    double Position[3], FocalPoint[3], ViewUp[3], ViewAngle, ClippingRange[2];
+    double ActorMatrix[16];
+    int Size[2];                  // of the edge distance map
+    std::vector<float> Distance;  // to the nearest edge, truncated, x fastest from the lower left like the image
+};
+
+// Pattern search from the start pose: every iteration scores a step up and down each of azimuth, elevation, roll,
+// log dolly and the right / up offsets in parallel, moves to the best one when it improves and halves all steps when
+// none does. Every improvement is published to `progress`; returns the best pose when the steps got small or on cancel
+PoseDelta RefinePose(PoseRefineProblem const& problem, PoseRefineProgress& progress, std::atomic<bool> const& cancel)
+{
+    constexpr int Parameters = 6;
+    constexpr int MaxIterations = 200;
+    double distance = problem.GetDistance();
+    double step[Parameters] = { 8, 8, 5, 0.1, 0.04 * distance, 0.04 * distance };
+    double const minStep = step[0] / 32;
+    double const limit[Parameters] = { 45, 45, 45, std::log(2.0), 0.5 * distance, 0.5 * distance };
+
+    auto toDelta = [](double const p[Parameters]) {
+        PoseDelta delta;
+        delta.Azimuth = p[0];
+        delta.Elevation = p[1];
+        delta.Roll = p[2];
+        delta.Dolly = std::exp(p[3]);
+        delta.Right = p[4];
+        delta.Up = p[5];
+        return delta;
+    };
+
+    double current[Parameters] = { 0, 0, 0, 0, 0, 0 };
+    double score = problem.Score(toDelta(current));
+    progress.Publish(toDelta(current), score, 0);
+
+    for (int iteration = 1; iteration <= MaxIterations && step[0] >= minStep && !cancel; ++iteration)
+    {
+        std::vector<std::array<double, Parameters>> candidates;
+        for (int p = 0; p < Parameters; ++p)
+            for (double sign : { -1.0, 1.0 })
+            {
+                std::array<double, Parameters> candidate;
+                std::copy_n(current, Parameters, candidate.begin());
+                candidate[p] = std::min(limit[p], std::max(-limit[p], current[p] + sign * step[p]));
+                if (candidate[p] != current[p])
+                    candidates.push_back(candidate);
+            }
+
+        std::vector<double> scores(candidates.size());
+        ParallelFor(0, static_cast<std::int64_t>(candidates.size()), 1, [&](std::int64_t begin, std::int64_t end) {
+            for (std::int64_t i = begin; i < end; ++i)
+                scores[i] = problem.Score(toDelta(candidates[i].data()));
+        });
+
+        auto best = std::min_element(scores.begin(), scores.end());
+        if (best != scores.end() && *best < score - 1e-6)
+        {
+            score = *best;
+            std::copy_n(candidates[best - scores.begin()].begin(), Parameters, current);
+            progress.Publish(toDelta(current), score, iteration);
+        }
+        else
+            for (auto& s : step)
+                s *= 0.5;
+    }
+    return toDelta(current);
+}
+
+// every 10 degrees of azimuth and of elevation up to 80 degrees above and below the model
+constexpr int TemplateAzimuthSteps = 36, TemplateElevationSteps = 17;
+constexpr double TemplateMaxElevation = 80;
+
+// Templates of the mesh read from `<mesh file>.silhouettes`, or from the temp directory when the mesh directory is not
+// writable; rasterized and written there when neither holds templates of this mesh. nullptr when cancelled
+std::shared_ptr<SilhouetteTemplates const> LoadSilhouetteTemplates(RasterMeshData const& mesh, std::string const& meshFileName,
+                                                                   std::atomic<bool> const& cancel)
+{
+    auto pointCount = static_cast<std::int64_t>(mesh.Points.size() / 3);
+    auto triangleCount = static_cast<std::int64_t>(mesh.Triangles.size() / 3);
+    auto hash = HashMesh(mesh.Points.data(), pointCount, mesh.Triangles.data(), triangleCount);
+
+    std::vector<std::string> paths{ meshFileName + ".silhouettes" };
+    std::error_code error;
+    auto temp = std::filesystem::temp_directory_path(error);
+    if (!error)
+        paths.push_back((temp / (std::filesystem::path(meshFileName).stem().string() + "_" + std::to_string(hash) + ".silhouettes")).string());
+
+    auto templates = std::make_shared<SilhouetteTemplates>();
+    for (auto const& path : paths)
+        if (ReadSilhouetteTemplates(path, *templates) && templates->MeshHash == hash &&
+            templates->AzimuthSteps == TemplateAzimuthSteps && templates->ElevationSteps == TemplateElevationSteps &&
+            templates->MaxElevation == TemplateMaxElevation)
+            return templates;
+
+    if (!BuildSilhouetteTemplates(mesh.Points.data(), pointCount, mesh.Triangles.data(), triangleCount, TemplateAzimuthSteps,
+                                  TemplateElevationSteps, TemplateMaxElevation, *templates, &cancel))
+        return nullptr;
+    for (auto const& path : paths)
+        if (WriteSilhouetteTemplates(*templates, path))
+            break;
+    return templates;
+}
+
+// pixel bounds x0, y0, x1, y1 of the model in the image, false when no point is in front of the camera
+bool GetModelImageBox(RasterMeshData const& mesh, vtkCamera* camera, vtkMatrix4x4* actorMatrix, int const img_extent[6], float box[4])
+{
+    ProjectedPoints projected;
+    ProjectPoints(GetImageProjection(camera, actorMatrix, img_extent), mesh.Points.data(),
+                  static_cast<std::int64_t>(mesh.Points.size() / 3), projected);
+    std::copy_n(projected.Box, 4, box);
+    return box[0] <= box[2];
+}
+
+// Edges of the square around `box` (image pixels) that a template would put the object bounding box in, box-sampled
+// to the template size; pixels outside the image repeat the border
+SilhouetteQuery MakeImageSilhouetteQuery(vtkImageData* image, float const box[4])
+{
+    constexpr int Side = SilhouetteTemplates::Side;
+    int const* dim = image->GetDimensions();
+    double side = std::max(box[2] - box[0], box[3] - box[1]) / (1 - 2 * SilhouetteTemplates::Margin);
+    double x0 = (box[0] + box[2]) / 2 - side / 2, y0 = (box[1] + box[3]) / 2 - side / 2, cell = side / Side;
+
+    vtkDataArray* scalars = image->GetPointData()->GetScalars();
+    int components = std::min(3, scalars->GetNumberOfComponents());
+    std::vector<float> gray(Side * Side);
+    for (int y = 0; y < Side; ++y)
+        for (int x = 0; x < Side; ++x)
+        {
+            double sum = 0;
+            for (int j = 0; j < 4; ++j)
+                for (int i = 0; i < 4; ++i)
+                {
+                    int u = std::min(dim[0] - 1, std::max(0, static_cast<int>(std::floor(x0 + (x + (i + 0.5) / 4) * cell))));
+                    int v = std::min(dim[1] - 1, std::max(0, static_cast<int>(std::floor(y0 + (y + (j + 0.5) / 4) * cell))));
+                    vtkIdType id = u + static_cast<vtkIdType>(v) * dim[0];
+                    for (int c = 0; c < components; ++c)
+                        sum += scalars->GetComponent(id, c);
+                }
+            gray[y * Side + x] = static_cast<float>(sum / (16 * components));
+        }
+    return MakeSilhouetteQuery(gray.data());
+}
+
+// Turn the camera around its focal point to the view of `match`, keeping its distance, then dolly it and move the
+// model so its image bounding box covers `box`. The focal point stays where SetupModelRender put it (the saved camera
+// parameters take the model mass center as the focal point plus the scene movement), so the model is only ever
+// translated with the actor position. The template views have no roll, Refine Pose takes it from there
+void ApplyTemplateView(SilhouetteMatch const& match, RasterMeshData const& mesh, float const box[4], vtkCamera* camera,
+                       vtkActor* actor, int const img_extent[6])
+{
+    double a = vtkMath::RadiansFromDegrees(match.Azimuth), e = vtkMath::RadiansFromDegrees(match.Elevation);
+    double back[3] = { std::sin(a) * std::cos(e), std::sin(e), std::cos(a) * std::cos(e) };
+    double modelUp[3] = { 0, 1, 0 };
+    double worldBack[3], worldUp[3];
+    vtkMatrix4x4* matrix = actor->GetMatrix();
+    for (int i = 0; i < 3; ++i)
+    {
+        worldBack[i] = worldUp[i] = 0;
+        for (int j = 0; j < 3; ++j)
+        {
+            worldBack[i] += matrix->GetElement(i, j) * back[j];
+            worldUp[i] += matrix->GetElement(i, j) * modelUp[j];
+        }
+    }
+    vtkMath::Normalize(worldBack);
+    vtkMath::Normalize(worldUp);
+
+    double focal[3];
+    camera->GetFocalPoint(focal);
+    double distance = camera->GetDistance();
+    camera->SetPosition(focal[0] + distance * worldBack[0], focal[1] + distance * worldBack[1], focal[2] + distance * worldBack[2]);
+    camera->SetViewUp(worldUp);
+    camera->OrthogonalizeViewUp();
+
+    // the model center onto the focal point, the dolly then scales the model about it
+    double const* center = actor->GetCenter();
+    actor->AddPosition(focal[0] - center[0], focal[1] - center[1], focal[2] - center[2]);
+
+    float modelBox[4];
+    if (!GetModelImageBox(mesh, camera, actor->GetMatrix(), img_extent, modelBox))
+        return;
+    double modelSide = std::max(modelBox[2] - modelBox[0], modelBox[3] - modelBox[1]);
+    if (modelSide > 0)
+        camera->Dolly(std::min(10.0, std::max(0.1, std::max(box[2] - box[0], box[3] - box[1]) / modelSide)));
+    if (!GetModelImageBox(mesh, camera, actor->GetMatrix(), img_extent, modelBox))
+        return;
+
+    // pixels per world unit at the model center along the camera right axis, the same along up
+    double direction[3], up[3], right[3];
+    camera->GetDirectionOfProjection(direction);
+    camera->GetViewUp(up);
+    vtkMath::Cross(direction, up, right);
+    auto projection = GetImageProjection(camera, nullptr, img_extent);
+    double beside[3] = { focal[0] + right[0], focal[1] + right[1], focal[2] + right[2] };
+    double p0[2], p1[2];
+    if (!ProjectPoint(projection, focal, p0) || !ProjectPoint(projection, beside, p1) || p1[0] == p0[0])
+        return;
+    double scale = 1 / (p1[0] - p0[0]);
+    double shift[2] = { scale * ((box[0] + box[2]) - (modelBox[0] + modelBox[2])) / 2,
+                        scale * ((box[1] + box[3]) - (modelBox[1] + modelBox[3])) / 2 };
+    actor->AddPosition(shift[0] * right[0] + shift[1] * up[0], shift[0] * right[1] + shift[1] * up[1],
+                       shift[0] * right[2] + shift[1] * up[2]);
+}
\ No newline at end of file
@@ -7,15 +7,32 @@
 #include <vtkOpenGLGPUVolumeRayCastMapper.h>
 #include <vtkSmartVolumeMapper.h>
 #include <vtkPolyData.h>
+#include <vtkCellArray.h>
 #include <vtkColorTransferFunction.h>
 #include <vtkPiecewiseFunction.h>
 #include <vtkVolume.h>
 #include <vtkVolumeProperty.h>
 #include <vtkContourValues.h>
+#include <vtkImageShrink3D.h>
+#include <vtkFlyingEdges3D.h>
+#include <vtkPolyDataMapper.h>
+#include <vtkActor.h>
+#include <vtkProperty.h>
+#include <vtkRenderer.h>
+#include <vtkRenderWindow.h>
+#include <vtkCamera.h>
+#include <vtkObjectFactory.h>
+#include <vtkWeakPointer.h>
+#include <vtkMatrix4x4.h>
+#include <vtkRayCastImageDisplayHelper.h>
+#include <vtkImageAlgorithm.h>
+#include <vtkInformation.h>
+#include <vtkInformationVector.h>
+#include <vtkStreamingDemandDrivenPipeline.h>
 
 #include <vtkPolyDataToImageStencil.h>
 #include <vtkImageData.h>
-#include <vtkImageStencil.h>
+#include <vtkImageStencilData.h>
 #include <vtkPointData.h>
 
 #include <vtkActor2D.h>
@@ -23,6 +40,10 @@
 #include <vtkTextProperty.h>
 
 #include <vtkPlane.h>
+#include <vtkPlaneCollection.h>
+#include <vtkImplicitPlaneWidget2.h>
+#include <vtkImplicitPlaneRepresentation.h>
+#include <vtkCallbackCommand.h>
 
 #include <vtkAxesActor.h>
 #include <vtkCaptionActor2D.h>
@@ -33,83 +54,548 @@
 
 #include <vtksys/SystemTools.hxx>
 
+#include "voxelize_parity.h"
+#include "volume_raycast.h"
+#include "bricked_volume.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <map>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <vector>
 
 namespace {
-	// Require STL mesh data, need adjust spacing and sample distance for good volume rendering
-	// https://vedo.embl.es/autodocs/_modules/vedo/volume.html
-	vtkSmartPointer<vtkImageData> ConvertMeshPolyDataToImageData(vtkSmartPointer<vtkPolyData> polyData, 
-		                                                         double const spacing[3])  // desired volume spacing
-	{
-		vtkNew<vtkImageData> whiteImage;
-		double bounds[6];
-		polyData->GetBounds(bounds);
-		whiteImage->SetSpacing(spacing);
+	// Scalar types of the mesh-to-volume path: inside voxels hold FullScale, or the covered fraction of it for
+	// anti-aliased (subsampled) voxelizations
+	template <typename T> struct VoxelTraits;
+	template <> struct VoxelTraits<unsigned char> {
+		static constexpr int VTKType = VTK_UNSIGNED_CHAR;
+		static constexpr RayCastScalar Scalar = RayCastScalar::UnsignedChar;
+		static constexpr unsigned char FullScale = 255;
+		static constexpr char const* MetaType = "MET_UCHAR";
+	};
+	template <> struct VoxelTraits<unsigned short> {
+		static constexpr int VTKType = VTK_UNSIGNED_SHORT;
+		static constexpr RayCastScalar Scalar = RayCastScalar::UnsignedShort;
+		static constexpr unsigned short FullScale = 65535;
+		static constexpr char const* MetaType = "MET_USHORT";
+	};
+	template <> struct VoxelTraits<float> {
+		static constexpr int VTKType = VTK_FLOAT;
+		static constexpr RayCastScalar Scalar = RayCastScalar::Float;
+		static constexpr float FullScale = 1.0f;
+		static constexpr char const* MetaType = "MET_FLOAT";
+	};
 
-		// compute dimensions
+	// voxel grid covering the mesh bounds at the desired spacing, voxel centers sit half a spacing inside the bounds
+	struct VoxelGrid {
 		int dim[3];
+		double origin[3];
+		double spacing[3];
+
+		vtkIdType SliceSize() const { return static_cast<vtkIdType>(dim[0]) * dim[1]; }
+		vtkIdType NumberOfVoxels() const { return SliceSize() * dim[2]; }
+	};
+
+	VoxelGrid ComputeVoxelGrid(double const bounds[6], double const spacing[3])
+	{
+		VoxelGrid grid;
 		for (int i = 0; i < 3; i++)
 		{
-			dim[i] = static_cast<int>(
+			grid.dim[i] = static_cast<int>(
 				ceil((bounds[i * 2 + 1] - bounds[i * 2]) / spacing[i]));
+			grid.origin[i] = bounds[i * 2] + spacing[i] / 2;
+			grid.spacing[i] = spacing[i];
 		}
-		whiteImage->SetDimensions(dim);
-		whiteImage->SetExtent(0, dim[0] - 1, 0, dim[1] - 1, 0, dim[2] - 1);
+		return grid;
+	}
 
-		double origin[3];
-		origin[0] = bounds[0] + spacing[0] / 2;
-		origin[1] = bounds[2] + spacing[1] / 2;
-		origin[2] = bounds[4] + spacing[2] / 2;
-		whiteImage->SetOrigin(origin);
-		whiteImage->AllocateScalars(VTK_UNSIGNED_CHAR, 1);
-
-		// fill the image with foreground voxels:
-		unsigned char inval = 255;
-		unsigned char outval = 0;
-		vtkIdType count = whiteImage->GetNumberOfPoints();
-		for (vtkIdType i = 0; i < count; ++i)
+	// Part of the mesh to voxelize: an axis-aligned box and/or the half-space kept by a clip plane (the side its normal
+	// points to). The voxel grid then only spans the region, so the same memory buys a finer spacing.
+	struct VoxelRegion {
+		bool useBox = false;
+		double box[6] = { 0, 0, 0, 0, 0, 0 };
+		bool useHalfSpace = false;
+		double planeOrigin[3] = { 0, 0, 0 };
+		double planeNormal[3] = { 0, 0, 1 };
+
+		bool IsSet() const { return useBox || useHalfSpace; }
+	};
+
+	// bounds of the part of `meshBounds` inside the region, false if nothing is left
+	bool GetRegionBounds(double const meshBounds[6], VoxelRegion const& region, double bounds[6])
+	{
+		std::copy(meshBounds, meshBounds + 6, bounds);
+		if (region.useBox)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				bounds[i * 2] = std::max(bounds[i * 2], region.box[i * 2]);
+				bounds[i * 2 + 1] = std::min(bounds[i * 2 + 1], region.box[i * 2 + 1]);
+			}
+		}
+		for (int i = 0; i < 3; i++)
 		{
-			whiteImage->GetPointData()->GetScalars()->SetTuple1(i, inval);
+			if (bounds[i * 2] >= bounds[i * 2 + 1])
+				return false;
 		}
+		if (!region.useHalfSpace)
+			return true;
 
-		// polygonal data --> image stencil:
+		// the box cut by the plane is the convex hull of its kept corners and the points where its edges cross the plane
+		auto side = [&](double const p[3]) {
+			return (p[0] - region.planeOrigin[0]) * region.planeNormal[0]
+				+ (p[1] - region.planeOrigin[1]) * region.planeNormal[1]
+				+ (p[2] - region.planeOrigin[2]) * region.planeNormal[2];
+		};
+		double hull[6] = { VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX };
+		auto addPoint = [&](double const p[3]) {
+			for (int i = 0; i < 3; i++)
+			{
+				hull[i * 2] = std::min(hull[i * 2], p[i]);
+				hull[i * 2 + 1] = std::max(hull[i * 2 + 1], p[i]);
+			}
+		};
+		for (int c = 0; c < 8; c++)
+		{
+			double corner[3] = { bounds[c & 1], bounds[2 + ((c >> 1) & 1)], bounds[4 + ((c >> 2) & 1)] };
+			double f = side(corner);
+			if (f >= 0)
+				addPoint(corner);
+			// edges towards the corners with a larger index along each axis
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (c & (1 << axis))
+					continue;
+				double other[3] = { corner[0], corner[1], corner[2] };
+				other[axis] = bounds[axis * 2 + 1];
+				double g = side(other);
+				if ((f < 0) != (g < 0))
+				{
+					double t = f / (f - g);
+					double cut[3] = { corner[0], corner[1], corner[2] };
+					cut[axis] += t * (other[axis] - corner[axis]);
+					addPoint(cut);
+				}
+			}
+		}
+		for (int i = 0; i < 3; i++)
+		{
+			if (hull[i * 2] >= hull[i * 2 + 1])
+				return false;
+		}
+		std::copy(hull, hull + 6, bounds);
+		return true;
+	}
+
+	// Clear the voxels of slices [z0, z1] (slab layout of VoxelizeSlabWithStencil) whose centers lie on the discarded
+	// side of the region's clip plane, the kept part of every row is one contiguous run
+	template <typename T>
+	void ClearSlabOutsideHalfSpace(VoxelGrid const& grid, VoxelRegion const& region, int z0, int z1, T* slab)
+	{
+		if (!region.useHalfSpace)
+			return;
+		double const* n = region.planeNormal;
+		double const* o = region.planeOrigin;
+		for (int z = z0; z <= z1; ++z)
+		{
+			for (int y = 0; y < grid.dim[1]; ++y)
+			{
+				T* row = slab + (z - z0) * grid.SliceSize() + static_cast<vtkIdType>(y) * grid.dim[0];
+				// side(x) = a + b * x over the voxel index x
+				double a = (grid.origin[0] - o[0]) * n[0]
+					+ (grid.origin[1] + y * grid.spacing[1] - o[1]) * n[1]
+					+ (grid.origin[2] + z * grid.spacing[2] - o[2]) * n[2];
+				double b = grid.spacing[0] * n[0];
+				if (b == 0)
+				{
+					if (a < 0)
+						std::fill(row, row + grid.dim[0], T(0));
+					continue;
+				}
+				// first (b > 0) or last (b < 0) kept index
+				double x = -a / b;
+				if (b > 0)
+				{
+					int end = static_cast<int>(std::min<double>(std::max(std::ceil(x), 0.0), grid.dim[0]));
+					std::fill(row, row + end, T(0));
+				}
+				else
+				{
+					int begin = static_cast<int>(std::min<double>(std::max(std::floor(x) + 1, 0.0), grid.dim[0]));
+					std::fill(row + begin, row + grid.dim[0], T(0));
+				}
+			}
+		}
+	}
+
+	// Voxelize slices [z0, z1] of the grid with the stencil filter and write them into `slab`,
+	// which holds (z1 - z0 + 1) slices starting at slice z0 and must be zero-initialized.
+	// The stencil only keeps run-lengths of the requested slab alive, not a whole volume.
+	template <typename T>
+	void VoxelizeSlabWithStencil(vtkPolyDataToImageStencil* pol2stenc, VoxelGrid const& grid,
+		                         int z0, int z1, T inval, T* slab)
+	{
+		int slabExtent[6] = { 0, grid.dim[0] - 1, 0, grid.dim[1] - 1, z0, z1 };
+		pol2stenc->UpdateExtent(slabExtent);
+		vtkImageStencilData* stencil = pol2stenc->GetOutput();
+
+		for (int z = z0; z <= z1; ++z)
+		{
+			for (int y = 0; y < grid.dim[1]; ++y)
+			{
+				T* row = slab + (z - z0) * grid.SliceSize() + static_cast<vtkIdType>(y) * grid.dim[0];
+				int r1, r2, iter = 0;
+				while (stencil->GetNextExtent(r1, r2, 0, grid.dim[0] - 1, y, z, iter))
+					std::fill(row + r1, row + r2 + 1, inval);
+			}
+		}
+	}
+
+	vtkSmartPointer<vtkPolyDataToImageStencil> GetMeshStencil(vtkPolyData* polyData, VoxelGrid const& grid)
+	{
 		vtkNew<vtkPolyDataToImageStencil> pol2stenc;
 		pol2stenc->SetInputData(polyData);
-		pol2stenc->SetOutputOrigin(origin);
-		pol2stenc->SetOutputSpacing(spacing);
-		pol2stenc->SetOutputWholeExtent(whiteImage->GetExtent());
-		pol2stenc->Update();
+		pol2stenc->SetOutputOrigin(grid.origin);
+		pol2stenc->SetOutputSpacing(grid.spacing);
+		pol2stenc->SetOutputWholeExtent(0, grid.dim[0] - 1, 0, grid.dim[1] - 1, 0, grid.dim[2] - 1);
+		return pol2stenc;
+	}
+
+	enum class VoxelizeEngine {
+		Stencil,     // vtkPolyDataToImageStencil, binary only
+		SimdParity   // ParityVoxelizer: triangle-parity rays with runtime SIMD dispatch, supports coverage
+	};
+
+	// point coordinates and fan-triangulated polygons of the mesh
+	void GetMeshTriangles(vtkPolyData* polyData, std::vector<double>& points, std::vector<int>& triangles)
+	{
+		points.resize(3 * static_cast<size_t>(polyData->GetNumberOfPoints()));
+		for (vtkIdType i = 0; i < polyData->GetNumberOfPoints(); ++i)
+			polyData->GetPoint(i, &points[3 * static_cast<size_t>(i)]);
+
+		triangles.clear();
+		vtkIdType npts;
+		vtkIdType const* pts;
+		auto polys = polyData->GetPolys();
+		for (polys->InitTraversal(); polys->GetNextCell(npts, pts);)
+		{
+			for (vtkIdType k = 1; k + 1 < npts; ++k)
+				triangles.insert(triangles.end(), { static_cast<int>(pts[0]), static_cast<int>(pts[k]), static_cast<int>(pts[k + 1]) });
+		}
+	}
+
+	// slab voxelization function of the chosen engine writing VoxelTraits<T>::FullScale (or its covered fraction),
+	// see VoxelizeSlabWithStencil for the slab layout
+	template <typename T>
+	using SlabVoxelizer = std::function<void(int z0, int z1, T* slab)>;
+
+	// subsamples > 1 gives an anti-aliased coverage volume, which only the parity engine can compute
+	template <typename T>
+	SlabVoxelizer<T> GetSlabVoxelizer(vtkPolyData* polyData, VoxelGrid const& grid, VoxelizeEngine engine, int subsamples)
+	{
+		if (engine == VoxelizeEngine::SimdParity)
+		{
+			std::vector<double> points;
+			std::vector<int> triangles;
+			GetMeshTriangles(polyData, points, triangles);
+			auto voxelizer = std::make_shared<ParityVoxelizer>(points, triangles, grid.dim, grid.origin, grid.spacing,
+				                                               DetectSimdLevel(), subsamples);
+			return [voxelizer](int z0, int z1, T* slab) {
+				voxelizer->VoxelizeSlab<T>(z0, z1, VoxelTraits<T>::FullScale, slab);
+			};
+		}
+
+		vtkSmartPointer<vtkPolyDataToImageStencil> pol2stenc = GetMeshStencil(polyData, grid);
+		return [pol2stenc, grid](int z0, int z1, T* slab) {
+			VoxelizeSlabWithStencil(pol2stenc, grid, z0, z1, VoxelTraits<T>::FullScale, slab);
+		};
+	}
+
+	// Require STL mesh data, need adjust spacing and sample distance for good volume rendering
+	// https://vedo.embl.es/autodocs/_modules/vedo/volume.html
+	// The mesh is voxelized in z-slabs of `slab_depth` slices (<= 0: the whole volume in one slab) that are written
+	// straight into the output, so peak memory is the output volume plus one slab of stencil data.
+	// T = unsigned char gives the binary 0 / 255 volume, unsigned short and float volumes with subsamples > 1 hold
+	// the partial volume of every voxel (SimdParity engine).
+	// With a `region` only the part of the mesh inside it is voxelized, nullptr is returned if the region misses the mesh.
+	// `cancel` is checked between slabs, once it is set the voxelization stops and nullptr is returned.
+	template <typename T = unsigned char>
+	vtkSmartPointer<vtkImageData> ConvertMeshPolyDataToImageData(vtkSmartPointer<vtkPolyData> polyData, 
+		                                                         double const spacing[3],  // desired volume spacing
+		                                                         int slab_depth = 0,
+		                                                         VoxelizeEngine engine = VoxelizeEngine::Stencil,
+		                                                         int subsamples = 1,
+		                                                         VoxelRegion const& region = VoxelRegion(),
+		                                                         std::atomic<bool> const* cancel = nullptr)
+	{
+		double meshBounds[6], bounds[6];
+		polyData->GetBounds(meshBounds);
+		if (!GetRegionBounds(meshBounds, region, bounds))
+			return nullptr;
+		auto grid = ComputeVoxelGrid(bounds, spacing);
+
+		vtkNew<vtkImageData> image;
+		image->SetSpacing(grid.spacing);
+		image->SetDimensions(grid.dim);
+		image->SetExtent(0, grid.dim[0] - 1, 0, grid.dim[1] - 1, 0, grid.dim[2] - 1);
+		image->SetOrigin(grid.origin);
+		image->AllocateScalars(VoxelTraits<T>::VTKType, 1);
+
+		// background voxels, foreground ones are filled slab by slab
+		auto voxels = static_cast<T*>(image->GetScalarPointer());
+		std::fill(voxels, voxels + grid.NumberOfVoxels(), T(0));
+
+		auto voxelizeSlab = GetSlabVoxelizer<T>(polyData, grid, engine, subsamples);
+		int depth = slab_depth > 0 ? slab_depth : grid.dim[2];
+		for (int z0 = 0; z0 < grid.dim[2]; z0 += depth)
+		{
+			if (cancel && *cancel)
+				return nullptr;
+			int z1 = std::min(z0 + depth, grid.dim[2]) - 1;
+			voxelizeSlab(z0, z1, voxels + z0 * grid.SliceSize());
+			ClearSlabOutsideHalfSpace(grid, region, z0, z1, voxels + z0 * grid.SliceSize());
+		}
+		image->Modified();
+
+		return image;
+	}
+
+	// Voxelize the mesh slab by slab into a MetaImage pair (`filename` .mhd header + .raw voxels) without ever holding
+	// the whole volume in memory, the result can be read back with vtkMetaImageReader.
+	// Return false if the files can not be written or the region misses the mesh.
+	template <typename T = unsigned char>
+	bool ConvertMeshPolyDataToRawFile(vtkSmartPointer<vtkPolyData> polyData,
+		                              double const spacing[3],  // desired volume spacing
+		                              std::string const& filename,  // .mhd header path, voxels go to the sibling .raw
+		                              int slab_depth = 16,
+		                              VoxelizeEngine engine = VoxelizeEngine::Stencil,
+		                              int subsamples = 1,
+		                              VoxelRegion const& region = VoxelRegion())
+	{
+		double meshBounds[6], bounds[6];
+		polyData->GetBounds(meshBounds);
+		if (!GetRegionBounds(meshBounds, region, bounds))
+			return false;
+		auto grid = ComputeVoxelGrid(bounds, spacing);
+
+		std::string rawFilename = vtksys::SystemTools::GetFilenameWithoutLastExtension(filename) + ".raw";
+		std::string rawPath = vtksys::SystemTools::GetFilenamePath(filename);
+		if (!rawPath.empty())
+			rawPath += "/";
+		rawPath += rawFilename;
+
+		std::ofstream header(filename);
+		std::ofstream raw(rawPath, std::ios::binary);
+		if (!header || !raw)
+			return false;
+
+		header << "ObjectType = Image\n"
+			<< "NDims = 3\n"
+			<< "BinaryData = True\n"
+			<< "BinaryDataByteOrderMSB = False\n"
+			<< "DimSize = " << grid.dim[0] << " " << grid.dim[1] << " " << grid.dim[2] << "\n"
+			<< "ElementSpacing = " << grid.spacing[0] << " " << grid.spacing[1] << " " << grid.spacing[2] << "\n"
+			<< "Offset = " << grid.origin[0] << " " << grid.origin[1] << " " << grid.origin[2] << "\n"
+			<< "ElementNumberOfChannels = 1\n"
+			<< "ElementType = " << VoxelTraits<T>::MetaType << "\n"
+			<< "ElementDataFile = " << rawFilename << "\n";
+
+		auto voxelizeSlab = GetSlabVoxelizer<T>(polyData, grid, engine, subsamples);
+		int depth = slab_depth > 0 ? slab_depth : grid.dim[2];
+		std::vector<T> slab;
+		for (int z0 = 0; z0 < grid.dim[2]; z0 += depth)
+		{
+			int z1 = std::min(z0 + depth, grid.dim[2]) - 1;
+			slab.assign(static_cast<size_t>((z1 - z0 + 1) * grid.SliceSize()), T(0));
+			voxelizeSlab(z0, z1, slab.data());
+			ClearSlabOutsideHalfSpace(grid, region, z0, z1, slab.data());
+			raw.write(reinterpret_cast<char const*>(slab.data()), static_cast<std::streamsize>(slab.size() * sizeof(T)));
+		}
+		return static_cast<bool>(raw) && static_cast<bool>(header);
+	}
+
+	// scalar type of the voxelization chosen at runtime
+	enum class VoxelType {
+		UnsignedChar,   // binary 0 / 255
+		UnsignedShort,  // coverage 0 - 65535
+		Float           // coverage 0 - 1
+	};
+
+	vtkSmartPointer<vtkImageData> ConvertMeshPolyDataToImageData(VoxelType type,
+		                                                         vtkSmartPointer<vtkPolyData> polyData,
+		                                                         double const spacing[3],
+		                                                         int slab_depth,
+		                                                         VoxelizeEngine engine,
+		                                                         int subsamples,
+		                                                         VoxelRegion const& region = VoxelRegion(),
+		                                                         std::atomic<bool> const* cancel = nullptr)
+	{
+		switch (type) {
+		case VoxelType::UnsignedShort:
+			return ConvertMeshPolyDataToImageData<unsigned short>(polyData, spacing, slab_depth, engine, subsamples, region, cancel);
+		case VoxelType::Float:
+			return ConvertMeshPolyDataToImageData<float>(polyData, spacing, slab_depth, engine, subsamples, region, cancel);
+		default:
+			return ConvertMeshPolyDataToImageData<unsigned char>(polyData, spacing, slab_depth, engine, subsamples, region, cancel);
+		}
+	}
 
-		// cut the corresponding white image and set the background:
-		vtkNew<vtkImageStencil> imgstenc;
-		imgstenc->SetInputData(whiteImage);
-		imgstenc->SetStencilConnection(pol2stenc->GetOutputPort());
-		imgstenc->ReverseStencilOff();
-		imgstenc->SetBackgroundValue(outval);
-		imgstenc->Update();
+	bool ConvertMeshPolyDataToRawFile(VoxelType type,
+		                              vtkSmartPointer<vtkPolyData> polyData,
+		                              double const spacing[3],
+		                              std::string const& filename,
+		                              int slab_depth,
+		                              VoxelizeEngine engine,
+		                              int subsamples,
+		                              VoxelRegion const& region = VoxelRegion())
+	{
+		switch (type) {
+		case VoxelType::UnsignedShort:
+			return ConvertMeshPolyDataToRawFile<unsigned short>(polyData, spacing, filename, slab_depth, engine, subsamples, region);
+		case VoxelType::Float:
+			return ConvertMeshPolyDataToRawFile<float>(polyData, spacing, filename, slab_depth, engine, subsamples, region);
+		default:
+			return ConvertMeshPolyDataToRawFile<unsigned char>(polyData, spacing, filename, slab_depth, engine, subsamples, region);
+		}
+	}
 
-		whiteImage->DeepCopy(imgstenc->GetOutput());
+	// Voxelize like ConvertMeshPolyDataToImageData, but one layer of bricks at a time straight into a BrickedVolume, so
+	// peak memory is the compressed bricks plus one dense layer of BrickedVolume::BrickSize slices.
+	// nullptr if the region misses the mesh or `cancel` is set
+	template <typename T = unsigned char>
+	std::shared_ptr<BrickedVolume> ConvertMeshPolyDataToBrickedVolume(vtkSmartPointer<vtkPolyData> polyData,
+		                                                              double const spacing[3],
+		                                                              VoxelizeEngine engine = VoxelizeEngine::Stencil,
+		                                                              int subsamples = 1,
+		                                                              VoxelRegion const& region = VoxelRegion(),
+		                                                              std::atomic<bool> const* cancel = nullptr)
+	{
+		double meshBounds[6], bounds[6];
+		polyData->GetBounds(meshBounds);
+		if (!GetRegionBounds(meshBounds, region, bounds))
+			return nullptr;
+		auto grid = ComputeVoxelGrid(bounds, spacing);
 
-		return whiteImage;
+		auto volume = std::make_shared<BrickedVolume>(VoxelTraits<T>::Scalar, grid.dim, grid.origin, grid.spacing);
+		auto voxelizeSlab = GetSlabVoxelizer<T>(polyData, grid, engine, subsamples);
+		std::vector<T> slab;
+		for (int z0 = 0; z0 < grid.dim[2]; z0 += BrickedVolume::BrickSize)
+		{
+			if (cancel && *cancel)
+				return nullptr;
+			int z1 = std::min(z0 + BrickedVolume::BrickSize, grid.dim[2]) - 1;
+			slab.assign(static_cast<size_t>((z1 - z0 + 1) * grid.SliceSize()), T(0));
+			voxelizeSlab(z0, z1, slab.data());
+			ClearSlabOutsideHalfSpace(grid, region, z0, z1, slab.data());
+			volume->SetBrickLayer(z0, slab.data());
+		}
+		return volume;
 	}
 
+	std::shared_ptr<BrickedVolume> ConvertMeshPolyDataToBrickedVolume(VoxelType type,
+		                                                              vtkSmartPointer<vtkPolyData> polyData,
+		                                                              double const spacing[3],
+		                                                              VoxelizeEngine engine,
+		                                                              int subsamples,
+		                                                              VoxelRegion const& region = VoxelRegion(),
+		                                                              std::atomic<bool> const* cancel = nullptr)
+	{
+		switch (type) {
+		case VoxelType::UnsignedShort:
+			return ConvertMeshPolyDataToBrickedVolume<unsigned short>(polyData, spacing, engine, subsamples, region, cancel);
+		case VoxelType::Float:
+			return ConvertMeshPolyDataToBrickedVolume<float>(polyData, spacing, engine, subsamples, region, cancel);
+		default:
+			return ConvertMeshPolyDataToBrickedVolume<unsigned char>(polyData, spacing, engine, subsamples, region, cancel);
+		}
+	}
+
+	// VTK scalar type of a VolumeRayCaster scalar type
+	int GetVtkScalarType(RayCastScalar scalar)
+	{
+		switch (scalar) {
+		case RayCastScalar::UnsignedShort: return VTK_UNSIGNED_SHORT;
+		case RayCastScalar::Float: return VTK_FLOAT;
+		default: return VTK_UNSIGNED_CHAR;
+		}
+	}
+
+	// Image source of a BrickedVolume for any mapper or filter. It reports the whole volume and on update decompresses
+	// only the bricks overlapping the requested update extent, e.g. just the VOI of a vtkExtractVOI downstream; volume
+	// mappers request the whole extent, so what they render is decompressed whole. A CpuRayCastMapper given the
+	// BrickedVolume itself (SetBrickedVolume) renders it without this dense copy
+	class BrickedVolumeSource : public vtkImageAlgorithm {
+	public:
+		static BrickedVolumeSource* New();
+		vtkTypeMacro(BrickedVolumeSource, vtkImageAlgorithm);
+
+		void SetVolume(std::shared_ptr<BrickedVolume const> volume) {
+			Volume = std::move(volume);
+			this->Modified();
+		}
+		std::shared_ptr<BrickedVolume const> GetVolume() const { return Volume; }
+
+	protected:
+		BrickedVolumeSource() { this->SetNumberOfInputPorts(0); }
+
+		int RequestInformation(vtkInformation*, vtkInformationVector**, vtkInformationVector* outputVector) override {
+			if (Volume == nullptr)
+			{
+				vtkErrorMacro("BrickedVolumeSource has no volume");
+				return 0;
+			}
+			int const* dim = Volume->GetDimensions();
+			int extent[6] = { 0, dim[0] - 1, 0, dim[1] - 1, 0, dim[2] - 1 };
+			vtkInformation* outInfo = outputVector->GetInformationObject(0);
+			outInfo->Set(vtkStreamingDemandDrivenPipeline::WHOLE_EXTENT(), extent, 6);
+			outInfo->Set(vtkDataObject::ORIGIN(), Volume->GetOrigin(), 3);
+			outInfo->Set(vtkDataObject::SPACING(), Volume->GetSpacing(), 3);
+			vtkDataObject::SetPointDataActiveScalarInfo(outInfo, GetVtkScalarType(Volume->GetScalar()), 1);
+			return 1;
+		}
+
+		void ExecuteDataWithInformation(vtkDataObject* output, vtkInformation* outInfo) override {
+			vtkImageData* image = this->AllocateOutputData(output, outInfo);
+			Volume->Decompress(image->GetExtent(), image->GetScalarPointer());
+		}
+
+	private:
+		std::shared_ptr<BrickedVolume const> Volume;
+	};
+
+	vtkStandardNewMacro(BrickedVolumeSource);
+
 	enum class VolumeType {
 		FixedPointVolumeRayCast,
 		GPUVolumeRayCast,
-		SmartVolume
+		SmartVolume,
+		CpuRayCast
 	};
 
-	vtkSmartPointer<vtkVolume> GetVolume(vtkSmartPointer<vtkImageData> imgData,
-		                                 VolumeType type,
-		                                 float sample_distance,
-		                                 float img_sample_distance,
-		                                 double iso1, double iso2,
-		                                 double color1[3], double color2[3])
+	// Refill the color / opacity transfer functions and iso values of `volumeProperty` in place.
+	// ISO values are given on the scale of the binary uint8 volume (0 - 255) and mapped onto the scalar range of T,
+	// so the same settings fit uint8, uint16 and float coverage volumes.
+	// Only the functions' MTime changes, so mappers just re-upload their transfer-function tables on the next render.
+	template <typename T>
+	void SetVolumeTransferFunctions(vtkVolumeProperty* volumeProperty,
+		                            double iso1, double iso2,
+		                            double color1[3], double color2[3])
 	{
-		vtkNew<vtkNamedColors> colors;
-		vtkNew<vtkColorTransferFunction> colorTransferFunction;
-		vtkNew<vtkPiecewiseFunction> scalarOpacity;
-		
+		constexpr double scale = static_cast<double>(VoxelTraits<T>::FullScale) / VoxelTraits<unsigned char>::FullScale;
+		iso1 *= scale;
+		iso2 *= scale;
+
+		vtkColorTransferFunction* colorTransferFunction = volumeProperty->GetRGBTransferFunction();
 		colorTransferFunction->RemoveAllPoints();
 		colorTransferFunction->AddRGBPoint(iso2,
 			color1[0],
@@ -120,24 +606,290 @@ namespace {
 			color2[1],
 			color2[2]);
 
+		vtkPiecewiseFunction* scalarOpacity = volumeProperty->GetScalarOpacity();
+		scalarOpacity->RemoveAllPoints();
 		scalarOpacity->AddPoint(iso1, 0.3);
 		scalarOpacity->AddPoint(iso2, 0.6);
 
-		vtkNew<vtkVolumeProperty> volumeProperty;
-		volumeProperty->ShadeOn();
-		volumeProperty->SetAmbient(0.4);
-		volumeProperty->SetDiffuse(0.6);
-		volumeProperty->SetSpecular(0.2);
-		volumeProperty->SetInterpolationTypeToLinear();
-		volumeProperty->SetColor(colorTransferFunction);
-		volumeProperty->SetScalarOpacity(scalarOpacity);
 		// Add some contour values to draw iso surfaces
 		volumeProperty->GetIsoSurfaceValues()->SetValue(0, iso1);
 		volumeProperty->GetIsoSurfaceValues()->SetValue(1, iso2);
+	}
 
-		vtkNew<vtkVolume> volume;
-		volume->SetProperty(volumeProperty);
+	// transfer functions of a volume whose input has the scalar type `scalar_type`
+	void SetVolumeTransferFunctions(vtkVolumeProperty* volumeProperty,
+		                            int scalar_type,
+		                            double iso1, double iso2,
+		                            double color1[3], double color2[3])
+	{
+		switch (scalar_type) {
+		case VTK_UNSIGNED_SHORT:
+			SetVolumeTransferFunctions<unsigned short>(volumeProperty, iso1, iso2, color1, color2);
+			break;
+		case VTK_FLOAT:
+			SetVolumeTransferFunctions<float>(volumeProperty, iso1, iso2, color1, color2);
+			break;
+		default:
+			SetVolumeTransferFunctions<unsigned char>(volumeProperty, iso1, iso2, color1, color2);
+			break;
+		}
+	}
+
+	// VolumeRayCaster scalar type of a VTK scalar type, false for unsupported ones
+	bool GetRayCastScalar(int scalar_type, RayCastScalar& scalar)
+	{
+		switch (scalar_type) {
+		case VTK_UNSIGNED_CHAR: scalar = RayCastScalar::UnsignedChar; return true;
+		case VTK_UNSIGNED_SHORT: scalar = RayCastScalar::UnsignedShort; return true;
+		case VTK_FLOAT: scalar = RayCastScalar::Float; return true;
+		default: return false;
+		}
+	}
+
+	struct GradientCacheStats {
+		int Volumes = 0;
+		size_t Bytes = 0;
+		double BuildMilliseconds = 0;  // of the gradients cached now
+	};
+
+	// Quantized gradients (volume_raycast.h) of the image data rendered by CpuRayCastMappers, built on the first request
+	// after the scalars change and shared by every mapper of that image, rebuilt mappers included. Entries go away with
+	// their image. Thread-safe, so the background rebuild can build them before the first shaded frame
+	class GradientCache {
+	public:
+		std::shared_ptr<QuantizedGradients const> Get(vtkImageData* imgData) {
+			vtkDataArray* scalars = imgData->GetPointData()->GetScalars();
+			RayCastScalar scalar;
+			if (scalars == nullptr || !GetRayCastScalar(scalars->GetDataType(), scalar))
+				return nullptr;
+			auto dataTime = std::max(imgData->GetMTime(), scalars->GetMTime());
+
+			std::lock_guard<std::mutex> lock(Mutex);
+			Prune();
+			for (auto& entry : Entries)
+				if (entry.Image == imgData && entry.Time == dataTime)
+					return entry.Gradients;
+
+			auto start = std::chrono::steady_clock::now();
+			auto gradients = std::make_shared<QuantizedGradients>();
+			gradients->Build(scalars->GetVoidPointer(0), scalar, imgData->GetDimensions());
+			double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			Entries.erase(std::remove_if(Entries.begin(), Entries.end(), [&](Entry const& entry) { return entry.Image == imgData; }),
+				          Entries.end());
+			Entries.push_back({ imgData, dataTime, gradients, buildTime });
+			return gradients;
+		}
+
+		// forget every entry, the next Get builds again (benchmarks measuring the build per configuration)
+		void Clear() {
+			std::lock_guard<std::mutex> lock(Mutex);
+			Entries.clear();
+		}
+
+		GradientCacheStats GetStats() {
+			std::lock_guard<std::mutex> lock(Mutex);
+			Prune();
+			GradientCacheStats stats;
+			for (auto const& entry : Entries)
+			{
+				++stats.Volumes;
+				stats.Bytes += entry.Gradients->GetMemorySize();
+				stats.BuildMilliseconds += entry.BuildMilliseconds;
+			}
+			return stats;
+		}
+
+	private:
+		struct Entry {
+			vtkWeakPointer<vtkImageData> Image;
+			vtkMTimeType Time;
+			std::shared_ptr<QuantizedGradients const> Gradients;
+			double BuildMilliseconds;
+		};
+
+		void Prune() {
+			Entries.erase(std::remove_if(Entries.begin(), Entries.end(), [](Entry const& entry) { return entry.Image == nullptr; }),
+				          Entries.end());
+		}
+
+		std::mutex Mutex;
+		std::vector<Entry> Entries;
+	};
+
+	GradientCache& GetGradientCache()
+	{
+		static GradientCache cache;
+		return cache;
+	}
+
+	// vtkVolumeMapper around VolumeRayCaster (volume_raycast.h): casts rays on the CPU (AVX2 ray packets when available)
+	// and draws the image as a viewport texture. Composite and iso-surface blend modes, the iso-surfaces are the
+	// volume property's iso values. Its brick min/max grid is rebuilt only when the input scalars change,
+	// transfer-function edits just refill the tables it samples from on the next render. Shading uses the quantized
+	// gradients of the GradientCache.
+	// Given a BrickedVolume it renders that instead of the input's scalars, reading bricks on demand; the input then only
+	// places the volume (origin, spacing, extent) and needs no scalars.
+	class CpuRayCastMapper : public vtkVolumeMapper {
+	public:
+		static CpuRayCastMapper* New();
+		vtkTypeMacro(CpuRayCastMapper, vtkVolumeMapper);
+
+		// world units along a ray
+		vtkSetMacro(SampleDistance, float);
+		vtkGetMacro(SampleDistance, float);
+		// viewport pixels per cast ray along x and y
+		vtkSetMacro(ImageSampleDistance, float);
+		vtkGetMacro(ImageSampleDistance, float);
+		// iso-surface blend on float scalars holding signed distances in world units, rays sphere-trace towards the surfaces
+		vtkSetMacro(DistanceField, bool);
+		vtkGetMacro(DistanceField, bool);
+
+		VolumeRayCaster const& GetRayCaster() const { return RayCaster; }
+
+		// rendered instead of the input's scalars, with the input's dimensions; nullptr renders the input again
+		void SetBrickedVolume(std::shared_ptr<BrickedVolume const> volume) {
+			Bricked = std::move(volume);
+			if (Bricked != nullptr)
+				RayCaster.SetVolume(Bricked);
+			VolumeTime = 0;  // the input's scalars are set up again without one
+			this->Modified();
+		}
+		std::shared_ptr<BrickedVolume const> GetBrickedVolume() const { return Bricked; }
 
+		void Render(vtkRenderer* ren, vtkVolume* vol) override {
+			if (this->GetNumberOfInputConnections(0) == 0)
+				return;
+			this->GetInputAlgorithm(0, 0)->Update();
+			vtkImageData* input = this->GetInput();
+			if (input == nullptr)
+				return;
+			vtkDataArray* scalars = Bricked == nullptr ? input->GetPointData()->GetScalars() : nullptr;
+			if (Bricked == nullptr && scalars == nullptr)
+				return;
+
+			RayCastScalar scalar;
+			if (Bricked != nullptr)
+				scalar = Bricked->GetScalar();
+			else if (!GetRayCastScalar(scalars->GetDataType(), scalar))
+			{
+				vtkErrorMacro("CpuRayCastMapper supports unsigned char, unsigned short and float scalars only");
+				return;
+			}
+			else
+			{
+				auto dataTime = std::max(input->GetMTime(), scalars->GetMTime());
+				if (dataTime != VolumeTime)
+				{
+					RayCaster.SetVolume(scalars->GetVoidPointer(0), scalar, input->GetDimensions());
+					VolumeTime = dataTime;
+				}
+			}
+
+			RayCastView view;
+			int viewportSize[2], viewportOrigin[2];
+			ren->GetTiledSizeAndOrigin(&viewportSize[0], &viewportSize[1], &viewportOrigin[0], &viewportOrigin[1]);
+			int memorySize[2];
+			for (int i = 0; i < 2; ++i)
+			{
+				view.ImageSize[i] = std::max(1, static_cast<int>(viewportSize[i] / std::max(ImageSampleDistance, 1.0f)));
+				memorySize[i] = 32;
+				while (memorySize[i] < view.ImageSize[i])
+					memorySize[i] *= 2;
+			}
+			view.ImageStride = memorySize[0];
+			view.SampleDistance = SampleDistance;
+
+			auto worldToNdc = ren->GetActiveCamera()->GetCompositeProjectionTransformMatrix(ren->GetTiledAspectRatio(), -1, 1);
+			vtkMatrix4x4::Invert(worldToNdc->GetData(), view.NdcToWorld);
+
+			// world -> volume coordinates -> continuous voxel index
+			double worldToVolume[16];
+			vtkMatrix4x4::Invert(vol->GetMatrix()->GetData(), worldToVolume);
+			double* origin = input->GetOrigin();
+			double* spacing = input->GetSpacing();
+			int* extent = input->GetExtent();
+			for (int r = 0; r < 3; ++r)
+			{
+				for (int c = 0; c < 4; ++c)
+					view.WorldToIndex[r * 4 + c] = worldToVolume[r * 4 + c] / spacing[r];
+				view.WorldToIndex[r * 4 + 3] -= origin[r] / spacing[r] + extent[2 * r];
+			}
+
+			if (auto planes = this->GetClippingPlanes())
+			{
+				vtkPlane* plane;
+				vtkCollectionSimpleIterator it;
+				for (planes->InitTraversal(it); (plane = planes->GetNextPlane(it)) != nullptr;)
+				{
+					double* n = plane->GetNormal();
+					double* o = plane->GetOrigin();
+					view.ClipPlanes.push_back({ n[0], n[1], n[2], -(n[0] * o[0] + n[1] * o[1] + n[2] * o[2]) });
+				}
+			}
+
+			auto property = vol->GetProperty();
+			RayCastTransfer transfer;
+			if (this->GetBlendMode() == vtkVolumeMapper::ISOSURFACE_BLEND)
+			{
+				transfer.Blend = RayCastBlend::IsoSurface;
+				auto isoValues = property->GetIsoSurfaceValues();
+				for (int i = 0; i < isoValues->GetNumberOfContours(); ++i)
+					transfer.IsoValues.push_back(isoValues->GetValue(i));
+				transfer.DistanceField = DistanceField && scalar == RayCastScalar::Float;
+			}
+			if (scalar == RayCastScalar::Float && Bricked != nullptr)
+				Bricked->GetScalarRange(transfer.Range);
+			else if (scalar == RayCastScalar::Float)
+				scalars->GetRange(transfer.Range);
+			else
+			{
+				transfer.Range[0] = 0;
+				transfer.Range[1] = scalar == RayCastScalar::UnsignedShort ? 65535 : 255;
+			}
+			constexpr int tableSize = 1024;
+			transfer.Color.resize(3 * tableSize);
+			transfer.Opacity.resize(tableSize);
+			property->GetRGBTransferFunction(0)->GetTable(transfer.Range[0], transfer.Range[1], tableSize, transfer.Color.data());
+			property->GetScalarOpacity(0)->GetTable(transfer.Range[0], transfer.Range[1], tableSize, transfer.Opacity.data());
+			transfer.OpacityUnitDistance = property->GetScalarOpacityUnitDistance(0);
+			transfer.Shade = property->GetShade(0) != 0;
+			transfer.Ambient = static_cast<float>(property->GetAmbient(0));
+			transfer.Diffuse = static_cast<float>(property->GetDiffuse(0));
+			transfer.Specular = static_cast<float>(property->GetSpecular(0));
+			transfer.SpecularPower = static_cast<float>(property->GetSpecularPower(0));
+			if (transfer.Shade && Bricked == nullptr)
+				RayCaster.SetGradients(GetGradientCache().Get(input));
+
+			Image.assign(4 * static_cast<size_t>(memorySize[0]) * memorySize[1], 0);
+			RayCaster.Render(view, transfer, Image.data());
+
+			int imageOrigin[2] = { 0, 0 };
+			DisplayHelper->PreMultipliedColorsOn();
+			DisplayHelper->RenderTexture(vol, ren, memorySize, view.ImageSize, view.ImageSize, imageOrigin, -1.0f, Image.data());
+		}
+
+		void ReleaseGraphicsResources(vtkWindow* window) override {
+			DisplayHelper->ReleaseGraphicsResources(window);
+		}
+
+	private:
+		float SampleDistance = 1.0f;
+		float ImageSampleDistance = 1.0f;
+		bool DistanceField = false;
+		VolumeRayCaster RayCaster;
+		std::shared_ptr<BrickedVolume const> Bricked;
+		vtkMTimeType VolumeTime = 0;
+		std::vector<unsigned char> Image;
+		vtkNew<vtkRayCastImageDisplayHelper> DisplayHelper;
+	};
+
+	vtkStandardNewMacro(CpuRayCastMapper);
+
+	vtkSmartPointer<vtkVolumeMapper> GetVolumeMapper(vtkSmartPointer<vtkImageData> imgData,
+		                                             VolumeType type,
+		                                             float sample_distance,
+		                                             float img_sample_distance)
+	{
 		switch (type) {
 		case VolumeType::FixedPointVolumeRayCast: {
 			vtkNew<vtkFixedPointVolumeRayCastMapper> mapper;
@@ -146,9 +898,7 @@ namespace {
 			mapper->SetSampleDistance(sample_distance);
 			mapper->SetImageSampleDistance(img_sample_distance);
 			mapper->SetBlendModeToComposite();
-
-			volume->SetMapper(mapper);
-			break;
+			return mapper;
 		}
 		case VolumeType::GPUVolumeRayCast: {
 			vtkNew<vtkOpenGLGPUVolumeRayCastMapper> mapper;
@@ -158,9 +908,7 @@ namespace {
 			mapper->SetImageSampleDistance(img_sample_distance);
 			mapper->SetBlendModeToIsoSurface();
 			// vtkVolumeMapper::AVERAGE_INTENSITY_BLEND and ISOSURFACE_BLEND are only supported by the vtkGPUVolumeRayCastMapper with the OpenGL2 backend
-
-			volume->SetMapper(mapper);
-			break;
+			return mapper;
 		}
 		case VolumeType::SmartVolume: {
 			vtkNew<vtkSmartVolumeMapper> mapper;
@@ -170,9 +918,16 @@ namespace {
 			mapper->SetRequestedRenderModeToDefault();  // use GPU if hardware supports else CPU
 			//mapper->SetRequestedRenderModeToRayCast();  // ensure to use the software rendering mode (CPU) == FixedPointVolumeRayCast
 			mapper->SetBlendModeToComposite();
-
-			volume->SetMapper(mapper);
-			break;
+			return mapper;
+		}
+		case VolumeType::CpuRayCast: {
+			vtkNew<CpuRayCastMapper> mapper;
+			mapper->SetInputData(imgData);
+			mapper->SetSampleDistance(sample_distance);
+			mapper->SetImageSampleDistance(img_sample_distance);
+			mapper->SetBlendModeToIsoSurface();  // like GPUVolumeRayCast, for hosts without a usable GPU
+			GetGradientCache().Get(imgData);  // here, usually on the rebuild thread, rather than on the first shaded frame
+			return mapper;
 		}
 		default: {
 			vtkNew<vtkSmartVolumeMapper> mapper;
@@ -181,26 +936,152 @@ namespace {
 			mapper->SetSampleDistance(sample_distance);
 			mapper->SetRequestedRenderModeToDefault();
 			mapper->SetBlendModeToComposite();
+			return mapper;
+		}
+		}
+	}
 
-			volume->SetMapper(mapper);
-			break;
+	// Level-of-detail volume: renders a downsampled proxy with coarser sample distances while the render window asks
+	// for an interactive update rate (the interactor style raises it to the interactor's DesiredUpdateRate during
+	// camera interaction) and the full-quality mapper once it drops back to the still update rate.
+	// Both mappers share one set of clipping planes, so clipping applies whichever of them is active.
+	class LODVolume : public vtkVolume {
+	public:
+		static LODVolume* New();
+		vtkTypeMacro(LODVolume, vtkVolume);
+
+		void SetLODMappers(vtkAbstractVolumeMapper* full, vtkAbstractVolumeMapper* proxy) {
+			FullMapper = full;
+			ProxyMapper = proxy;
+			if (FullMapper->GetClippingPlanes() == nullptr)
+			{
+				vtkNew<vtkPlaneCollection> planes;
+				FullMapper->SetClippingPlanes(planes);
+			}
+			if (ProxyMapper != nullptr)
+				ProxyMapper->SetClippingPlanes(FullMapper->GetClippingPlanes());
+			this->SetMapper(full);
 		}
+
+		vtkAbstractVolumeMapper* GetFullMapper() { return FullMapper; }
+		vtkAbstractVolumeMapper* GetProxyMapper() { return ProxyMapper; }
+
+		// desired update rates (frames per second) at or above this render the proxy
+		vtkSetMacro(InteractiveUpdateRate, double);
+		vtkGetMacro(InteractiveUpdateRate, double);
+
+		int RenderVolumetricGeometry(vtkViewport* viewport) override {
+			auto renderWindow = static_cast<vtkRenderer*>(viewport)->GetRenderWindow();
+			bool interactive = ProxyMapper != nullptr && renderWindow != nullptr
+				&& renderWindow->GetDesiredUpdateRate() >= InteractiveUpdateRate;
+			vtkAbstractVolumeMapper* mapper = interactive ? ProxyMapper : FullMapper;
+			if (mapper != nullptr && this->GetMapper() != mapper)
+				this->SetMapper(mapper);
+			return vtkVolume::RenderVolumetricGeometry(viewport);
 		}
+
+	private:
+		vtkSmartPointer<vtkAbstractVolumeMapper> FullMapper;
+		vtkSmartPointer<vtkAbstractVolumeMapper> ProxyMapper;
+		double InteractiveUpdateRate = 1.0;
+	};
+
+	vtkStandardNewMacro(LODVolume);
+
+	// blend mode (vtkVolumeMapper::COMPOSITE_BLEND or ISOSURFACE_BLEND) of the CpuRayCastMapper of `volume`, including the
+	// proxy of a LODVolume; other mappers keep theirs
+	void SetCpuRayCastBlendMode(vtkVolume* volume, int blend_mode)
+	{
+		vtkAbstractVolumeMapper* mappers[2] = { volume->GetMapper(), nullptr };
+		if (auto lod = LODVolume::SafeDownCast(volume))
+		{
+			mappers[0] = lod->GetFullMapper();
+			mappers[1] = lod->GetProxyMapper();
+		}
+		for (auto mapper : mappers)
+			if (auto cpuMapper = CpuRayCastMapper::SafeDownCast(mapper))
+				cpuMapper->SetBlendMode(blend_mode);
+	}
+
+	// shaded, linearly interpolated volume property with the transfer functions of scalars of type T
+	template <typename T>
+	vtkSmartPointer<vtkVolumeProperty> GetVolumeProperty(double iso1, double iso2,
+		                                                 double color1[3], double color2[3])
+	{
+		vtkNew<vtkColorTransferFunction> colorTransferFunction;
+		vtkNew<vtkPiecewiseFunction> scalarOpacity;
+
+		vtkNew<vtkVolumeProperty> volumeProperty;
+		volumeProperty->ShadeOn();
+		volumeProperty->SetAmbient(0.4);
+		volumeProperty->SetDiffuse(0.6);
+		volumeProperty->SetSpecular(0.2);
+		volumeProperty->SetInterpolationTypeToLinear();
+		volumeProperty->SetColor(colorTransferFunction);
+		volumeProperty->SetScalarOpacity(scalarOpacity);
+		SetVolumeTransferFunctions<T>(volumeProperty, iso1, iso2, color1, color2);
+		return volumeProperty;
+	}
+
+	// `lod_shrink` > 1 adds an interaction proxy of the volume shrunk (averaged) by that factor along every axis,
+	// rendered with sample distances coarser by the same factor
+	template <typename T>
+	vtkSmartPointer<vtkVolume> GetVolume(vtkSmartPointer<vtkImageData> imgData,
+		                                 VolumeType type,
+		                                 float sample_distance,
+		                                 float img_sample_distance,
+		                                 double iso1, double iso2,
+		                                 double color1[3], double color2[3],
+		                                 int lod_shrink = 1)
+	{
+		auto volumeProperty = GetVolumeProperty<T>(iso1, iso2, color1, color2);
+
+		auto mapper = GetVolumeMapper(imgData, type, sample_distance, img_sample_distance);
+		if (lod_shrink <= 1)
+		{
+			vtkNew<vtkVolume> volume;
+			volume->SetProperty(volumeProperty);
+			volume->SetMapper(mapper);
+			return volume;
+		}
+
+		vtkNew<vtkImageShrink3D> shrink;
+		shrink->SetInputData(imgData);
+		shrink->SetShrinkFactors(lod_shrink, lod_shrink, lod_shrink);
+		shrink->AveragingOn();
+		shrink->Update();
+		vtkSmartPointer<vtkImageData> proxyData = shrink->GetOutput();
+		auto proxyMapper = GetVolumeMapper(proxyData, type, sample_distance * lod_shrink,
+			                               std::min(img_sample_distance * lod_shrink, 20.0f));
+
+		vtkNew<LODVolume> volume;
+		volume->SetProperty(volumeProperty);
+		volume->SetLODMappers(mapper, proxyMapper);
 		return volume;
 	}
 	
-    vtkSmartPointer<vtkPropCollection> SetupMyActorsForRayCast(std::string const& imgDataName, 
-		                                                       vtkSmartPointer<vtkImageData> imgData,
-		                                                       VolumeType type,
-		                                                       float sample_distance,
-		                                                       float img_sample_distance,
-		                                                       double iso1, double iso2,
-		                                                       double color1[3], double color2[3])
+	// volume of the image's scalar type
+	vtkSmartPointer<vtkVolume> GetVolume(vtkSmartPointer<vtkImageData> imgData,
+		                                 VolumeType type,
+		                                 float sample_distance,
+		                                 float img_sample_distance,
+		                                 double iso1, double iso2,
+		                                 double color1[3], double color2[3],
+		                                 int lod_shrink = 1)
 	{
-		// volume
-		auto volume = GetVolume(imgData, type, sample_distance, img_sample_distance, iso1, iso2, color1, color2);
+		switch (imgData->GetScalarType()) {
+		case VTK_UNSIGNED_SHORT:
+			return GetVolume<unsigned short>(imgData, type, sample_distance, img_sample_distance, iso1, iso2, color1, color2, lod_shrink);
+		case VTK_FLOAT:
+			return GetVolume<float>(imgData, type, sample_distance, img_sample_distance, iso1, iso2, color1, color2, lod_shrink);
+		default:
+			return GetVolume<unsigned char>(imgData, type, sample_distance, img_sample_distance, iso1, iso2, color1, color2, lod_shrink);
+		}
+	}
 
-		// text
+	// file name and dimensions of the volume in the lower left corner
+	vtkSmartPointer<vtkActor2D> GetVolumeInfoText(std::string const& imgDataName, vtkImageData* imgData)
+	{
 		vtkNew<vtkTextProperty> textProperty;
 		textProperty->SetFontSize(16);
 		textProperty->SetColor(0.3, 0.3, 0.3);
@@ -219,25 +1100,295 @@ namespace {
 		vtkNew<vtkActor2D> textActor;
 		textActor->SetMapper(textMapper);
 		textActor->SetPosition(20, 20);
+		return textActor;
+	}
+
+    vtkSmartPointer<vtkPropCollection> SetupMyActorsForRayCast(std::string const& imgDataName, 
+		                                                       vtkSmartPointer<vtkImageData> imgData,
+		                                                       VolumeType type,
+		                                                       float sample_distance,
+		                                                       float img_sample_distance,
+		                                                       double iso1, double iso2,
+		                                                       double color1[3], double color2[3],
+		                                                       int lod_shrink = 1)
+	{
+		// volume
+		auto volume = GetVolume(imgData, type, sample_distance, img_sample_distance, iso1, iso2, color1, color2, lod_shrink);
 
 		vtkNew<vtkPropCollection> actors;
 		actors->AddItem(volume);
-		actors->AddItem(textActor);
+		actors->AddItem(GetVolumeInfoText(imgDataName, imgData));
 
 		return actors;
     }
 
-	void SetClipPlane(vtkVolume* volume, double origin[3], double normal[3]) {
-		vtkNew<vtkPlane> plane;
+	// image with the dimensions, origin and spacing of a BrickedVolume and no scalars, the input that places it for a
+	// CpuRayCastMapper rendering its bricks
+	vtkSmartPointer<vtkImageData> GetBrickedVolumeGeometry(BrickedVolume const& volume)
+	{
+		auto imgData = vtkSmartPointer<vtkImageData>::New();
+		imgData->SetDimensions(volume.GetDimensions()[0], volume.GetDimensions()[1], volume.GetDimensions()[2]);
+		imgData->SetOrigin(volume.GetOrigin()[0], volume.GetOrigin()[1], volume.GetOrigin()[2]);
+		imgData->SetSpacing(volume.GetSpacing()[0], volume.GetSpacing()[1], volume.GetSpacing()[2]);
+		return imgData;
+	}
+
+	// SetupMyActorsForRayCast with a CpuRayCastMapper reading the bricks of `bricked` on demand, so the volume is never
+	// decompressed whole. `geometry` is its GetBrickedVolumeGeometry; no interaction proxy, it would need a dense copy
+	vtkSmartPointer<vtkPropCollection> SetupMyActorsForBrickedRayCast(std::string const& imgDataName,
+		                                                              vtkSmartPointer<vtkImageData> geometry,
+		                                                              std::shared_ptr<BrickedVolume const> bricked,
+		                                                              float sample_distance,
+		                                                              float img_sample_distance,
+		                                                              double iso1, double iso2,
+		                                                              double color1[3], double color2[3])
+	{
+		vtkSmartPointer<vtkVolumeProperty> volumeProperty;
+		switch (bricked->GetScalar()) {
+		case RayCastScalar::UnsignedShort:
+			volumeProperty = GetVolumeProperty<unsigned short>(iso1, iso2, color1, color2);
+			break;
+		case RayCastScalar::Float:
+			volumeProperty = GetVolumeProperty<float>(iso1, iso2, color1, color2);
+			break;
+		default:
+			volumeProperty = GetVolumeProperty<unsigned char>(iso1, iso2, color1, color2);
+			break;
+		}
+
+		vtkNew<CpuRayCastMapper> mapper;
+		mapper->SetInputData(geometry);
+		mapper->SetBrickedVolume(std::move(bricked));
+		mapper->SetSampleDistance(sample_distance);
+		mapper->SetImageSampleDistance(img_sample_distance);
+		mapper->SetBlendModeToIsoSurface();
+
+		vtkNew<vtkVolume> volume;
+		volume->SetProperty(volumeProperty);
+		volume->SetMapper(mapper);
+
+		vtkNew<vtkPropCollection> actors;
+		actors->AddItem(volume);
+		actors->AddItem(GetVolumeInfoText(imgDataName, geometry));
+
+		return actors;
+	}
+
+	// ISO value given on the scale of the binary uint8 volume (0 - 255), mapped onto the scalar range of `scalar_type`
+	// like SetVolumeTransferFunctions does
+	double GetScalarIsoValue(int scalar_type, double iso)
+	{
+		switch (scalar_type) {
+		case VTK_UNSIGNED_SHORT:
+			return iso * VoxelTraits<unsigned short>::FullScale / VoxelTraits<unsigned char>::FullScale;
+		case VTK_FLOAT:
+			return iso * VoxelTraits<float>::FullScale / VoxelTraits<unsigned char>::FullScale;
+		default:
+			return iso;
+		}
+	}
+
+	// Surfaces of one volume extracted with vtkFlyingEdges3D (multithreaded through vtkSMPTools), cached per iso value
+	// so going back to an earlier ISO setting swaps the surface in without extracting it again. The least recently asked
+	// for surface makes room, so the surface of the iso value not being dragged stays cached.
+	// The cache empties itself when it is asked about another image or the image or its scalars were modified.
+	class IsoSurfaceCache {
+	public:
+		static constexpr size_t MaxSurfaces = 8;
+
+		vtkSmartPointer<vtkPolyData> GetSurface(vtkImageData* imgData, double iso) {
+			vtkDataArray* scalars = imgData->GetPointData()->GetScalars();
+			auto dataTime = scalars != nullptr ? std::max(imgData->GetMTime(), scalars->GetMTime()) : imgData->GetMTime();
+			if (imgData != Input || dataTime != InputTime)
+			{
+				Surfaces.clear();
+				Recent.clear();
+				Input = imgData;
+				InputTime = dataTime;
+			}
+			auto it = Surfaces.find(iso);
+			if (it != Surfaces.end())
+			{
+				Recent.splice(Recent.begin(), Recent, it->second.second);
+				return it->second.first;
+			}
+
+			vtkNew<vtkFlyingEdges3D> flyingEdges;
+			flyingEdges->SetInputData(imgData);
+			flyingEdges->SetValue(0, iso);
+			flyingEdges->ComputeNormalsOn();
+			flyingEdges->ComputeGradientsOff();
+			flyingEdges->ComputeScalarsOff();
+			flyingEdges->Update();
+			vtkSmartPointer<vtkPolyData> surface = flyingEdges->GetOutput();
+
+			// the surfaces asked for last are at the front, the other one of an UpdateIsoSurfaceActors call included
+			Recent.push_front(iso);
+			Surfaces[iso] = { surface, Recent.begin() };
+			while (Surfaces.size() > MaxSurfaces)
+			{
+				Surfaces.erase(Recent.back());
+				Recent.pop_back();
+			}
+			return surface;
+		}
+
+	private:
+		vtkSmartPointer<vtkImageData> Input;
+		vtkMTimeType InputTime = 0;
+		std::map<double, std::pair<vtkSmartPointer<vtkPolyData>, std::list<double>::iterator>> Surfaces;
+		std::list<double> Recent;  // most recently asked for first
+	};
+
+	// Point the two surface actors of SetupMyActorsForIsoSurface at the surfaces of iso1 / iso2 and color them like the
+	// volume's transfer functions: the iso1 surface translucent around the opaque iso2 surface
+	void UpdateIsoSurfaceActors(vtkActor* actor1, vtkActor* actor2,
+		                        IsoSurfaceCache& cache, vtkImageData* imgData,
+		                        double iso1, double iso2,
+		                        double color1[3], double color2[3])
+	{
+		int scalarType = imgData->GetScalarType();
+		static_cast<vtkPolyDataMapper*>(actor1->GetMapper())->SetInputData(cache.GetSurface(imgData, GetScalarIsoValue(scalarType, iso1)));
+		static_cast<vtkPolyDataMapper*>(actor2->GetMapper())->SetInputData(cache.GetSurface(imgData, GetScalarIsoValue(scalarType, iso2)));
+		actor1->GetProperty()->SetColor(color2);
+		actor1->GetProperty()->SetOpacity(0.3);
+		actor2->GetProperty()->SetColor(color1);
+		actor2->GetProperty()->SetOpacity(1.0);
+	}
+
+	// Extracted iso-surface alternative to SetupMyActorsForRayCast, usually much faster to render than ray casting the
+	// volume, above all on software GL. The first two props are the iso1 and iso2 surface actors
+	vtkSmartPointer<vtkPropCollection> SetupMyActorsForIsoSurface(std::string const& imgDataName,
+		                                                          vtkSmartPointer<vtkImageData> imgData,
+		                                                          IsoSurfaceCache& cache,
+		                                                          double iso1, double iso2,
+		                                                          double color1[3], double color2[3])
+	{
+		vtkNew<vtkPropCollection> actors;
+		vtkSmartPointer<vtkActor> surfaces[2];
+		for (auto& surface : surfaces)
+		{
+			vtkNew<vtkPolyDataMapper> mapper;
+			mapper->ScalarVisibilityOff();
+			surface = vtkSmartPointer<vtkActor>::New();
+			surface->SetMapper(mapper);
+			surface->GetProperty()->SetAmbient(0.4);
+			surface->GetProperty()->SetDiffuse(0.6);
+			surface->GetProperty()->SetSpecular(0.2);
+			actors->AddItem(surface);
+		}
+		UpdateIsoSurfaceActors(surfaces[0], surfaces[1], cache, imgData, iso1, iso2, color1, color2);
+		actors->AddItem(GetVolumeInfoText(imgDataName, imgData));
+		return actors;
+	}
+
+
+	// Progressive refinement for vtkFixedPointVolumeRayCastMapper: after every camera change the first frame is cast
+	// at a coarse image sample distance, each following frame halves it until the target distance is reached.
+	// Call Update once per frame before rendering; it returns true while frames are still being refined.
+	// The mapper keeps its gradient and min-max caches across the passes, only the rays are cast again.
+	struct ProgressiveImageSampling {
+		float startImageSampleDistance = 8.0f;
+
+		bool Update(vtkVolume* volume, vtkCamera* camera, float img_sample_distance) {
+			auto lod = LODVolume::SafeDownCast(volume);
+			auto mapper = vtkFixedPointVolumeRayCastMapper::SafeDownCast(lod ? lod->GetFullMapper() : volume->GetMapper());
+			if (mapper == nullptr)
+				return false;
+
+			// restart on camera changes and on a new volume
+			if (camera->GetMTime() != cameraTime || mapper != lastMapper)
+			{
+				cameraTime = camera->GetMTime();
+				lastMapper = mapper;
+				current = std::max(startImageSampleDistance, img_sample_distance);
+			}
+			else
+				current = std::max(current * 0.5f, img_sample_distance);
+
+			if (mapper->GetImageSampleDistance() != current)
+				mapper->SetImageSampleDistance(current);
+			return current > img_sample_distance;
+		}
+
+	private:
+		vtkMTimeType cameraTime = 0;
+		vtkFixedPointVolumeRayCastMapper* lastMapper = nullptr;
+		float current = 0;
+	};
+
+	// Clip with a single plane: the mapper's existing clipping plane is moved instead of piling up new ones
+	vtkPlane* SetClipPlane(vtkVolume* volume, double origin[3], double normal[3]) {
+		auto mapper = volume->GetMapper();
+		vtkPlaneCollection* planes = mapper->GetClippingPlanes();
+		vtkPlane* plane = planes != nullptr && planes->GetNumberOfItems() > 0 ? planes->GetItem(0) : nullptr;
+		if (plane == nullptr)
+		{
+			vtkNew<vtkPlane> newPlane;
+			mapper->AddClippingPlane(newPlane);
+			plane = newPlane;
+		}
 		plane->SetOrigin(origin);
 		plane->SetNormal(normal);
-		volume->GetMapper()->AddClippingPlane(plane);
+		return plane;
+	}
+
+	// Clip with `plane` itself, later changes of the plane show up on the next render without touching the mapper
+	void SetClipPlane(vtkAbstractMapper* mapper, vtkPlane* plane) {
+		vtkPlaneCollection* planes = mapper->GetClippingPlanes();
+		if (planes != nullptr && planes->GetNumberOfItems() == 1 && planes->IsItemPresent(plane))
+			return;
+		mapper->RemoveAllClippingPlanes();
+		mapper->AddClippingPlane(plane);
+	}
+
+	void SetClipPlane(vtkVolume* volume, vtkPlane* plane) {
+		SetClipPlane(volume->GetMapper(), plane);
+	}
+
+	// extracted iso-surfaces
+	void SetClipPlane(vtkActor* actor, vtkPlane* plane) {
+		SetClipPlane(actor->GetMapper(), plane);
+	}
+
+	// Interactive plane in the viewport that writes its origin and normal into `plane` while it is dragged,
+	// so a mapper clipped by `plane` follows it at interactive frame rates
+	vtkSmartPointer<vtkImplicitPlaneWidget2> SetUpClipPlaneWidget(vtkRenderWindowInteractor* interactor, vtkPlane* plane) {
+		vtkNew<vtkImplicitPlaneRepresentation> representation;
+		representation->SetPlaceFactor(1.0);
+		representation->OutlineTranslationOff();
+		representation->ScaleEnabledOff();
+
+		vtkNew<vtkCallbackCommand> callback;
+		callback->SetClientData(plane);
+		callback->SetCallback([](vtkObject* caller, unsigned long, void* clientData, void*) {
+			auto widget = static_cast<vtkImplicitPlaneWidget2*>(caller);
+			widget->GetImplicitPlaneRepresentation()->GetPlane(static_cast<vtkPlane*>(clientData));
+		});
+
+		vtkNew<vtkImplicitPlaneWidget2> widget;
+		widget->SetInteractor(interactor);
+		widget->SetRepresentation(representation);
+		widget->AddObserver(vtkCommand::InteractionEvent, callback);
+		return widget;
+	}
+
+	// fit the widget to `bounds` and move it onto `plane`
+	void PlaceClipPlaneWidget(vtkImplicitPlaneWidget2* widget, vtkPlane* plane, double bounds[6]) {
+		auto representation = widget->GetImplicitPlaneRepresentation();
+		representation->PlaceWidget(bounds);
+		representation->SetOrigin(plane->GetOrigin());
+		representation->SetNormal(plane->GetNormal());
 	}
 
 	void UnSetClip(vtkVolume* volume) {
 		volume->GetMapper()->RemoveAllClippingPlanes();
 	}
 
+	void UnSetClip(vtkActor* actor) {
+		actor->GetMapper()->RemoveAllClippingPlanes();
+	}
+
 	vtkSmartPointer<vtkOrientationMarkerWidget> SetUpAxesWidget(vtkRenderWindowInteractor* interactor) {
 		vtkNew<vtkNamedColors> colors;
 		// axes
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary silhouettes of one mesh seen from an azimuth x elevation grid of directions, for finding the view of an object
+// in an image without a renderer. Every silhouette is drawn orthographically, its bounding box centered and scaled so
+// the longer side fills the inner (1 - 2 Margin) of a Side x Side square, and packed one bit per pixel, one 64-bit
+// word per row with row 0 at the bottom and bit x for column x.
+// The view of template (azimuth, elevation) is the default VTK camera on +z looking at the mesh, turned by
+// Azimuth(azimuth) and then Elevation(elevation): seen from (sin a cos e, sin e, cos a cos e) with +y up
+struct SilhouetteTemplates
+{
+    static constexpr int Side = 64;
+    static constexpr double Margin = 1.0 / 16;
+
+    int AzimuthSteps = 0, ElevationSteps = 0;  // azimuths cover [0, 360), elevations [-MaxElevation, MaxElevation]
+    double MaxElevation = 0;                   // degrees
+    std::uint64_t MeshHash = 0;                // of the points and triangles they were built from
+    std::vector<std::uint64_t> Rows;           // Side words per template, azimuth fastest
+
+    int GetNumberOfTemplates() const { return AzimuthSteps * ElevationSteps; }
+    double GetAzimuth(int index) const;
+    double GetElevation(int index) const;
+    std::uint64_t const* GetTemplate(int index) const { return Rows.data() + static_cast<std::size_t>(index) * Side; }
+};
+
+// FNV-1a of the point coordinates and triangle indices, tells whether templates on disk belong to a mesh
+std::uint64_t HashMesh(float const* points, std::int64_t pointCount, std::uint32_t const* triangles, std::int64_t triangleCount);
+
+// Rasterize every view of the grid, the views in parallel; false when `cancel` was set before all were drawn
+bool BuildSilhouetteTemplates(float const* points, std::int64_t pointCount, std::uint32_t const* triangles,
+                              std::int64_t triangleCount, int azimuthSteps, int elevationSteps, double maxElevation,
+                              SilhouetteTemplates& templates, std::atomic<bool> const* cancel = nullptr);
+
+// Binary file of a small header and the packed rows, false when it cannot be written
+bool WriteSilhouetteTemplates(SilhouetteTemplates const& templates, std::string const& path);
+// false when the file is missing or no template file of this version
+bool ReadSilhouetteTemplates(std::string const& path, SilhouetteTemplates& templates);
+
+// Edges of an image crop packed like a template: the strongest Sobel gradients of the crop resampled to Side x Side,
+// and the same widened by one pixel so contours one pixel off still hit them
+struct SilhouetteQuery
+{
+    std::uint64_t Edges[SilhouetteTemplates::Side];
+    std::uint64_t NearEdges[SilhouetteTemplates::Side];
+};
+
+// `gray` is the crop already resampled to Side x Side, x fastest from the lower left, the crop being the square around
+// the object bounding box a template would put there
+SilhouetteQuery MakeSilhouetteQuery(float const* gray);
+
+struct SilhouetteMatch
+{
+    int Index = -1;
+    double Azimuth = 0, Elevation = 0;
+    double Score = 0;  // F-measure of the contour pixels on query edges and the query edges next to the contour
+};
+
+// The `count` templates whose contours lie best on the query edges, best first. Scoring only the contour on edges
+// would tie every view whose contour runs inside the widened edges, the edges the contour leaves out tell them apart
+std::vector<SilhouetteMatch> FindBestViews(SilhouetteTemplates const& templates, SilhouetteQuery const& query, int count);
\ No newline at end of file
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "cpu_features.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+enum class RayCastScalar {
+    UnsignedChar,
+    UnsignedShort,
+    Float
+};
+
+class BrickedVolume;
+class BrickCache;
+
+// Per-brick min/max of a scalar volume in bricks of BrickSize^3 voxels. Every brick also covers the first voxel
+// layer of its upper neighbors, so all trilinear samples taken inside a brick lie within [min, max].
+// Built in parallel, it only depends on the voxels and is rebuilt when they change, not with the transfer function.
+class BrickMinMax
+{
+public:
+    static constexpr int BrickSize = 8;
+
+    void Build(void const* voxels, RayCastScalar scalar, int const dim[3]);
+    // from the value ranges of the compressed bricks, without decompressing any; the ranges are the union of the
+    // compressed bricks each brick overlaps, so they may be wider than the voxels'
+    void Build(BrickedVolume const& volume);
+
+    int Dim[3] = { 0, 0, 0 };  // bricks along x, y, z
+    std::vector<float> Min, Max;
+};
+
+// Per-voxel gradients for shading, central differences in index space quantized to 32 bits: the direction as a 12+12 bit
+// octahedral normal and the L1 magnitude as 8 bits of MaxMagnitude. Built in parallel once per volume, they do not depend
+// on the transfer functions and one instance can be shared by any number of casters
+class QuantizedGradients
+{
+public:
+    void Build(void const* voxels, RayCastScalar scalar, int const dim[3]);
+
+    // index-space gradient of voxel x + y Dim[0] + z Dim[0] Dim[1]
+    void Decode(std::int64_t voxel, float g[3]) const;
+
+    std::size_t GetMemorySize() const { return Encoded.size() * sizeof(std::uint32_t); }
+
+    int Dim[3] = { 0, 0, 0 };
+    float MaxMagnitude = 0;
+    std::vector<std::uint32_t> Encoded;  // u | v << 12 | magnitude << 24
+};
+
+// camera, clipping and output image of one ray-cast frame
+struct RayCastView
+{
+    double NdcToWorld[16];    // row-major, normalized device coordinates (x, y, z in [-1, 1]) to world
+    double WorldToIndex[12];  // row-major affine 3x4, world to continuous voxel index
+    std::vector<std::array<double, 4>> ClipPlanes;  // world half-spaces a x + b y + c z + d >= 0 that are kept
+    int ImageSize[2];         // pixels cast
+    int ImageStride;          // pixels per image row
+    double SampleDistance;    // world units along a ray
+};
+
+enum class RayCastBlend {
+    Composite,
+    IsoSurface
+};
+
+// transfer functions and shading, tables cover [Range[0], Range[1]] evenly
+struct RayCastTransfer
+{
+    RayCastBlend Blend = RayCastBlend::Composite;
+    double Range[2];
+    std::vector<float> Color;    // rgb per entry
+    std::vector<float> Opacity;  // per entry, for OpacityUnitDistance
+    double OpacityUnitDistance = 1.0;
+    bool Shade = false;
+    float Ambient = 0.4f, Diffuse = 0.6f, Specular = 0.2f, SpecularPower = 10.0f;
+
+    // IsoSurface: the surfaces of these values, colored and weighted by the tables at their value.
+    // Binary and coverage volumes are interpolated trilinearly, so any value between empty and full works
+    std::vector<double> IsoValues;
+    // IsoSurface: the scalars are signed distances in world units, rays step ahead by the distance to the nearest
+    // iso value instead of SampleDistance while that is larger
+    bool DistanceField = false;
+};
+
+// CPU volume ray caster, front-to-back compositing with early ray termination that steps over bricks the opacity
+// transfer function (or, for iso-surfaces, the iso values) makes fully transparent.
+// The image is cast in 16x16 pixel tiles handed out by a work-stealing scheduler; with AVX2 every tile is traced in
+// packets of 8 rays (4x2 pixels) stepping in lockstep, the scalar path traces one ray at a time.
+// A BrickedVolume is rendered without its dense copy: constant bricks are sampled as their value, the others are
+// decompressed the first time a ray samples them, so bricks the transfer function makes transparent stay compressed.
+// That path traces one ray at a time and shades with central differences
+class VolumeRayCaster
+{
+public:
+    explicit VolumeRayCaster(SimdLevel level = DetectSimdLevel()) : Level(level) {}
+
+    // the voxels are referenced, not copied, and must stay alive until the next SetVolume
+    void SetVolume(void const* voxels, RayCastScalar scalar, int const dim[3]);
+    // the bricks decompressed for earlier frames are kept until the next SetVolume
+    void SetVolume(std::shared_ptr<BrickedVolume const> volume);
+
+    // Precomputed gradients of the volume, used for shading while their dimensions match it; without them every shaded
+    // sample takes central differences of six trilinear samples
+    void SetGradients(std::shared_ptr<QuantizedGradients const> gradients) { Gradients = std::move(gradients); }
+
+    // premultiplied RGBA, ImageStride x ImageSize[1] pixels
+    void Render(RayCastView const& view, RayCastTransfer const& transfer, unsigned char* rgba) const;
+
+    BrickMinMax const& GetBricks() const { return Bricks; }
+    SimdLevel GetSimdLevel() const { return Level; }
+    // of a BrickedVolume: the bricks decompressed so far and their bytes
+    int GetDecompressedBricks() const;
+    std::size_t GetDecompressedBrickBytes() const;
+
+private:
+    SimdLevel Level;
+    void const* Voxels = nullptr;
+    RayCastScalar Scalar = RayCastScalar::UnsignedChar;
+    int Dim[3] = { 0, 0, 0 };
+    BrickMinMax Bricks;
+    std::shared_ptr<QuantizedGradients const> Gradients;
+    std::shared_ptr<BrickCache> Bricked;  // instead of Voxels
+};
\ No newline at end of file
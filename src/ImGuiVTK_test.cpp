@@ -14,7 +14,9 @@
 #include "ImGuiVTK.h"
 #include "imfilebrowser.h"
 #include "my_pipeline.h"
+#include "background_job.h"
 #include <stdio.h>
+#include <filesystem>
 
 #include <glad/glad.h>
 
@@ -26,6 +28,16 @@ static void glfw_error_callback(int error, const char* description)
     fprintf(stderr, "Glfw Error %d: %s\n", error, description);
 }
 
+// volume and props built off the UI thread, swapped into the renderer once complete
+struct VolumeRebuild
+{
+    vtkSmartPointer<vtkImageData> ImgData = nullptr;
+    vtkSmartPointer<vtkPropCollection> Props = nullptr;
+    IsoSurfaceCache Surfaces;  // ExtractedIsoSurface: the surfaces extracted for the new image
+    std::string BrickedKey;  // BrickedStorage: mesh and voxelization settings of the compressed volume
+    std::shared_ptr<BrickedVolume const> Bricked = nullptr;
+};
+
 int main(int argc, char* argv[])
 {
     // Setup window
@@ -92,17 +104,158 @@ int main(int argc, char* argv[])
     vtkSmartPointer<vtkImageData> ImgData = nullptr;
 
     float SpacingX = 0.1f, SpacingY = 0.1f, SpacingZ = 0.1f;
+    int SlabDepth = 16;  // voxelize in z-slabs of this many slices, 0: whole volume at once (a rebuild can only be cancelled between slabs)
+    const char* VoxelizeEngineType[] = { "Stencil", "SimdParity" };
+    int CurrentVoxelizeEngine = 0;
+    const char* VoxelTypeName[] = { "uint8 (binary)", "uint16 (coverage)", "float (coverage)" };
+    int CurrentVoxelType = 0;
+    int CoverageSubsamples = 2;  // rays per voxel side for coverage volumes (SimdParity only)
+    bool BrickedStorage = false;  // voxelize into compressed bricks and keep them, revisiting a mesh and its settings only decompresses
+    std::map<std::string, std::shared_ptr<BrickedVolume const>> BrickedVolumes;  // by BrickedKey
     float SampleDistance = 0.1f, ImgSampleDistance = 1.f;
+    int LODShrink = 2;  // downsampling of the proxy volume rendered during camera interaction, 1: no proxy
     double Iso1 = 0.5, Iso2 = 1.5;
     ImVec4 Iso1Color = ImVec4(1.00f, 0.96f, 0.93f, 1.00f), Iso2Color = ImVec4(0.78f, 0.47f, 0.15f, 1.00f);
 
-    const char* RayCastType[] = { "FixedPointVolumeRayCast", "GPUVolumeRayCast", "SmartVolume" };
+    const char* RenderModeName[] = { "RayCast", "ExtractedIsoSurface" };
+    int CurrentRenderMode = 0;
+    IsoSurfaceCache SurfaceCache;  // surfaces of ImgData per iso value
+    const char* RayCastType[] = { "FixedPointVolumeRayCast", "GPUVolumeRayCast", "SmartVolume", "CpuRayCast" };
     int CurrentRayCastType = 1;
+    bool CpuIsoSurface = true;  // CpuRayCast: iso-surface blend, composite otherwise
+    bool ProgressiveRefinement = true;  // FixedPointVolumeRayCast: coarse first frame after camera changes, refined while idle
+    ProgressiveImageSampling progressiveSampling;
 
     double ClipPlaneOrigin[3] = { 0 }, ClipPlaneNormal[3] = { 0 };
+    bool ClipOn = false;
+    bool ClipWidgetOn = false;
+    // the one clipping plane of the shown volume, moved in place by the Clip panel and the plane widget
+    vtkNew<vtkPlane> ClipPlane;
+    vtkMTimeType ClipPlaneTime = ClipPlane->GetMTime();
+    auto clipWidget = SetUpClipPlaneWidget(interactor, ClipPlane);
+    bool VoxelizeClipRegion = false;  // voxelize only the half-space kept by the clip plane instead of clipping at render time
 
     bool GridOn = true;
 
+    // props[0] is the volume, or with extracted iso-surfaces props[0] and props[1] are the surface actors
+    auto ShownVolume = [&]() -> vtkVolume* {
+        return props->GetNumberOfItems() != 0 ? vtkVolume::SafeDownCast(props->GetItemAsObject(0)) : nullptr;
+    };
+    auto ShownSurface = [&](int i) { return static_cast<vtkActor*>(props->GetItemAsObject(i)); };
+    // the CpuRayCastMapper rendering the bricks of a BrickedVolume, ImgData then has no scalars
+    auto ShownBrickedMapper = [&]() -> CpuRayCastMapper* {
+        auto volume = ShownVolume();
+        auto mapper = volume != nullptr ? CpuRayCastMapper::SafeDownCast(volume->GetMapper()) : nullptr;
+        return mapper != nullptr && mapper->GetBrickedVolume() != nullptr ? mapper : nullptr;
+    };
+
+    // edit the transfer functions of the shown volume in place, or swap in the surfaces of the new ISO values
+    auto UpdateTransferFunctions = [&]() {
+        double color1[3] = { Iso1Color.x, Iso1Color.y, Iso1Color.z };
+        double color2[3] = { Iso2Color.x, Iso2Color.y, Iso2Color.z };
+        if (auto volume = ShownVolume())
+        {
+            auto bricked = ShownBrickedMapper();
+            int scalarType = bricked != nullptr ? GetVtkScalarType(bricked->GetBrickedVolume()->GetScalar()) : ImgData->GetScalarType();
+            SetVolumeTransferFunctions(volume->GetProperty(), scalarType, Iso1, Iso2, color1, color2);
+        }
+        else if (props->GetNumberOfItems() != 0)
+            UpdateIsoSurfaceActors(ShownSurface(0), ShownSurface(1), SurfaceCache, ImgData, Iso1, Iso2, color1, color2);
+    };
+
+    auto ClipShownProps = [&](bool clip) {
+        if (auto volume = ShownVolume())
+        {
+            if (clip)
+                SetClipPlane(volume, ClipPlane);
+            else
+                UnSetClip(volume);
+        }
+        else if (props->GetNumberOfItems() != 0)
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                if (clip)
+                    SetClipPlane(ShownSurface(i), ClipPlane);
+                else
+                    UnSetClip(ShownSurface(i));
+            }
+        }
+    };
+
+    // voxelization and mapper setup run in the background, the old props keep rendering meanwhile
+    BackgroundJob<VolumeRebuild> rebuildJob;
+    auto StartRebuild = [&]() {
+        // the job works on its own copies of the settings and a shallow copy of the mesh
+        auto mesh = vtkSmartPointer<vtkPolyData>::New();
+        mesh->ShallowCopy(PolyData);
+        std::string name = FileName;
+        double spacing[3] = { SpacingX, SpacingY, SpacingZ };
+        double color1[3] = { Iso1Color.x, Iso1Color.y, Iso1Color.z };
+        double color2[3] = { Iso2Color.x, Iso2Color.y, Iso2Color.z };
+        auto voxelType = static_cast<VoxelType>(CurrentVoxelType);
+        auto engine = static_cast<VoxelizeEngine>(CurrentVoxelizeEngine);
+        int subsamples = CurrentVoxelType == 0 ? 1 : CoverageSubsamples;
+        auto volumeType = static_cast<VolumeType>(CurrentRayCastType);
+        bool isoSurface = CurrentRenderMode == 1;
+        bool brickedRayCast = !isoSurface && volumeType == VolumeType::CpuRayCast;  // renders the bricks on demand
+        VoxelRegion region;
+        if (ClipOn && VoxelizeClipRegion)
+        {
+            region.useHalfSpace = true;
+            std::copy(ClipPlaneOrigin, ClipPlaneOrigin + 3, region.planeOrigin);
+            std::copy(ClipPlaneNormal, ClipPlaneNormal + 3, region.planeNormal);
+        }
+        std::string brickedKey;
+        std::shared_ptr<BrickedVolume const> bricked;
+        if (BrickedStorage)
+        {
+            std::ostringstream key;
+            key << name << '|' << spacing[0] << ' ' << spacing[1] << ' ' << spacing[2] << '|' << CurrentVoxelType << '|'
+                << CurrentVoxelizeEngine << '|' << subsamples;
+            if (region.useHalfSpace)
+                key << '|' << region.planeOrigin[0] << ' ' << region.planeOrigin[1] << ' ' << region.planeOrigin[2] << ' '
+                    << region.planeNormal[0] << ' ' << region.planeNormal[1] << ' ' << region.planeNormal[2];
+            brickedKey = key.str();
+            auto found = BrickedVolumes.find(brickedKey);
+            if (found != BrickedVolumes.end())
+                bricked = found->second;
+        }
+        rebuildJob.Start([=, slabDepth = SlabDepth, sampleDistance = SampleDistance, imgSampleDistance = ImgSampleDistance,
+                          iso1 = Iso1, iso2 = Iso2, lodShrink = LODShrink](BackgroundJob<VolumeRebuild>::CancelFlag const& cancel) mutable {
+            VolumeRebuild rebuild;
+            if (!brickedKey.empty())
+            {
+                rebuild.BrickedKey = brickedKey;
+                rebuild.Bricked = bricked != nullptr ? bricked : ConvertMeshPolyDataToBrickedVolume(voxelType, mesh, spacing, engine, subsamples, region, &cancel);
+                if (rebuild.Bricked == nullptr || cancel)
+                    return rebuild;
+                if (brickedRayCast)
+                {
+                    rebuild.ImgData = GetBrickedVolumeGeometry(*rebuild.Bricked);
+                    rebuild.Props = SetupMyActorsForBrickedRayCast(name, rebuild.ImgData, rebuild.Bricked, sampleDistance, imgSampleDistance,
+                                                                   iso1, iso2, color1, color2);
+                    return rebuild;
+                }
+                // the other mappers and the iso-surface cache render from a dense image of the whole extent, so for them
+                // the shown volume is decompressed whole
+                vtkNew<BrickedVolumeSource> source;
+                source->SetVolume(rebuild.Bricked);
+                source->Update();
+                rebuild.ImgData = source->GetOutput();
+            }
+            else
+                rebuild.ImgData = ConvertMeshPolyDataToImageData(voxelType, mesh, spacing, slabDepth, engine, subsamples, region, &cancel);
+            if (rebuild.ImgData == nullptr || cancel)
+                return rebuild;
+            if (isoSurface)
+                rebuild.Props = SetupMyActorsForIsoSurface(name, rebuild.ImgData, rebuild.Surfaces, iso1, iso2, color1, color2);
+            else
+                rebuild.Props = SetupMyActorsForRayCast(name, rebuild.ImgData, volumeType, sampleDistance, imgSampleDistance, iso1, iso2, color1, color2, lodShrink);
+            return rebuild;
+        });
+    };
+
     // Main loop
     while (!glfwWindowShouldClose(window))
     {
@@ -115,54 +268,146 @@ int main(int argc, char* argv[])
 
         // volume rendering adjustments
         ImGui::Begin("Rendering Config");
-        ImGui::SliderFloat("SpacingX", &SpacingX, 0.0f, 1.0f);
-        ImGui::SliderFloat("SpacingY", &SpacingY, 0.0f, 1.0f);
-        ImGui::SliderFloat("SpacingZ", &SpacingZ, 0.0f, 1.0f);
+        bool spacingChanged = ImGui::SliderFloat("SpacingX", &SpacingX, 0.0f, 1.0f);
+        spacingChanged |= ImGui::SliderFloat("SpacingY", &SpacingY, 0.0f, 1.0f);
+        spacingChanged |= ImGui::SliderFloat("SpacingZ", &SpacingZ, 0.0f, 1.0f);
+        if (spacingChanged)
+            rebuildJob.Cancel();  // the running rebuild is out of date
+        ImGui::InputInt("SlabDepth", &SlabDepth);
+        ImGui::ListBox("VoxelizeEngine", &CurrentVoxelizeEngine, VoxelizeEngineType, IM_ARRAYSIZE(VoxelizeEngineType), 2);
+        ImGui::ListBox("VoxelType", &CurrentVoxelType, VoxelTypeName, IM_ARRAYSIZE(VoxelTypeName), 3);
+        ImGui::SliderInt("CoverageSubsamples", &CoverageSubsamples, 1, 8);
+        ImGui::Checkbox("BrickedStorage", &BrickedStorage);
         ImGui::InputFloat("SampleDistance", &SampleDistance);
         ImGui::SliderFloat("ImgSampleDistance", &ImgSampleDistance, 1.f, 100.f);
-        ImGui::InputDouble("ISO1", &Iso1);
-        ImGui::InputDouble("ISO2", &Iso2);
-        ImGui::ColorEdit3("ISO1 Color", (float*)&Iso1Color);
-        ImGui::ColorEdit3("ISO2 Color", (float*)&Iso2Color);
+        ImGui::SliderInt("LODShrink", &LODShrink, 1, 8);
+        bool transferFunctionChanged = ImGui::InputDouble("ISO1", &Iso1);
+        transferFunctionChanged |= ImGui::InputDouble("ISO2", &Iso2);
+        transferFunctionChanged |= ImGui::ColorEdit3("ISO1 Color", (float*)&Iso1Color);
+        transferFunctionChanged |= ImGui::ColorEdit3("ISO2 Color", (float*)&Iso2Color);
+        if (transferFunctionChanged && props->GetNumberOfItems() != 0)
+            UpdateTransferFunctions();  // no rebuild needed
+        ImGui::ListBox("RenderMode", &CurrentRenderMode, RenderModeName, IM_ARRAYSIZE(RenderModeName), 2);
         ImGui::ListBox("RayCastType", &CurrentRayCastType, RayCastType, IM_ARRAYSIZE(RayCastType), 4);
+        if (ImGui::Checkbox("CpuIsoSurface", &CpuIsoSurface) && ShownVolume() != nullptr)
+            SetCpuRayCastBlendMode(ShownVolume(),
+                                   CpuIsoSurface ? vtkVolumeMapper::ISOSURFACE_BLEND : vtkVolumeMapper::COMPOSITE_BLEND);
+        ImGui::Checkbox("ProgressiveRefinement", &ProgressiveRefinement);
         ImGui::Checkbox("GridOn", &GridOn);
 
         ImGui::PushStyleColor(ImGuiCol_Button, ImVec4{ 0.2f, 0.3f, 0.4f, 1.0f });
         if (ImGui::Button("Config") && PolyData != nullptr)
         {
-            // clean up old props
-            if (props->GetNumberOfItems() != 0) instance.RemoveProps(props);
-            // Setup actor pipeline
-            double spacing[3] = { SpacingX, SpacingY, SpacingZ };
-            ImgData = ConvertMeshPolyDataToImageData(PolyData, spacing);
-            double color1[3] = { Iso1Color.x, Iso1Color.y, Iso1Color.z };
-            double color2[3] = { Iso2Color.x, Iso2Color.y, Iso2Color.z };
-            props = SetupMyActorsForRayCast(FileName, ImgData, static_cast<VolumeType>(CurrentRayCastType), SampleDistance, ImgSampleDistance, Iso1, Iso2, color1, color2);
-            if (GridOn)
-                props->AddItem(GetCubeAxesActor(instance.Renderer->GetActiveCamera(), ImgData->GetBounds()));
-            instance.AddProps(props);
+            // restarts a rebuild that is still running
+            StartRebuild();
             fileDialog.ClearSelected();
         }
+        ImGui::SameLine();
+        if (ImGui::Button("Voxelize To Disk") && PolyData != nullptr)
+        {
+            // stream the volume slab by slab into a .mhd/.raw pair next to the mesh
+            double spacing[3] = { SpacingX, SpacingY, SpacingZ };
+            VoxelRegion region;
+            if (ClipOn && VoxelizeClipRegion)
+            {
+                region.useHalfSpace = true;
+                std::copy(ClipPlaneOrigin, ClipPlaneOrigin + 3, region.planeOrigin);
+                std::copy(ClipPlaneNormal, ClipPlaneNormal + 3, region.planeNormal);
+            }
+            auto path = std::filesystem::path(FileName).replace_extension(".mhd").string();
+            if (!ConvertMeshPolyDataToRawFile(static_cast<VoxelType>(CurrentVoxelType), PolyData, spacing, path, SlabDepth > 0 ? SlabDepth : 16,
+                                              static_cast<VoxelizeEngine>(CurrentVoxelizeEngine), CurrentVoxelType == 0 ? 1 : CoverageSubsamples, region))
+                fprintf(stderr, "Failed to write volume to %s\n", path.c_str());
+        }
         ImGui::PopStyleColor(1);
+        if (rebuildJob.IsRunning())
+        {
+            ImGui::Text("Rebuilding volume...");
+            ImGui::SameLine();
+            if (ImGui::Button("Cancel"))
+                rebuildJob.Cancel();
+        }
         ImGui::End();
 
         // clip
         ImGui::Begin("Clip");
+        if (ClipPlane->GetMTime() != ClipPlaneTime)
+        {
+            // dragged with the widget
+            ClipPlaneTime = ClipPlane->GetMTime();
+            ClipPlane->GetOrigin(ClipPlaneOrigin);
+            ClipPlane->GetNormal(ClipPlaneNormal);
+        }
         ImGui::InputScalarN("PlaneOrigin", ImGuiDataType_Double, ClipPlaneOrigin, 3, NULL, NULL, "%.6f");
         ImGui::InputScalarN("PlaneNormal", ImGuiDataType_Double, ClipPlaneNormal, 3, NULL, NULL, "%.6f");
-        if (ImGui::Button("Clip") && PolyData != nullptr && props->GetNumberOfItems() != 0) {
-            instance.RemoveProps(props);
-            SetClipPlane(static_cast<vtkVolume*>(props->GetItemAsObject(0)), ClipPlaneOrigin, ClipPlaneNormal);
-            instance.AddProps(props);
+        ImGui::Checkbox("VoxelizeClipRegion", &VoxelizeClipRegion);
+        bool hasVolume = PolyData != nullptr && props->GetNumberOfItems() != 0;
+        if (ImGui::Checkbox("PlaneWidget", &ClipWidgetOn) && hasVolume) {
+            if (ClipWidgetOn) {
+                // start from the typed plane, or a z plane through the volume center
+                if (ClipPlaneNormal[0] == 0 && ClipPlaneNormal[1] == 0 && ClipPlaneNormal[2] == 0) {
+                    ImgData->GetCenter(ClipPlaneOrigin);
+                    ClipPlaneNormal[2] = 1;
+                }
+                ClipPlane->SetOrigin(ClipPlaneOrigin);
+                ClipPlane->SetNormal(ClipPlaneNormal);
+                PlaceClipPlaneWidget(clipWidget, ClipPlane, ImgData->GetBounds());
+                clipWidget->On();
+                if (!VoxelizeClipRegion) {
+                    ClipOn = true;
+                    ClipShownProps(true);
+                }
+            }
+            else
+                clipWidget->Off();
+        }
+        if (ImGui::Button("Clip") && hasVolume) {
+            ClipOn = true;
+            ClipPlane->SetOrigin(ClipPlaneOrigin);
+            ClipPlane->SetNormal(ClipPlaneNormal);
+            if (ClipWidgetOn)
+                PlaceClipPlaneWidget(clipWidget, ClipPlane, ImgData->GetBounds());
+            if (VoxelizeClipRegion)
+                StartRebuild();  // the new volume only covers the kept half-space
+            else
+                ClipShownProps(true);
         }
         ImGui::SameLine();
-        if (ImGui::Button("UnsetClip") && PolyData != nullptr && props->GetNumberOfItems() != 0) {
-            instance.RemoveProps(props);
-            UnSetClip(static_cast<vtkVolume*>(props->GetItemAsObject(0)));
-            instance.AddProps(props);
+        if (ImGui::Button("UnsetClip") && hasVolume) {
+            ClipOn = false;
+            ClipWidgetOn = false;
+            clipWidget->Off();
+            ClipShownProps(false);
+            if (VoxelizeClipRegion)
+                StartRebuild();
         }
         ImGui::End();
 
+        // memory and precomputation of the shown volume
+        ImGui::Begin("Stats");
+        if (ImgData != nullptr)
+            ImGui::Text("Volume: %.1f MiB", ImgData->GetActualMemorySize() / 1024.0);
+        auto gradientStats = GetGradientCache().GetStats();
+        ImGui::Text("Gradients (CpuRayCast): %d volumes, %.1f MiB, built in %.1f ms", gradientStats.Volumes,
+                    gradientStats.Bytes / (1024.0 * 1024.0), gradientStats.BuildMilliseconds);
+        size_t compressed = 0, dense = 0;
+        for (auto const& entry : BrickedVolumes)
+        {
+            compressed += entry.second->GetCompressedSize();
+            dense += entry.second->GetDecompressedSize();
+        }
+        ImGui::Text("Bricked volumes: %d, %.1f MiB of %.1f MiB dense", static_cast<int>(BrickedVolumes.size()),
+                    compressed / (1024.0 * 1024.0), dense / (1024.0 * 1024.0));
+        if (auto bricked = ShownBrickedMapper())
+            ImGui::Text("Shown volume: %d bricks decompressed on demand, %.1f MiB",
+                        bricked->GetRayCaster().GetDecompressedBricks(),
+                        bricked->GetRayCaster().GetDecompressedBrickBytes() / (1024.0 * 1024.0));
+        else if (BrickedStorage && ImgData != nullptr)
+            ImGui::TextWrapped("The shown volume is decompressed whole (Volume above); only CpuRayCast in RayCast mode renders the bricks on demand.");
+        if (ImGui::Button("Clear Bricked"))
+            BrickedVolumes.clear();
+        ImGui::End();
+
         // file browser
         if (ImGui::Begin("FileBrowser"))
         {
@@ -174,24 +419,43 @@ int main(int argc, char* argv[])
         fileDialog.Display();
         if (fileDialog.HasSelected())
         {
-            // clean up old props
-            if (props->GetNumberOfItems() != 0) instance.RemoveProps(props);
             // Setup actor pipeline
             FileName = fileDialog.GetSelected().string();
             PolyData = ReadPolyData(FileName.c_str());
-            double spacing[3] = { SpacingX, SpacingY, SpacingZ };
-            ImgData = ConvertMeshPolyDataToImageData(PolyData, spacing);
-            double color1[3] = { Iso1Color.x, Iso1Color.y, Iso1Color.z };
-            double color2[3] = { Iso2Color.x, Iso2Color.y, Iso2Color.z };
-            props = SetupMyActorsForRayCast(FileName, ImgData, static_cast<VolumeType>(CurrentRayCastType), SampleDistance, ImgSampleDistance, Iso1, Iso2, color1, color2);
-            if (GridOn)
-                props->AddItem(GetCubeAxesActor(instance.Renderer->GetActiveCamera(), ImgData->GetBounds()));
-            instance.AddProps(props);
+            StartRebuild();
             fileDialog.ClearSelected();
         }
 
+        // swap in a finished rebuild, old and new props change within this frame
+        VolumeRebuild rebuild;
+        if (rebuildJob.Poll(rebuild))
+        {
+            if (rebuild.Props == nullptr)
+                fprintf(stderr, "Failed to build the volume of %s (empty clip region?)\n", FileName.c_str());
+            else
+            {
+                if (GridOn)
+                    rebuild.Props->AddItem(GetCubeAxesActor(instance.Renderer->GetActiveCamera(), rebuild.ImgData->GetBounds()));
+                if (props->GetNumberOfItems() != 0) instance.RemoveProps(props);
+                ImgData = rebuild.ImgData;
+                props = rebuild.Props;
+                if (rebuild.Bricked != nullptr)
+                    BrickedVolumes[rebuild.BrickedKey] = rebuild.Bricked;
+                SurfaceCache = std::move(rebuild.Surfaces);
+                UpdateTransferFunctions();  // edited while rebuilding
+                if (auto volume = ShownVolume())
+                    SetCpuRayCastBlendMode(volume, CpuIsoSurface ? vtkVolumeMapper::ISOSURFACE_BLEND : vtkVolumeMapper::COMPOSITE_BLEND);
+                if (ClipOn && !VoxelizeClipRegion)
+                    ClipShownProps(true);
+                instance.AddProps(props);
+            }
+        }
+
         // Rendering
 
+        progressiveSampling.startImageSampleDistance = ProgressiveRefinement ? 8.0f : 0.0f;  // 0: always the target distance
+        if (auto volume = ShownVolume())
+            progressiveSampling.Update(volume, instance.Renderer->GetActiveCamera(), ImgSampleDistance);
         instance.Render();
         ImGui::Render();
 
@@ -208,6 +472,7 @@ int main(int argc, char* argv[])
     }
 
     // Cleanup
+    rebuildJob.Cancel();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     instance.ShutDown();
@@ -0,0 +1,261 @@
+#include "bricked_volume.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    constexpr int BrickSize = BrickedVolume::BrickSize;
+
+    std::size_t ScalarSize(RayCastScalar scalar)
+    {
+        switch (scalar) {
+        case RayCastScalar::UnsignedShort: return sizeof(unsigned short);
+        case RayCastScalar::Float: return sizeof(float);
+        default: return sizeof(unsigned char);
+        }
+    }
+
+    template <typename T>
+    void AppendRun(std::vector<std::uint8_t>& runs, std::uint32_t length, T value)
+    {
+        auto n = static_cast<std::uint16_t>(length - 1);  // a brick holds at most 32^3 voxels
+        std::uint8_t bytes[sizeof(std::uint16_t) + sizeof(T)];
+        std::memcpy(bytes, &n, sizeof(n));
+        std::memcpy(bytes + sizeof(n), &value, sizeof(T));
+        runs.insert(runs.end(), bytes, bytes + sizeof(bytes));
+    }
+
+    template <typename T>
+    void DecodeRuns(std::vector<std::uint8_t> const& runs, T* out)
+    {
+        for (size_t i = 0; i < runs.size(); i += sizeof(std::uint16_t) + sizeof(T))
+        {
+            std::uint16_t n;
+            T value;
+            std::memcpy(&n, &runs[i], sizeof(n));
+            std::memcpy(&value, &runs[i + sizeof(n)], sizeof(T));
+            out = std::fill_n(out, n + 1, value);
+        }
+    }
+}
+
+BrickedVolume::BrickedVolume(RayCastScalar scalar, int const dim[3], double const origin[3], double const spacing[3])
+    : Scalar(scalar)
+{
+    for (int a = 0; a < 3; ++a)
+    {
+        Dim[a] = dim[a];
+        Origin[a] = origin[a];
+        Spacing[a] = spacing[a];
+        BrickDim[a] = (dim[a] + BrickSize - 1) / BrickSize;
+    }
+    Bricks.resize(static_cast<size_t>(BrickDim[0]) * BrickDim[1] * BrickDim[2]);
+}
+
+template <typename T>
+void BrickedVolume::CompressLayer(int z0, T const* slab)
+{
+    int bz = z0 / BrickSize;
+    int depth = std::min(BrickSize, Dim[2] - z0);
+    auto sliceSize = static_cast<std::int64_t>(Dim[0]) * Dim[1];
+    ParallelFor(0, static_cast<std::int64_t>(BrickDim[0]) * BrickDim[1], 1, [&](std::int64_t begin, std::int64_t end) {
+        std::vector<std::uint8_t> runs;
+        for (auto i = begin; i < end; ++i)
+        {
+            int bx = static_cast<int>(i % BrickDim[0]), by = static_cast<int>(i / BrickDim[0]);
+            int x0 = bx * BrickSize, y0 = by * BrickSize;
+            int x1 = std::min(x0 + BrickSize, Dim[0]), y1 = std::min(y0 + BrickSize, Dim[1]);
+
+            runs.clear();
+            T value = slab[x0 + static_cast<std::int64_t>(y0) * Dim[0]];
+            T vmin = value, vmax = value;
+            std::uint32_t length = 0;
+            bool constant = true;
+            for (int z = 0; z < depth; ++z)
+            {
+                for (int y = y0; y < y1; ++y)
+                {
+                    T const* row = slab + z * sliceSize + static_cast<std::int64_t>(y) * Dim[0];
+                    for (int x = x0; x < x1; ++x)
+                    {
+                        if (row[x] == value)
+                        {
+                            ++length;
+                            continue;
+                        }
+                        AppendRun(runs, length, value);
+                        constant = false;
+                        value = row[x];
+                        vmin = std::min(vmin, value);
+                        vmax = std::max(vmax, value);
+                        length = 1;
+                    }
+                }
+            }
+
+            Brick& brick = Bricks[(static_cast<size_t>(bz) * BrickDim[1] + by) * BrickDim[0] + bx];
+            brick.Constant = 0;
+            brick.Min = static_cast<float>(vmin);
+            brick.Max = static_cast<float>(vmax);
+            if (constant)
+            {
+                std::memcpy(&brick.Constant, &value, sizeof(T));
+                std::vector<std::uint8_t>().swap(brick.Runs);
+            }
+            else
+            {
+                AppendRun(runs, length, value);
+                brick.Runs.assign(runs.begin(), runs.end());
+            }
+        }
+    });
+}
+
+template <typename T>
+void BrickedVolume::DecompressExtent(int const extent[6], T* out) const
+{
+    int b0[3], count[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        b0[a] = extent[2 * a] / BrickSize;
+        count[a] = extent[2 * a + 1] / BrickSize - b0[a] + 1;
+    }
+    std::int64_t rowSize = extent[1] - extent[0] + 1;
+    std::int64_t sliceSize = rowSize * (extent[3] - extent[2] + 1);
+
+    ParallelFor(0, static_cast<std::int64_t>(count[0]) * count[1] * count[2], 1, [&](std::int64_t begin, std::int64_t end) {
+        std::vector<T> voxels;
+        for (auto i = begin; i < end; ++i)
+        {
+            int b[3] = { b0[0] + static_cast<int>(i % count[0]), b0[1] + static_cast<int>(i / count[0] % count[1]),
+                         b0[2] + static_cast<int>(i / (static_cast<std::int64_t>(count[0]) * count[1])) };
+            // the brick's voxels and the part of them inside the extent
+            int lo[3], size[3], from[3], to[3];
+            for (int a = 0; a < 3; ++a)
+            {
+                lo[a] = b[a] * BrickSize;
+                size[a] = std::min(BrickSize, Dim[a] - lo[a]);
+                from[a] = std::max(lo[a], extent[2 * a]);
+                to[a] = std::min(lo[a] + size[a] - 1, extent[2 * a + 1]);
+            }
+
+            Brick const& brick = Bricks[(static_cast<size_t>(b[2]) * BrickDim[1] + b[1]) * BrickDim[0] + b[0]];
+            T value{};
+            if (brick.Runs.empty())
+                std::memcpy(&value, &brick.Constant, sizeof(T));
+            else
+            {
+                voxels.resize(static_cast<size_t>(size[0]) * size[1] * size[2]);
+                DecodeRuns(brick.Runs, voxels.data());
+            }
+            for (int z = from[2]; z <= to[2]; ++z)
+            {
+                for (int y = from[1]; y <= to[1]; ++y)
+                {
+                    T* row = out + (z - extent[4]) * sliceSize + (y - extent[2]) * rowSize + (from[0] - extent[0]);
+                    if (brick.Runs.empty())
+                        std::fill_n(row, to[0] - from[0] + 1, value);
+                    else
+                    {
+                        T const* src = voxels.data() + (static_cast<size_t>(z - lo[2]) * size[1] + (y - lo[1])) * size[0] + (from[0] - lo[0]);
+                        std::copy(src, src + (to[0] - from[0] + 1), row);
+                    }
+                }
+            }
+        }
+    });
+}
+
+void BrickedVolume::SetBrickLayer(int z0, void const* slab)
+{
+    switch (Scalar) {
+    case RayCastScalar::UnsignedShort: CompressLayer(z0, static_cast<unsigned short const*>(slab)); break;
+    case RayCastScalar::Float: CompressLayer(z0, static_cast<float const*>(slab)); break;
+    default: CompressLayer(z0, static_cast<unsigned char const*>(slab)); break;
+    }
+}
+
+void BrickedVolume::Decompress(int const extent[6], void* out) const
+{
+    switch (Scalar) {
+    case RayCastScalar::UnsignedShort: DecompressExtent(extent, static_cast<unsigned short*>(out)); break;
+    case RayCastScalar::Float: DecompressExtent(extent, static_cast<float*>(out)); break;
+    default: DecompressExtent(extent, static_cast<unsigned char*>(out)); break;
+    }
+}
+
+void BrickedVolume::GetScalarRange(double range[2]) const
+{
+    range[0] = range[1] = 0;
+    for (size_t i = 0; i < Bricks.size(); ++i)
+    {
+        range[0] = i == 0 ? Bricks[i].Min : std::min(range[0], static_cast<double>(Bricks[i].Min));
+        range[1] = i == 0 ? Bricks[i].Max : std::max(range[1], static_cast<double>(Bricks[i].Max));
+    }
+}
+
+void BrickedVolume::GetBrickRange(std::size_t brick, float range[2]) const
+{
+    range[0] = Bricks[brick].Min;
+    range[1] = Bricks[brick].Max;
+}
+
+void BrickedVolume::DecompressBrick(std::size_t brick, void* out) const
+{
+    auto const& b = Bricks[brick];
+    if (!b.Runs.empty())
+    {
+        switch (Scalar) {
+        case RayCastScalar::UnsignedShort: DecodeRuns(b.Runs, static_cast<unsigned short*>(out)); break;
+        case RayCastScalar::Float: DecodeRuns(b.Runs, static_cast<float*>(out)); break;
+        default: DecodeRuns(b.Runs, static_cast<unsigned char*>(out)); break;
+        }
+        return;
+    }
+    std::int64_t i = static_cast<std::int64_t>(brick);
+    std::int64_t voxels = 1;
+    for (int a = 0; a < 3; ++a)
+    {
+        voxels *= std::min(BrickSize, Dim[a] - static_cast<int>(i % BrickDim[a]) * BrickSize);
+        i /= BrickDim[a];
+    }
+    switch (Scalar) {
+    case RayCastScalar::UnsignedShort: {
+        unsigned short value;
+        std::memcpy(&value, &b.Constant, sizeof(value));
+        std::fill_n(static_cast<unsigned short*>(out), voxels, value);
+        break;
+    }
+    case RayCastScalar::Float: {
+        float value;
+        std::memcpy(&value, &b.Constant, sizeof(value));
+        std::fill_n(static_cast<float*>(out), voxels, value);
+        break;
+    }
+    default: {
+        unsigned char value;
+        std::memcpy(&value, &b.Constant, sizeof(value));
+        std::fill_n(static_cast<unsigned char*>(out), voxels, value);
+        break;
+    }
+    }
+}
+
+std::size_t BrickedVolume::GetCompressedSize() const
+{
+    std::size_t size = 0;
+    for (auto const& brick : Bricks)
+        size += sizeof(Brick) + brick.Runs.size();
+    return size;
+}
+
+std::size_t BrickedVolume::GetDecompressedSize() const
+{
+    return static_cast<std::size_t>(Dim[0]) * Dim[1] * Dim[2] * ScalarSize(Scalar);
+}
+
+int BrickedVolume::GetNumberOfConstantBricks() const
+{
+    return static_cast<int>(std::count_if(Bricks.begin(), Bricks.end(), [](Brick const& brick) { return brick.Runs.empty(); }));
+}
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include "image_projection.h"
+#include "parallel_for.h"
+
+#include <vtkNew.h>
+#include <vtkCamera.h>
+#include <vtkMatrix4x4.h>
+
+#include <algorithm>
+#include <limits>
+
+#if defined(IMGUIVTK_X86)
+#include <immintrin.h>
+#endif
+
+namespace {
+    constexpr std::int64_t Grain = 65536;  // points per parallel chunk
+
+    struct Box
+    {
+        float Min[2] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+        float Max[2] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+    };
+
+    void ProjectScalar(ImageProjection const& projection, float const* points, std::int64_t begin, std::int64_t end,
+                       ProjectedPoints& projected, Box& box)
+    {
+        double const* m = projection.ModelToClip;
+        double halfSize[2] = { 0.5 * projection.ImageSize[0], 0.5 * projection.ImageSize[1] };
+        for (std::int64_t i = begin; i < end; ++i)
+        {
+            double p[3] = { points[3 * i], points[3 * i + 1], points[3 * i + 2] };
+            double x = m[0] * p[0] + m[1] * p[1] + m[2] * p[2] + m[3];
+            double y = m[4] * p[0] + m[5] * p[1] + m[6] * p[2] + m[7];
+            double w = m[12] * p[0] + m[13] * p[1] + m[14] * p[2] + m[15];
+            projected.Depth[i] = static_cast<float>(w);
+            if (!(w > 0))
+            {
+                projected.X[i] = projected.Y[i] = 0;
+                continue;
+            }
+            auto px = static_cast<float>((x / w + 1) * halfSize[0]);
+            auto py = static_cast<float>((y / w + 1) * halfSize[1]);
+            projected.X[i] = px;
+            projected.Y[i] = py;
+            box.Min[0] = std::min(box.Min[0], px);
+            box.Min[1] = std::min(box.Min[1], py);
+            box.Max[0] = std::max(box.Max[0], px);
+            box.Max[1] = std::max(box.Max[1], py);
+        }
+    }
+
+#if defined(IMGUIVTK_X86)
+    IMGUIVTK_TARGET("avx2")
+    float HorizontalMin(__m256 v)
+    {
+        __m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+        return _mm_cvtss_f32(m);
+    }
+
+    IMGUIVTK_TARGET("avx2")
+    float HorizontalMax(__m256 v)
+    {
+        __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        return _mm_cvtss_f32(m);
+    }
+
+    // 8 points per step in single precision, gathered from the interleaved xyz, the tail in scalar
+    IMGUIVTK_TARGET("avx2")
+    void ProjectAVX2(ImageProjection const& projection, float const* points, std::int64_t begin, std::int64_t end,
+                     ProjectedPoints& projected, Box& box)
+    {
+        double const* m = projection.ModelToClip;
+        __m256 row[3][4];
+        int const rows[3] = { 0, 1, 3 };  // x, y, w
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                row[r][c] = _mm256_set1_ps(static_cast<float>(m[4 * rows[r] + c]));
+        __m256 halfWidth = _mm256_set1_ps(0.5f * projection.ImageSize[0]);
+        __m256 halfHeight = _mm256_set1_ps(0.5f * projection.ImageSize[1]);
+        __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+        __m256 minX = _mm256_set1_ps(box.Min[0]), minY = _mm256_set1_ps(box.Min[1]);
+        __m256 maxX = _mm256_set1_ps(box.Max[0]), maxY = _mm256_set1_ps(box.Max[1]);
+        __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+        std::int64_t i = begin;
+        for (; i + 8 <= end; i += 8)
+        {
+            float const* base = points + 3 * i;
+            __m256 px = _mm256_i32gather_ps(base, stride, 4);
+            __m256 py = _mm256_i32gather_ps(base + 1, stride, 4);
+            __m256 pz = _mm256_i32gather_ps(base + 2, stride, 4);
+            __m256 clip[3];
+            for (int r = 0; r < 3; ++r)
+                clip[r] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(row[r][0], px), _mm256_mul_ps(row[r][1], py)),
+                                        _mm256_add_ps(_mm256_mul_ps(row[r][2], pz), row[r][3]));
+
+            __m256 front = _mm256_cmp_ps(clip[2], zero, _CMP_GT_OQ);
+            __m256 invW = _mm256_div_ps(one, clip[2]);
+            __m256 x = _mm256_and_ps(front, _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(clip[0], invW), one), halfWidth));
+            __m256 y = _mm256_and_ps(front, _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(clip[1], invW), one), halfHeight));
+            _mm256_storeu_ps(projected.X.data() + i, x);
+            _mm256_storeu_ps(projected.Y.data() + i, y);
+            _mm256_storeu_ps(projected.Depth.data() + i, clip[2]);
+
+            minX = _mm256_blendv_ps(minX, _mm256_min_ps(minX, x), front);
+            minY = _mm256_blendv_ps(minY, _mm256_min_ps(minY, y), front);
+            maxX = _mm256_blendv_ps(maxX, _mm256_max_ps(maxX, x), front);
+            maxY = _mm256_blendv_ps(maxY, _mm256_max_ps(maxY, y), front);
+        }
+        box.Min[0] = HorizontalMin(minX);
+        box.Min[1] = HorizontalMin(minY);
+        box.Max[0] = HorizontalMax(maxX);
+        box.Max[1] = HorizontalMax(maxY);
+        ProjectScalar(projection, points, i, end, projected, box);
+    }
+#endif
+}
+
+ImageProjection GetImageProjection(vtkCamera* camera, vtkMatrix4x4* actorMatrix, int const img_extent[6])
+{
+    ImageProjection projection;
+    projection.ImageSize[0] = img_extent[1] - img_extent[0] + 1;
+    projection.ImageSize[1] = img_extent[3] - img_extent[2] + 1;
+    double aspect = static_cast<double>(projection.ImageSize[0]) / projection.ImageSize[1];
+
+    vtkNew<vtkMatrix4x4> modelToClip;
+    auto worldToClip = camera->GetCompositeProjectionTransformMatrix(aspect, -1, 1);
+    if (actorMatrix != nullptr)
+        vtkMatrix4x4::Multiply4x4(worldToClip, actorMatrix, modelToClip);
+    else
+        modelToClip->DeepCopy(worldToClip);
+    std::copy_n(modelToClip->GetData(), 16, projection.ModelToClip);
+    return projection;
+}
+
+bool ProjectPoint(ImageProjection const& projection, double const point[3], double pixel[2], double* depth)
+{
+    double const* m = projection.ModelToClip;
+    double clip[4];
+    for (int r = 0; r < 4; ++r)
+        clip[r] = m[4 * r] * point[0] + m[4 * r + 1] * point[1] + m[4 * r + 2] * point[2] + m[4 * r + 3];
+    if (depth != nullptr)
+        *depth = clip[3];
+    if (!(clip[3] > 0))
+        return false;
+    pixel[0] = (clip[0] / clip[3] + 1) * 0.5 * projection.ImageSize[0];
+    pixel[1] = (clip[1] / clip[3] + 1) * 0.5 * projection.ImageSize[1];
+    return true;
+}
+
+void GetPrincipalPoint(ImageProjection const& projection, double const point[3], int principal_point[2])
+{
+    double pixel[2];
+    ProjectPoint(projection, point, pixel);
+    principal_point[0] = static_cast<int>(pixel[0] - 0.5 * projection.ImageSize[0]);
+    principal_point[1] = static_cast<int>(pixel[1] - 0.5 * projection.ImageSize[1]);
+}
+
+void ProjectPoints(ImageProjection const& projection, float const* points, std::int64_t count, ProjectedPoints& projected,
+                   SimdLevel level)
+{
+    projected.X.resize(static_cast<size_t>(count));
+    projected.Y.resize(static_cast<size_t>(count));
+    projected.Depth.resize(static_cast<size_t>(count));
+
+    std::vector<Box> boxes(static_cast<size_t>((count + Grain - 1) / Grain));
+    ParallelFor(0, count, Grain, [&](std::int64_t begin, std::int64_t end) {
+        auto& box = boxes[begin / Grain];
+#if defined(IMGUIVTK_X86)
+        if (level >= SimdLevel::AVX2)
+        {
+            ProjectAVX2(projection, points, begin, end, projected, box);
+            return;
+        }
+#endif
+        ProjectScalar(projection, points, begin, end, projected, box);
+    });
+
+    Box total;
+    for (auto const& box : boxes)
+        for (int a = 0; a < 2; ++a)
+        {
+            total.Min[a] = std::min(total.Min[a], box.Min[a]);
+            total.Max[a] = std::max(total.Max[a], box.Max[a]);
+        }
+    projected.Box[0] = total.Min[0];
+    projected.Box[1] = total.Min[1];
+    projected.Box[2] = total.Max[0];
+    projected.Box[3] = total.Max[1];
+}
\ No newline at end of file
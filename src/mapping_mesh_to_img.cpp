@@ -19,6 +19,7 @@
 
 #include <cstdio>
 #include <filesystem>
+#include <memory>
 
 #include "ImGuiVTK.h"
 #include "imfilebrowser.h"
@@ -26,14 +27,24 @@
 #include "loadimg.h"
 
 #include "mapping_mesh_to_img.h"
+#include "mapping_mesh_batch.h"
 #include "metric.h"
+#include "background_job.h"
+#include "pose_refine.h"
+#include "pose_history.h"
+#include "mesh_gallery.h"
+#include "image_pyramid.h"
 
 GLFWwindow* create_glfw_window(char const* window_name = "Annotation Tool", int window_width = 1920, int window_height = 1080);
 
-void handle_key_press(vtkCamera* camera, vtkActor* model_actor, double* elevation, double* azimuth, float model_move_resolution);
+void handle_key_press(vtkCamera* camera, vtkActor* model_actor, double* elevation, double* azimuth, float model_move_resolution, PoseHistory& history);
 
 int main(int argc, char* argv[])
 {
+    // headless: render a manifest offscreen without any window
+    if (argc > 1 && std::string(argv[1]) == "--batch")
+        return RunBatch(argc, argv);
+
 #pragma region SetUp
     // Disable vtk output window
     //vtkObject::GlobalWarningDisplayOff();
@@ -71,6 +82,12 @@ int main(int argc, char* argv[])
     ImGui::FileBrowser meshFileDialog;
     meshFileDialog.SetTitle("MeshFileSelection");
     meshFileDialog.SetTypeFilters({ ".stl", ".obj" });
+    ImGui::FileBrowser meshDirDialog(ImGuiFileBrowserFlags_SelectDirectory);
+    meshDirDialog.SetTitle("MeshDirectorySelection");
+
+    // thumbnails of every mesh in a directory, clicking one loads it like the mesh file browser
+    MeshGallery mesh_gallery;
+    ThumbnailTextures gallery_textures;
 
     // Our state
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
@@ -79,7 +96,9 @@ int main(int argc, char* argv[])
     std::string MeshFileName{}, ImgFileName{};
     vtkSmartPointer<vtkPolyData> PolyData = nullptr;
     vtkSmartPointer<vtkImageData> ImgData = nullptr;
+    vtkSmartPointer<vtkImageData> BackgroundData = nullptr;  // shown by the background actor and the locked layers
     SceneAndBackground SceneAndImg{};
+    SceneModels Models{};  // every model of the image, SceneAndImg.SceneActor is the selected one
     bool MeshChanged = false;
 
     float inplane_rot_angle = 0, current_roll = 0;
@@ -91,12 +110,84 @@ int main(int argc, char* argv[])
     ImVec4 model_color = ImVec4(0.00f, 0.00f, 1.00f, 1.00f);
     bool truncated = false, occluded = false;
 
-    std::set<std::string> LockedMeshes;
     std::string OutputFilename{};
     std::string ModelCategory{};
     Metrics CurrentMetrics;
-
-    double original_scene_actor_center[3]{0, 0, 0}, final_scene_actor_center[3]{0, 0, 0};
+    std::vector<MeshRaster> CurrentMasks;  // silhouette and depth at the image resolution, one per metric
+
+    double final_scene_actor_center[3]{0, 0, 0};
+
+    // images too large for one texture are never read whole: ImgData then only has their size, BackgroundData is the
+    // base level of the tiles and the finer tiles stream in as the background zooms in
+    TiledBackground tiled_background;
+    bool tiled_image = false;
+    float background_zoom = 1;
+    float background_center[2]{ 0, 0 };
+
+    // automatic pose refinement, its poses are relative to the camera and model position it started from
+    BackgroundJob<PoseDelta> refine_job;
+    std::shared_ptr<PoseRefineProgress> refine_progress;
+    vtkNew<vtkCamera> refine_start_camera;
+    double refine_start_position[3]{ 0, 0, 0 };
+    double refine_score = 0;
+    int refine_iteration = 0;
+    auto apply_refined_pose = [&](PoseDelta const& delta) {
+        auto camera = SceneAndImg.SceneRenderer->GetActiveCamera();
+        camera->DeepCopy(refine_start_camera);
+        double offset[3];
+        ApplyPoseDelta(camera, delta, offset);
+        SceneAndImg.SceneActor->SetPosition(refine_start_position[0] + offset[0],
+                                            refine_start_position[1] + offset[1],
+                                            refine_start_position[2] + offset[2]);
+        SceneAndImg.SceneRenderer->ResetCameraClippingRange();
+    };
+
+    // poses of the selected model before its recent edits
+    PoseHistory pose_history;
+
+    // silhouette templates of the mesh, loaded or built in the background on every mesh load
+    BackgroundJob<std::shared_ptr<SilhouetteTemplates const>> template_job;
+    std::shared_ptr<SilhouetteTemplates const> silhouette_templates;
+    std::shared_ptr<RasterMeshData const> template_mesh;
+    std::vector<SilhouetteMatch> view_matches;
+    float view_match_box[4]{ 0, 0, 0, 0 };  // image box the model covered when the views were matched
+    auto load_templates = [&]() {
+        silhouette_templates.reset();
+        view_matches.clear();
+        template_mesh = std::make_shared<RasterMeshData const>(GetRasterMeshData(PolyData));
+        template_job.Start([mesh = template_mesh, path = MeshFileName](BackgroundJob<std::shared_ptr<SilhouetteTemplates const>>::CancelFlag const& cancel) {
+            return LoadSilhouetteTemplates(*mesh, path, cancel);
+        });
+    };
+
+    // the sliders move the selected model relative to where they were last, start them over for another model
+    auto reset_pose_sliders = [&]() {
+        inplane_rot_angle = 0;
+        current_roll = SceneAndImg.SceneRenderer->GetActiveCamera()->GetRoll();
+        elevation = azimuth = 0;
+        current_elevation = current_azimuth = 0;
+        zoom = last_zoom = 1;
+    };
+    // after the selection changed: the parked models were rendered offscreen, the model view shows the selected mesh
+    auto model_selected = [&]() {
+        glfwMakeContextCurrent(window);
+        reset_pose_sliders();
+        pose_history.Clear();
+        auto const& model = Models.Models[Models.Selected];
+        if (GetModelMesh(model) != PolyData.Get())
+        {
+            PolyData = GetModelMesh(model);
+            MeshFileName = model.MeshFileName;
+            SetupModelRender(instance.Renderer, PolyData);
+            load_templates();
+        }
+    };
+    auto select_model = [&](int index) {
+        refine_job.Cancel();
+        refine_progress.reset();
+        SelectSceneModel(SceneAndImg, Models, index, BackgroundData);
+        model_selected();
+    };
 #pragma endregion GlobalStates
 
     // Main loop
@@ -119,17 +210,86 @@ int main(int argc, char* argv[])
         ImGui::Text(MeshFileName.c_str());
         ImGui::End();
         meshFileDialog.Display();
+        std::string selected_mesh{};
         if (meshFileDialog.HasSelected())
+        {
+            selected_mesh = meshFileDialog.GetSelected().string();
+            meshFileDialog.ClearSelected();
+        }
+
+        if (ImGui::Begin("MeshGallery"))
+        {
+            if (ImGui::Button("Open Mesh Directory"))
+                meshDirDialog.Open();
+            if (mesh_gallery.GetCount() > 0)
+            {
+                ImGui::SameLine();
+                ImGui::Text("%s: %d / %d", mesh_gallery.GetDirectory().c_str(), mesh_gallery.GetFinishedCount(), mesh_gallery.GetCount());
+            }
+
+            // only the rows on screen are laid out, their thumbnails get textures and the workers go there first
+            gallery_textures.BeginFrame();
+            auto const& style = ImGui::GetStyle();
+            float thumbnail = static_cast<float>(MeshGallery::ThumbnailSize);
+            float cell = thumbnail + 2 * style.FramePadding.x + style.ItemSpacing.x;
+            int columns = std::max(1, static_cast<int>((ImGui::GetContentRegionAvail().x + style.ItemSpacing.x) / cell));
+            int rows = (mesh_gallery.GetCount() + columns - 1) / columns;
+            ImGuiListClipper clipper;
+            clipper.Begin(rows, thumbnail + 2 * style.FramePadding.y + style.ItemSpacing.y + ImGui::GetTextLineHeightWithSpacing());
+            bool first_step = true;
+            while (clipper.Step())
+            {
+                if (first_step)
+                    mesh_gallery.SetVisibleStart(clipper.DisplayStart * columns);
+                first_step = false;
+                for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row)
+                    for (int index = row * columns; index < std::min((row + 1) * columns, mesh_gallery.GetCount()); ++index)
+                    {
+                        if (index > row * columns)
+                            ImGui::SameLine();
+                        ImGui::PushID(index);
+                        ImGui::BeginGroup();
+                        GLuint texture = 0;
+                        if (mesh_gallery.GetState(index) == MeshGallery::ThumbnailState::Ready)
+                            texture = gallery_textures.Get(index, mesh_gallery.GetThumbnail(index), MeshGallery::ThumbnailSize);
+                        bool clicked = false;
+                        if (texture != 0)  // row 0 of the thumbnail is at the bottom
+                            clicked = ImGui::ImageButton((ImTextureID)(intptr_t)texture, ImVec2(thumbnail, thumbnail), ImVec2(0, 1), ImVec2(1, 0));
+                        else
+                            clicked = ImGui::Button(mesh_gallery.GetState(index) == MeshGallery::ThumbnailState::Failed ? "failed" : "...",
+                                                    ImVec2(thumbnail + 2 * style.FramePadding.x, thumbnail + 2 * style.FramePadding.y));
+                        if (clicked)
+                            selected_mesh = mesh_gallery.GetPath(index);
+                        if (ImGui::IsItemHovered())
+                            ImGui::SetTooltip("%s", mesh_gallery.GetPath(index).c_str());
+                        ImGui::PushTextWrapPos(ImGui::GetCursorPosX() + thumbnail + 2 * style.FramePadding.x);
+                        ImGui::TextUnformatted(mesh_gallery.GetName(index).c_str());
+                        ImGui::PopTextWrapPos();
+                        ImGui::EndGroup();
+                        ImGui::PopID();
+                    }
+            }
+        }
+        ImGui::End();
+        meshDirDialog.Display();
+        if (meshDirDialog.HasSelected())
+        {
+            gallery_textures.Clear();
+            mesh_gallery.Open(meshDirDialog.GetSelected().string());
+            meshDirDialog.ClearSelected();
+        }
+
+        if (!selected_mesh.empty())
         {
             // setup
             if (MeshFileName.empty())
             {
-                MeshFileName = meshFileDialog.GetSelected().string();
+                MeshFileName = selected_mesh;
                 MeshChanged = true;
             }
             else  // change the mesh
             {
-                auto tmp = meshFileDialog.GetSelected().string();
+                auto tmp = selected_mesh;
                 if (MeshFileName != tmp)
                 {
                     MeshFileName = tmp;
@@ -140,17 +300,16 @@ int main(int argc, char* argv[])
             }
             if (MeshChanged)
             {
+                refine_job.Cancel();
+                refine_progress.reset();
                 PolyData = ReadPolyData(MeshFileName.c_str());
                 SetupModelRender(instance.Renderer, PolyData);
-                // replace scene mesh only if the scene has been setup
+                load_templates();
+                // replace the mesh of the selected model only if the scene has been setup
                 if (SceneAndImg.SceneActor != nullptr)
-                {
-                    ChangeTheModel(SceneAndImg, PolyData);
-                    std::memcpy(&original_scene_actor_center, SceneAndImg.SceneActor->GetCenter(), 3 * sizeof(double));
-                }
+                    ChangeSceneModelMesh(Models, PolyData, MeshFileName);
             }
             // TODO: setup two renderers on ImGuiVTK instance.init() and make change mesh / image easier (one props for one)
-            meshFileDialog.ClearSelected();
         }
         if (ImGui::Begin("ImgFileBrowser"))
         {
@@ -163,24 +322,39 @@ int main(int argc, char* argv[])
         if (imgFileDialog.HasSelected())
         {
             ImgFileName = imgFileDialog.GetSelected().string();
-            ImgData = ReadImageData(ImgFileName.c_str());
+            int image_size[2]{ 0, 0 };
+            tiled_background.Close();
+            tiled_image = ReadImageSize(ImgFileName.c_str(), image_size) &&
+                          std::max(image_size[0], image_size[1]) > TiledBackgroundMinSize && tiled_background.Open(ImgFileName);
+            ImgData = tiled_image ? tiled_background.GetGeometry() : ReadImageData(ImgFileName.c_str());
+            BackgroundData = tiled_image ? tiled_background.GetBase() : ImgData.Get();
+            refine_job.Cancel();
+            refine_progress.reset();
             // setup
             if (SceneAndImg.BackgroundActor == nullptr)
-                SceneAndImg = SetupSceneAndBackgroundRenders(instance.RenderWindow, ImgData, PolyData);
+                SceneAndImg = SetupSceneAndBackgroundRenders(instance.RenderWindow, BackgroundData, PolyData);
             else // replace the background image
             {
-                ChangeTheBackgroundImage(SceneAndImg, ImgData);
+                ChangeTheBackgroundImage(SceneAndImg, BackgroundData);
             }
+            // the base covers whole pixels like the tiles over it; fit the full resolution, the base may be a bit larger
+            SceneAndImg.BackgroundActor->GetMapper()->SetBorder(tiled_image);
+            background_zoom = 1;
+            background_center[0] = 0.5f * ImgData->GetExtent()[1];
+            background_center[1] = 0.5f * ImgData->GetExtent()[3];
+            double image_center[2] = { background_center[0], background_center[1] };
+            SetBackgroundZoom(SceneAndImg, ImgData, background_zoom, image_center);
+            ResetSceneModels(SceneAndImg, Models, MeshFileName, BackgroundData);
             // first let the scene camera follows the model camera
             SceneAndImg.SceneRenderer->SetActiveCamera(instance.Renderer->GetActiveCamera());
             imgFileDialog.ClearSelected();
 
-            std::memcpy(&original_scene_actor_center, SceneAndImg.SceneActor->GetCenter(), 3 * sizeof(double));
             auto path = std::filesystem::path(ImgFileName);
             CurrentMetrics.image_name = path.stem().string();
             CurrentMetrics.image_path = ImgFileName;
             CurrentMetrics.metrics.clear();
-            LockedMeshes.clear();
+            CurrentMasks.clear();
+            pose_history.Clear();
             OutputFilename = path.replace_extension(".txt").string();
         }
 #pragma endregion FileBrowser
@@ -210,6 +384,34 @@ int main(int argc, char* argv[])
                 ImGui::Dummy(ImVec2(0.0f, 20.0f));
 #pragma endregion LockReleaseOverlay
 
+#pragma region UndoRedo
+                // the pose before any edit of this frame, recorded when an edit starts
+                auto scene_camera = SceneAndImg.SceneRenderer->GetActiveCamera();
+                auto pose_before = CapturePose(scene_camera, SceneAndImg.SceneActor);
+                auto restore_pose = [&](bool undo) {
+                    PoseSnapshot pose;
+                    if (!(undo ? pose_history.Undo(pose_before, pose) : pose_history.Redo(pose_before, pose)))
+                        return;
+                    refine_job.Cancel();
+                    refine_progress.reset();
+                    RestorePose(pose, scene_camera, SceneAndImg.SceneActor);
+                    SceneAndImg.SceneRenderer->ResetCameraClippingRange();
+                    reset_pose_sliders();
+                };
+                bool text_input = ImGui::GetIO().WantTextInput;
+                ImGui::BeginDisabled(!pose_history.CanUndo());
+                if (ImGui::Button("Undo") || (!text_input && ImGui::GetIO().KeyCtrl && ImGui::IsKeyPressed(90)))  // Ctrl + z
+                    restore_pose(true);
+                ImGui::EndDisabled();
+                ImGui::SameLine();
+                ImGui::BeginDisabled(!pose_history.CanRedo());
+                if (ImGui::Button("Redo") || (!text_input && ImGui::GetIO().KeyCtrl && ImGui::IsKeyPressed(89)))  // Ctrl + y
+                    restore_pose(false);
+                ImGui::EndDisabled();
+
+                ImGui::Dummy(ImVec2(0.0f, 20.0f));
+#pragma endregion UndoRedo
+
 #pragma region ModelAppearance
 
                 // scene model opacity
@@ -231,6 +433,41 @@ int main(int argc, char* argv[])
                 ImGui::Dummy(ImVec2(0.0f, 20.0f));
 #pragma endregion ModelAppearance
 
+#pragma region BackgroundView
+                // look closer at the image, the live model is hidden while zoomed in
+                int const* image_extent = ImgData->GetExtent();
+                float image_height = static_cast<float>(image_extent[3] + 1);
+                bool view_changed = ImGui::SliderFloat("Background Zoom", &background_zoom, 1.0f, 256.0f, "%.1fx", ImGuiSliderFlags_Logarithmic);
+                view_changed |= ImGui::DragFloat2("Background Center", background_center, image_height / (200 * background_zoom), 0.0f,
+                                                  static_cast<float>(std::max(image_extent[1], image_extent[3])), "%.0f px");
+                if (ImGui::Button("Fit Background"))
+                {
+                    background_zoom = 1;
+                    background_center[0] = 0.5f * image_extent[1];
+                    background_center[1] = 0.5f * image_extent[3];
+                    view_changed = true;
+                }
+                if (view_changed)
+                {
+                    double center[2] = { background_center[0], background_center[1] };
+                    SetBackgroundZoom(SceneAndImg, ImgData, background_zoom, center);
+                }
+                if (tiled_image)
+                {
+                    ImGui::Text("tiled image: level %d shown, the base is level %d", tiled_background.GetShownLevel(), tiled_background.GetBaseLevel());
+                    ImGui::TextWrapped("Match View, Refine Pose and the masks need the whole image in memory, they are off for tiled images.");
+                    if (tiled_background.IsCachedFormat())
+                        ImGui::TextWrapped("PNG and JPEG decode only whole: opening needs memory for the full image once (4 bytes a pixel), "
+                                           "its tiles then go to an uncompressed disk cache in the temp directory and it is released.");
+                    if (tiled_background.IsCaching())
+                        ImGui::Text("writing the tile cache, the finer levels show when it is done");
+                    else if (tiled_background.HasCacheFailed())
+                        ImGui::TextWrapped("the tile cache could not be written, only the base level is shown");
+                }
+
+                ImGui::Dummy(ImVec2(0.0f, 20.0f));
+#pragma endregion BackgroundView
+
 #pragma region ModelRotation
                 // in-plane rotation
                 if (ImGui::SliderFloat("In-Plane Rotation Angle", &inplane_rot_angle, -180.0f, 180.0f, "%.1f degrees"))
@@ -238,6 +475,7 @@ int main(int argc, char* argv[])
                     auto current_cam = SceneAndImg.SceneRenderer->GetActiveCamera();
                     current_cam->SetRoll(current_roll + inplane_rot_angle);
                 }
+                if (ImGui::IsItemActivated()) pose_history.Record(pose_before);  // one entry per drag
 
                 ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
@@ -248,6 +486,7 @@ int main(int argc, char* argv[])
                     current_cam->Zoom(zoom / last_zoom);
                     last_zoom = zoom;
                 }
+                if (ImGui::IsItemActivated()) pose_history.Record(pose_before);  // one entry per drag
 
                 ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
@@ -265,6 +504,7 @@ int main(int argc, char* argv[])
                     // double* p = current_cam->GetViewUp();
                     // printf("%f, %f, %f\n", p[0], p[1], p[2]);
                 }
+                if (ImGui::IsItemActivated()) pose_history.Record(pose_before);  // one entry per drag
 
                 ImGui::Dummy(ImVec2(0.0f, 20.0f));
 
@@ -275,6 +515,7 @@ int main(int argc, char* argv[])
                     current_cam->Azimuth(azimuth - current_azimuth);
                     current_azimuth = azimuth;
                 }
+                if (ImGui::IsItemActivated()) pose_history.Record(pose_before);  // one entry per drag
 
                 ImGui::Dummy(ImVec2(0.0f, 20.0f));
 #pragma endregion ModelRotation
@@ -289,10 +530,12 @@ int main(int argc, char* argv[])
                     SceneAndImg.SceneActor->AddPosition(0, model_move_resolution, 0);
                 }
                 ImGui::Unindent(upDownIndent);
+                if (ImGui::IsItemActivated()) pose_history.Record(pose_before);  // one entry per hold
                 if (ImGui::IsItemActive()) SceneAndImg.SceneActor->AddPosition(0, model_move_resolution, 0);  // hold button
                 if (ImGui::Button("Model Left", ImVec2(120, 30))) {
                     SceneAndImg.SceneActor->AddPosition(-model_move_resolution, 0, 0);
                 }
+                if (ImGui::IsItemActivated()) pose_history.Record(pose_before);  // one entry per hold
                 if (ImGui::IsItemActive()) SceneAndImg.SceneActor->AddPosition(-model_move_resolution, 0, 0);  // hold button
                 ImGui::SameLine();
                 ImGui::Indent(upDownIndent);
@@ -300,6 +543,7 @@ int main(int argc, char* argv[])
                     SceneAndImg.SceneActor->AddPosition(0, -model_move_resolution, 0);
                 }
                 ImGui::Unindent(upDownIndent);
+                if (ImGui::IsItemActivated()) pose_history.Record(pose_before);  // one entry per hold
                 if (ImGui::IsItemActive()) SceneAndImg.SceneActor->AddPosition(0, -model_move_resolution, 0);  // hold button
                 ImGui::SameLine();
                 ImGui::Indent(rightIndent);
@@ -307,11 +551,93 @@ int main(int argc, char* argv[])
                     SceneAndImg.SceneActor->AddPosition(model_move_resolution, 0, 0);
                 }
                 ImGui::Unindent(rightIndent);
+                if (ImGui::IsItemActivated()) pose_history.Record(pose_before);  // one entry per hold
                 if (ImGui::IsItemActive()) SceneAndImg.SceneActor->AddPosition(model_move_resolution, 0, 0);  // hold button
 
                 ImGui::Dummy(ImVec2(0.0f, 20.0f));
 #pragma endregion ModelMotion
 
+#pragma region MatchView
+                // views of the templates whose silhouettes best fit the image where the model is now
+                template_job.Poll(silhouette_templates);
+                if (template_job.IsRunning())
+                    ImGui::Text("Building silhouette templates...");
+                else if (silhouette_templates && !tiled_image && ImGui::Button("Match View"))
+                {
+                    SceneAndImg.SceneRenderer->ResetCameraClippingRange();
+                    view_matches.clear();
+                    if (GetModelImageBox(*template_mesh, SceneAndImg.SceneRenderer->GetActiveCamera(),
+                                         SceneAndImg.SceneActor->GetMatrix(), ImgData->GetExtent(), view_match_box))
+                        view_matches = FindBestViews(*silhouette_templates, MakeImageSilhouetteQuery(ImgData, view_match_box), 5);
+                    if (!view_matches.empty())
+                    {
+                        pose_history.Record(pose_before);
+                        refine_job.Cancel();
+                        refine_progress.reset();
+                        ApplyTemplateView(view_matches.front(), *template_mesh, view_match_box, SceneAndImg.SceneRenderer->GetActiveCamera(),
+                                          SceneAndImg.SceneActor, ImgData->GetExtent());
+                        SceneAndImg.SceneRenderer->ResetCameraClippingRange();
+                    }
+                }
+                for (auto const& match : view_matches)
+                {
+                    auto label = "azimuth " + std::to_string(static_cast<int>(match.Azimuth)) + ", elevation " +
+                                 std::to_string(static_cast<int>(match.Elevation)) + ", fit " +
+                                 std::to_string(static_cast<int>(100 * match.Score)) + "%";
+                    if (ImGui::Selectable(label.c_str(), false))
+                    {
+                        pose_history.Record(pose_before);
+                        refine_job.Cancel();
+                        refine_progress.reset();
+                        ApplyTemplateView(match, *template_mesh, view_match_box, SceneAndImg.SceneRenderer->GetActiveCamera(),
+                                          SceneAndImg.SceneActor, ImgData->GetExtent());
+                        SceneAndImg.SceneRenderer->ResetCameraClippingRange();
+                    }
+                }
+
+                ImGui::Dummy(ImVec2(0.0f, 20.0f));
+#pragma endregion MatchView
+
+#pragma region RefinePose
+                // fit the model silhouette to the image edges, the best pose so far is shown live
+                PoseDelta refined_pose;
+                if (refine_progress && refine_progress->Take(refined_pose, refine_score, refine_iteration))
+                    apply_refined_pose(refined_pose);
+                if (refine_job.Poll(refined_pose))
+                    apply_refined_pose(refined_pose);
+
+                ImGui::PushStyleColor(ImGuiCol_Button, ImVec4{ 0.2f, 0.6f, 0.4f, 1.0f });
+                if (!refine_job.IsRunning())
+                {
+                    if (!tiled_image && ImGui::Button("Refine Pose"))
+                    {
+                        pose_history.Record(pose_before);
+                        SceneAndImg.SceneRenderer->ResetCameraClippingRange();
+                        refine_start_camera->DeepCopy(SceneAndImg.SceneRenderer->GetActiveCamera());
+                        SceneAndImg.SceneActor->GetPosition(refine_start_position);
+                        auto problem = std::make_shared<PoseRefineProblem const>(ImgData, PolyData, refine_start_camera,
+                                                                                 SceneAndImg.SceneActor->GetMatrix());
+                        refine_progress = std::make_shared<PoseRefineProgress>();
+                        refine_job.Start([problem, progress = refine_progress](BackgroundJob<PoseDelta>::CancelFlag const& cancel) {
+                            return RefinePose(*problem, *progress, cancel);
+                        });
+                    }
+                }
+                else if (ImGui::Button("Stop Refining"))
+                {
+                    refine_job.Cancel();  // keeps the best pose shown so far
+                    refine_progress.reset();
+                }
+                ImGui::PopStyleColor(1);
+                if (refine_progress)
+                {
+                    ImGui::SameLine();
+                    ImGui::Text("edge distance %.2f px, iteration %d", refine_score, refine_iteration);
+                }
+
+                ImGui::Dummy(ImVec2(0.0f, 20.0f));
+#pragma endregion RefinePose
+
 #pragma region ModelMetrics
                 // label truncated / occluded
                 ImGui::Checkbox("Truncated", &truncated);
@@ -327,27 +653,36 @@ int main(int argc, char* argv[])
                 ImGui::PushStyleColor(ImGuiCol_Button, ImVec4{ 1.0f, 0.3f, 0.4f, 1.0f });
                 if (ImGui::Button("Save Current Model Metrics"))
                 {
-                    // TODO: better way to combine the current background image data with the scene mesh model projection
-                    // maybe project the bounding box or silhouette?
-                    ChangeTheBackgroundImage(SceneAndImg, GetScreenShotImageData(SceneAndImg));
-
+                    // saving again updates the metric of the model, it stays editable
+                    auto& model = Models.Models[Models.Selected];
                     std::memcpy(&final_scene_actor_center, SceneAndImg.SceneActor->GetCenter(), 3 * sizeof(double));
-                    double scene_movement[3] = { final_scene_actor_center[0] - original_scene_actor_center[0], 
-                                                 final_scene_actor_center[1] - original_scene_actor_center[1], 
-                                                 final_scene_actor_center[2] - original_scene_actor_center[2] };
+                    double scene_movement[3] = { final_scene_actor_center[0] - model.OriginalCenter[0], 
+                                                 final_scene_actor_center[1] - model.OriginalCenter[1], 
+                                                 final_scene_actor_center[2] - model.OriginalCenter[2] };
                     auto cam = SceneAndImg.SceneRenderer->GetActiveCamera();
                     auto camera_parameters = GetCameraParameters(SceneAndImg.SceneRenderer, scene_movement, ImgData->GetExtent());
                     auto model_name = std::filesystem::path(MeshFileName).stem().string();
 
-                    CurrentMetrics.metrics.push_back(Metric{
+                    Metric metric{
                         model_name,
                         ModelCategory,
                         truncated,
                         occluded,
                         camera_parameters,
                         MeshFileName
-                    });
-                    LockedMeshes.insert(model_name);
+                    };
+                    if (model.MetricIndex < 0)
+                    {
+                        model.MetricIndex = static_cast<int>(CurrentMetrics.metrics.size());
+                        CurrentMetrics.metrics.push_back(metric);
+                        CurrentMasks.emplace_back();
+                    }
+                    else
+                        CurrentMetrics.metrics[model.MetricIndex] = metric;
+
+                    SceneAndImg.SceneRenderer->ResetCameraClippingRange();
+                    if (!tiled_image)  // a mask of a tiled image would not fit in memory, it stays empty
+                        RasterizeModel(PolyData, cam, SceneAndImg.SceneActor->GetMatrix(), ImgData->GetDimensions(), CurrentMasks[model.MetricIndex]);
 
                     // // debug (to verify the correctness of rotaion angles)
                     // // FIXME: is this debug way correct? is the camera parameters calculation way correct?
@@ -360,11 +695,36 @@ int main(int argc, char* argv[])
                 }
                 ImGui::PopStyleColor(1);
 
-                if (ImGui::BeginListBox("Saved Models"))
+                // models of the image, the selected one is edited and the others wait in the parked layer
+                if (ImGui::Button("Add Model") && PolyData != nullptr)
+                    select_model(AddSceneModel(SceneAndImg, Models, PolyData, MeshFileName));
+                ImGui::SameLine();
+                if (ImGui::Button("Remove Model") && Models.Models.size() > 1)
+                {
+                    // its metric and mask go with it
+                    int removed = Models.Selected, metric_index = Models.Models[removed].MetricIndex;
+                    if (metric_index >= 0)
+                    {
+                        CurrentMetrics.metrics.erase(CurrentMetrics.metrics.begin() + metric_index);
+                        CurrentMasks.erase(CurrentMasks.begin() + metric_index);
+                        for (auto& model : Models.Models)
+                            if (model.MetricIndex > metric_index)
+                                --model.MetricIndex;
+                    }
+                    refine_job.Cancel();
+                    refine_progress.reset();
+                    RemoveSceneModel(SceneAndImg, Models, removed, BackgroundData);
+                    model_selected();
+                }
+                if (ImGui::BeginListBox("Models"))
                 {
-                    for (auto const& m : LockedMeshes)
+                    for (int i = 0; i < static_cast<int>(Models.Models.size()); ++i)
                     {
-                        ImGui::Selectable(m.c_str(), false);
+                        auto const& model = Models.Models[i];
+                        auto label = std::to_string(i) + ": " + std::filesystem::path(model.MeshFileName).stem().string() +
+                                     (model.MetricIndex >= 0 ? " (saved)" : "");
+                        if (ImGui::Selectable(label.c_str(), i == Models.Selected) && i != Models.Selected)
+                            select_model(i);
                     }
                     ImGui::EndListBox();
                 }
@@ -377,6 +737,11 @@ int main(int argc, char* argv[])
                 if (ImGui::Button("Write Metrics To File"))
                 {
                     WriteMetricsToFile(OutputFilename, CurrentMetrics);
+                    // <output>_<index>_<model>_mask.png / _depth.tif next to it
+                    auto stem = std::filesystem::path(OutputFilename).replace_extension().string();
+                    for (size_t i = 0; i < CurrentMasks.size(); ++i)
+                        if (!CurrentMasks[i].Mask.empty())
+                            WriteMeshRaster(CurrentMasks[i], stem + "_" + std::to_string(i) + "_" + CurrentMetrics.metrics[i].model_name);
                 }
                 ImGui::PopStyleColor(1);
 #pragma endregion ModelMetrics
@@ -386,12 +751,14 @@ int main(int argc, char* argv[])
 #pragma endregion Overlay
 
         // Rendering
+        if (tiled_image)
+            tiled_background.Update(SceneAndImg.BackgroundRenderer);
         instance.Render();
         ImGui::Render();
 
         // Handle key press events
         if (SceneAndImg.SceneRenderer != nullptr && SceneAndImg.SceneActor != nullptr)
-            handle_key_press(SceneAndImg.SceneRenderer->GetActiveCamera(), SceneAndImg.SceneActor, &current_elevation, &current_azimuth, model_move_resolution);
+            handle_key_press(SceneAndImg.SceneRenderer->GetActiveCamera(), SceneAndImg.SceneActor, &current_elevation, &current_azimuth, model_move_resolution, pose_history);
 
         int display_w, display_h;
         glfwGetFramebufferSize(window, &display_w, &display_h);
@@ -406,6 +773,9 @@ int main(int argc, char* argv[])
     }
 
     // Cleanup
+    mesh_gallery.Close();
+    gallery_textures.Clear();  // while the GL context is alive
+    tiled_background.Close();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     instance.ShutDown();
@@ -447,7 +817,7 @@ GLFWwindow* create_glfw_window(char const* window_name, int window_width, int wi
     return window;
 }
 
-void handle_key_press(vtkCamera* camera, vtkActor* model_actor, double* elevation, double* azimuth, float model_move_resolution)
+void handle_key_press(vtkCamera* camera, vtkActor* model_actor, double* elevation, double* azimuth, float model_move_resolution, PoseHistory& history)
 {
     //for (int i = 0; i < IM_ARRAYSIZE(io.KeysDown); i++) if (ImGui::IsKeyPressed(i)) { std::cout << i << '\n'; }
     // GLFW keys layout: https://www.glfw.org/docs/3.3/group__keys.html
@@ -456,6 +826,8 @@ void handle_key_press(vtkCamera* camera, vtkActor* model_actor, double* elevatio
     {
         if (ImGui::IsKeyPressed(key))
         {
+            if (ImGui::IsKeyPressed(key, false))  // a held key is one edit, not one per repeat
+                history.Record(CapturePose(camera, model_actor));
             if (key == 265)  // Up
             {
                 camera->Elevation(1);
@@ -0,0 +1,228 @@
+#include "mesh_raster.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+
+namespace {
+    constexpr int TileSize = 64;                // pixels per image tile side
+    constexpr std::int64_t ChunkSize = 16384;   // triangles set up and binned together
+
+    struct ClipVertex
+    {
+        float X, Y, Z, W;
+    };
+
+    // Counter-clockwise screen triangle in pixel coordinates. Edge i, e(x, y) = A x + B y + C, is zero on the edge
+    // opposite corner i and positive inside; 1 / w is interpolated linearly in screen space
+    struct ScreenTriangle
+    {
+        double A[3], B[3], C[3];
+        double InvW[3];  // 1 / w of the corners divided by twice the area, so sum e_i InvW_i is 1 / w
+        int Box[4];      // inclusive pixel bounds x0, y0, x1, y1 within the image
+    };
+
+    // triangles of one chunk and their tile bins, Items[Offsets[t], Offsets[t + 1]) index the triangles of tile t
+    struct Chunk
+    {
+        std::vector<ScreenTriangle> Triangles;
+        std::vector<std::uint32_t> Offsets, Items;
+    };
+
+    ClipVertex Lerp(ClipVertex const& a, ClipVertex const& b, float t)
+    {
+        return { a.X + t * (b.X - a.X), a.Y + t * (b.Y - a.Y), a.Z + t * (b.Z - a.Z), a.W + t * (b.W - a.W) };
+    }
+
+    // the part of a triangle in front of the near plane z = -w, 0, 3 or 4 corners
+    int ClipNear(ClipVertex const (&in)[3], ClipVertex (&out)[4])
+    {
+        int n = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            auto const& a = in[i];
+            auto const& b = in[(i + 1) % 3];
+            float da = a.Z + a.W, db = b.Z + b.W;
+            if (da >= 0)
+                out[n++] = a;
+            if ((da >= 0) != (db >= 0))
+                out[n++] = Lerp(a, b, da / (da - db));
+        }
+        return n;
+    }
+
+    // false for triangles without area or without a pixel center inside the image
+    bool SetupTriangle(ClipVertex const& v0, ClipVertex const& v1, ClipVertex const& v2, int const size[2], ScreenTriangle& t)
+    {
+        ClipVertex const* v[3] = { &v0, &v1, &v2 };
+        double x[3], y[3], invW[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            if (!(v[i]->W > 0))
+                return false;
+            invW[i] = 1.0 / v[i]->W;
+            x[i] = (v[i]->X * invW[i] * 0.5 + 0.5) * size[0];
+            y[i] = (v[i]->Y * invW[i] * 0.5 + 0.5) * size[1];
+        }
+
+        double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (area == 0 || !std::isfinite(area))
+            return false;
+        if (area < 0)  // no culling, make it counter-clockwise
+        {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(invW[1], invW[2]);
+            area = -area;
+        }
+
+        // pixel centers (i + 0.5, j + 0.5) within the bounding box
+        double minX = std::min({ x[0], x[1], x[2] }), maxX = std::max({ x[0], x[1], x[2] });
+        double minY = std::min({ y[0], y[1], y[2] }), maxY = std::max({ y[0], y[1], y[2] });
+        if (maxX < 0.5 || maxY < 0.5 || minX > size[0] - 0.5 || minY > size[1] - 0.5)
+            return false;
+        t.Box[0] = static_cast<int>(std::max(0.0, std::ceil(minX - 0.5)));
+        t.Box[1] = static_cast<int>(std::max(0.0, std::ceil(minY - 0.5)));
+        t.Box[2] = static_cast<int>(std::min(size[0] - 1.0, std::floor(maxX - 0.5)));
+        t.Box[3] = static_cast<int>(std::min(size[1] - 1.0, std::floor(maxY - 0.5)));
+        if (t.Box[0] > t.Box[2] || t.Box[1] > t.Box[3])
+            return false;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            int j = (i + 1) % 3, k = (i + 2) % 3;
+            t.A[i] = y[j] - y[k];
+            t.B[i] = x[k] - x[j];
+            t.C[i] = x[j] * y[k] - x[k] * y[j];
+            t.InvW[i] = invW[i] / area;
+        }
+        return true;
+    }
+
+    // nearest depth per pixel of one tile, +inf where no triangle covers it
+    void RasterizeTriangle(ScreenTriangle const& t, int const tile[4], float* depth)
+    {
+        int x0 = std::max(t.Box[0], tile[0]), x1 = std::min(t.Box[2], tile[2]);
+        int y0 = std::max(t.Box[1], tile[1]), y1 = std::min(t.Box[3], tile[3]);
+        for (int y = y0; y <= y1; ++y)
+        {
+            double py = y + 0.5, px = x0 + 0.5;
+            double e[3];
+            for (int i = 0; i < 3; ++i)
+                e[i] = t.A[i] * px + t.B[i] * py + t.C[i];
+            float* row = depth + (y - tile[1]) * TileSize - tile[0];
+            for (int x = x0; x <= x1; ++x)
+            {
+                if (e[0] >= 0 && e[1] >= 0 && e[2] >= 0)
+                {
+                    double invW = e[0] * t.InvW[0] + e[1] * t.InvW[1] + e[2] * t.InvW[2];
+                    auto d = static_cast<float>(1.0 / invW);
+                    row[x] = std::min(row[x], d);
+                }
+                for (int i = 0; i < 3; ++i)
+                    e[i] += t.A[i];
+            }
+        }
+    }
+}
+
+void RasterizeMesh(float const* points, std::int64_t pointCount, std::uint32_t const* triangles, std::int64_t triangleCount,
+                   double const modelToClip[16], int const size[2], MeshRaster& raster, bool parallel)
+{
+    raster.Size[0] = size[0];
+    raster.Size[1] = size[1];
+    auto pixels = static_cast<std::size_t>(size[0]) * size[1];
+    raster.Mask.assign(pixels, 0);
+    raster.Depth.assign(pixels, 0.0f);
+    if (pixels == 0 || triangleCount <= 0)
+        return;
+
+    auto forRange = [parallel](std::int64_t first, std::int64_t last, std::int64_t grain, auto&& fn) {
+        if (parallel)
+            ParallelFor(first, last, grain, fn);
+        else
+            fn(first, last);
+    };
+
+    std::vector<ClipVertex> clip(static_cast<std::size_t>(pointCount));
+    forRange(0, pointCount, 65536, [&](std::int64_t begin, std::int64_t end) {
+        auto const* m = modelToClip;
+        for (std::int64_t i = begin; i < end; ++i)
+        {
+            double p[3] = { points[3 * i], points[3 * i + 1], points[3 * i + 2] };
+            float c[4];
+            for (int r = 0; r < 4; ++r)
+                c[r] = static_cast<float>(m[4 * r] * p[0] + m[4 * r + 1] * p[1] + m[4 * r + 2] * p[2] + m[4 * r + 3]);
+            clip[i] = { c[0], c[1], c[2], c[3] };
+        }
+    });
+
+    int tiles[2] = { (size[0] + TileSize - 1) / TileSize, (size[1] + TileSize - 1) / TileSize };
+    int tileCount = tiles[0] * tiles[1];
+
+    // set up and bin the triangles of every chunk, counting sort by tile
+    std::vector<Chunk> chunks(static_cast<std::size_t>((triangleCount + ChunkSize - 1) / ChunkSize));
+    forRange(0, static_cast<std::int64_t>(chunks.size()), 1, [&](std::int64_t begin, std::int64_t end) {
+        for (std::int64_t c = begin; c < end; ++c)
+        {
+            auto& chunk = chunks[c];
+            std::int64_t first = c * ChunkSize, last = std::min(first + ChunkSize, triangleCount);
+            for (std::int64_t i = first; i < last; ++i)
+            {
+                ClipVertex corners[3] = { clip[triangles[3 * i]], clip[triangles[3 * i + 1]], clip[triangles[3 * i + 2]] };
+                ClipVertex polygon[4];
+                int n = ClipNear(corners, polygon);
+                for (int k = 2; k < n; ++k)  // fan
+                {
+                    ScreenTriangle t;
+                    if (SetupTriangle(polygon[0], polygon[k - 1], polygon[k], size, t))
+                        chunk.Triangles.push_back(t);
+                }
+            }
+
+            chunk.Offsets.assign(static_cast<std::size_t>(tileCount) + 1, 0);
+            auto forTiles = [&](ScreenTriangle const& t, auto&& fn) {
+                for (int ty = t.Box[1] / TileSize; ty <= t.Box[3] / TileSize; ++ty)
+                    for (int tx = t.Box[0] / TileSize; tx <= t.Box[2] / TileSize; ++tx)
+                        fn(tx + ty * tiles[0]);
+            };
+            for (auto const& t : chunk.Triangles)
+                forTiles(t, [&](int tile) { ++chunk.Offsets[tile + 1]; });
+            for (int tile = 0; tile < tileCount; ++tile)
+                chunk.Offsets[tile + 1] += chunk.Offsets[tile];
+            chunk.Items.resize(chunk.Offsets[tileCount]);
+            std::vector<std::uint32_t> cursor(chunk.Offsets.begin(), chunk.Offsets.end() - 1);
+            for (std::size_t k = 0; k < chunk.Triangles.size(); ++k)
+                forTiles(chunk.Triangles[k], [&](int tile) { chunk.Items[cursor[tile]++] = static_cast<std::uint32_t>(k); });
+        }
+    });
+
+    auto rasterizeTile = [&](std::int64_t tileIndex) {
+        int tx = static_cast<int>(tileIndex % tiles[0]), ty = static_cast<int>(tileIndex / tiles[0]);
+        int tile[4] = { tx * TileSize, ty * TileSize, std::min((tx + 1) * TileSize, size[0]) - 1,
+                        std::min((ty + 1) * TileSize, size[1]) - 1 };
+        float depth[TileSize * TileSize];
+        std::fill(std::begin(depth), std::end(depth), std::numeric_limits<float>::infinity());
+        for (auto const& chunk : chunks)
+            for (auto k = chunk.Offsets[tileIndex]; k < chunk.Offsets[tileIndex + 1]; ++k)
+                RasterizeTriangle(chunk.Triangles[chunk.Items[k]], tile, depth);
+
+        for (int y = tile[1]; y <= tile[3]; ++y)
+            for (int x = tile[0]; x <= tile[2]; ++x)
+            {
+                float d = depth[(y - tile[1]) * TileSize + (x - tile[0])];
+                if (d == std::numeric_limits<float>::infinity())
+                    continue;
+                auto pixel = static_cast<std::size_t>(y) * size[0] + x;
+                raster.Mask[pixel] = 255;
+                raster.Depth[pixel] = d;
+            }
+    };
+    if (parallel)
+        WorkStealingFor(tileCount, rasterizeTile);
+    else
+        for (int tileIndex = 0; tileIndex < tileCount; ++tileIndex)
+            rasterizeTile(tileIndex);
+}
\ No newline at end of file
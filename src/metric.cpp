@@ -1,4 +1,5 @@
 #include "metric.h"
+#include "image_projection.h"
 #include <vtkRenderWindow.h>
 #include <vtkRenderer.h>
 #include <vtkCamera.h>
@@ -7,24 +8,6 @@
 
 using json = nlohmann::json;
 
-void world2view(vtkRenderer* renderer, double& x, double& y, double& z)
-{
-    double coordinates[3] { x, y, z };
-    renderer->SetWorldPoint(coordinates);
-    renderer->WorldToView();
-    renderer->GetViewPoint(coordinates);
-    x = coordinates[0];
-    y = coordinates[1];
-    //std::cout << "x: " << x << ", y: " << y << '\n';  // x [-0.5, 0.5], y [-1, 1]
-    //renderer->ViewportToNormalizedViewport(x, y);  // normalize it
-
-    // auto vp = renderer->GetViewport();
-    // std::cout << "viewport: " << vp[0] << ", " << vp[1] << ", " << vp[2] << ", " << vp[3] << '\n';
-    // auto sz = renderer->GetRenderWindow()->GetSize();
-    // std::cout << "viewport size: " << sz[0] << ", " << sz[1] / 2 << '\n';
-    // std::cout << "movement from viewport center: " << sz[0] / 2 * x << ", " << sz[1] / 4 * y << '\n';
-}
-
 // FIXME: correct?
 // calculate principal point (u, v) on image pixel coordinate
 CameraParameters GetCameraParameters(void* scene_renderer_, double scene_movement[3], int img_extent[6])
@@ -39,6 +22,7 @@ CameraParameters GetCameraParameters(void* scene_renderer_, double scene_movemen
     camera->GetFocalPoint(camera_focal_point);
 
     double inplane_rotation = camera->GetRoll();
+    double view_angle = camera->GetViewAngle();  // the zoom of the pose
 
     double distance = camera->GetDistance();
     double vx = camera_position[0] - camera_focal_point[0];
@@ -57,36 +41,17 @@ CameraParameters GetCameraParameters(void* scene_renderer_, double scene_movemen
     new_mass_center[1] = camera_focal_point[1] + scene_movement[1];
     new_mass_center[2] = camera_focal_point[2] + scene_movement[2];
 
-    // mass center in scene renderer and transform it to viewport coordinate
-    double vpp[3]{ new_mass_center[0], new_mass_center[1], new_mass_center[2] };
-    world2view(scene_renderer, vpp[0], vpp[1], vpp[2]);
-    // image center in background renderer and its viewport coordinate is (0, 0)
-
-    // they are different renderers! image is on backgroundRenderer!
-    double img_width = img_extent[1] - img_extent[0] + 1;
-    double img_height = img_extent[3] - img_extent[2] + 1;
+    // mass center in image pixels relative to the image center, projected without touching the renderer state
+    auto projection = GetImageProjection(camera, nullptr, img_extent);
     int principal_point[2]{ 0 };
-    auto sz = scene_renderer->GetRenderWindow()->GetSize();
-    if (img_width >= img_height)
-    {
-        auto y = img_height / 2.0;
-        auto x_y_factor = double(sz[0]) / (sz[1] / 2.0);
-        principal_point[1] = int(vpp[1] * y);
-        principal_point[0] = int( vpp[0] * x_y_factor * y );
-    }
-    else
-    {
-        auto x = img_width / 2.0;
-        auto y_x_factor = (sz[1] / 2.0) / double(sz[0]);
-        principal_point[0] = int(vpp[0] * x);
-        principal_point[1] = int( vpp[1] * y_x_factor * x );
-    }
+    GetPrincipalPoint(projection, new_mass_center, principal_point);
 
     return CameraParameters{
         azimuth,
         elevation,
         distance,
         inplane_rotation,
+        view_angle,
         { principal_point[0], principal_point[1] },
 
         { camera_position[0], camera_position[1], camera_position[2] },
@@ -108,6 +73,7 @@ void to_json(json& j, CameraParameters const& camera_parameters)
               { "elevation", camera_parameters.elevation },
               { "distance", camera_parameters.distance },
               { "inplane_rotation", camera_parameters.inplane_rotation },
+              { "view_angle", camera_parameters.view_angle },
               { "principal_point", camera_parameters.principal_point },
 
               { "camera_position", camera_parameters.camera_position },
@@ -122,6 +88,7 @@ void from_json(json const& j, CameraParameters& camera_parameters)
     j.at("elevation").get_to(camera_parameters.elevation);
     j.at("distance").get_to(camera_parameters.distance);
     j.at("inplane_rotation").get_to(camera_parameters.inplane_rotation);
+    camera_parameters.view_angle = j.value("view_angle", 30.0);
     j.at("principal_point").get_to(camera_parameters.principal_point);
 
     j.at("camera_position").get_to(camera_parameters.camera_position);
@@ -0,0 +1,248 @@
+#include "silhouette_templates.h"
+#include "mesh_raster.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+namespace {
+    constexpr int Side = SilhouetteTemplates::Side;
+    constexpr char FileMagic[8] = { 'S', 'I', 'L', 'T', 'P', 'L', '0', '1' };
+    constexpr double EdgePercentile = 0.9;  // gradient magnitudes of the query above it count as edges
+    constexpr double Pi = 3.14159265358979323846;
+
+    int PopCount(std::uint64_t word)
+    {
+        return static_cast<int>(std::bitset<64>(word).count());
+    }
+
+    // orthographic model to clip matrix (row-major, w = 1) fitting the points seen from (azimuth, elevation) into
+    // the template square, false when they have no extent across the view
+    bool GetViewMatrix(float const* points, std::int64_t pointCount, double azimuth, double elevation, double modelToClip[16])
+    {
+        double a = azimuth * Pi / 180, e = elevation * Pi / 180;
+        double right[3] = { std::cos(a), 0, -std::sin(a) };
+        double back[3] = { std::sin(a) * std::cos(e), std::sin(e), std::cos(a) * std::cos(e) };
+        double up[3] = { back[1] * right[2] - back[2] * right[1],
+                         back[2] * right[0] - back[0] * right[2],
+                         back[0] * right[1] - back[1] * right[0] };
+
+        double box[4] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+                          std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest() };
+        for (std::int64_t i = 0; i < pointCount; ++i)
+        {
+            float const* p = points + 3 * i;
+            double x = right[0] * p[0] + right[1] * p[1] + right[2] * p[2];
+            double y = up[0] * p[0] + up[1] * p[1] + up[2] * p[2];
+            box[0] = std::min(box[0], x);
+            box[1] = std::min(box[1], y);
+            box[2] = std::max(box[2], x);
+            box[3] = std::max(box[3], y);
+        }
+        double extent = std::max(box[2] - box[0], box[3] - box[1]);
+        if (!(extent > 0))
+            return false;
+
+        double k = 2 * (1 - 2 * SilhouetteTemplates::Margin) / extent;
+        double cx = (box[0] + box[2]) / 2, cy = (box[1] + box[3]) / 2;
+        std::fill_n(modelToClip, 16, 0.0);
+        for (int i = 0; i < 3; ++i)
+        {
+            modelToClip[i] = k * right[i];
+            modelToClip[4 + i] = k * up[i];
+        }
+        modelToClip[3] = -k * cx;
+        modelToClip[7] = -k * cy;
+        modelToClip[15] = 1;
+        return true;
+    }
+
+    // set bits whose four neighbors are set as well, bits outside the square count as clear
+    void Erode(std::uint64_t const* rows, std::uint64_t* eroded)
+    {
+        for (int y = 0; y < Side; ++y)
+        {
+            std::uint64_t below = y > 0 ? rows[y - 1] : 0, above = y + 1 < Side ? rows[y + 1] : 0;
+            eroded[y] = rows[y] & (rows[y] << 1) & (rows[y] >> 1) & below & above;
+        }
+    }
+
+    void Dilate(std::uint64_t const* rows, std::uint64_t* dilated)
+    {
+        std::uint64_t wide[Side];
+        for (int y = 0; y < Side; ++y)
+            wide[y] = rows[y] | (rows[y] << 1) | (rows[y] >> 1);
+        for (int y = 0; y < Side; ++y)
+            dilated[y] = wide[y] | (y > 0 ? wide[y - 1] : 0) | (y + 1 < Side ? wide[y + 1] : 0);
+    }
+}
+
+double SilhouetteTemplates::GetAzimuth(int index) const
+{
+    return (index % AzimuthSteps) * 360.0 / AzimuthSteps;
+}
+
+double SilhouetteTemplates::GetElevation(int index) const
+{
+    if (ElevationSteps < 2)
+        return 0;
+    return -MaxElevation + (index / AzimuthSteps) * 2 * MaxElevation / (ElevationSteps - 1);
+}
+
+std::uint64_t HashMesh(float const* points, std::int64_t pointCount, std::uint32_t const* triangles, std::int64_t triangleCount)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](void const* data, std::size_t size) {
+        auto bytes = static_cast<unsigned char const*>(data);
+        for (std::size_t i = 0; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+    };
+    add(&pointCount, sizeof(pointCount));
+    add(&triangleCount, sizeof(triangleCount));
+    add(points, static_cast<std::size_t>(pointCount) * 3 * sizeof(float));
+    add(triangles, static_cast<std::size_t>(triangleCount) * 3 * sizeof(std::uint32_t));
+    return hash;
+}
+
+bool BuildSilhouetteTemplates(float const* points, std::int64_t pointCount, std::uint32_t const* triangles,
+                              std::int64_t triangleCount, int azimuthSteps, int elevationSteps, double maxElevation,
+                              SilhouetteTemplates& templates, std::atomic<bool> const* cancel)
+{
+    templates.AzimuthSteps = std::max(1, azimuthSteps);
+    templates.ElevationSteps = std::max(1, elevationSteps);
+    templates.MaxElevation = maxElevation;
+    templates.MeshHash = HashMesh(points, pointCount, triangles, triangleCount);
+    templates.Rows.assign(static_cast<std::size_t>(templates.GetNumberOfTemplates()) * Side, 0);
+
+    // every view rasterized on one thread, many views at once
+    int const size[2] = { Side, Side };
+    ParallelFor(0, templates.GetNumberOfTemplates(), 1, [&](std::int64_t begin, std::int64_t end) {
+        MeshRaster raster;
+        for (auto index = static_cast<int>(begin); index < end; ++index)
+        {
+            if (cancel && *cancel)
+                return;
+            double modelToClip[16];
+            if (!GetViewMatrix(points, pointCount, templates.GetAzimuth(index), templates.GetElevation(index), modelToClip))
+                continue;
+            RasterizeMesh(points, pointCount, triangles, triangleCount, modelToClip, size, raster, false);
+            auto rows = templates.Rows.data() + static_cast<std::size_t>(index) * Side;
+            for (int y = 0; y < Side; ++y)
+                for (int x = 0; x < Side; ++x)
+                    if (raster.Mask[y * Side + x] != 0)
+                        rows[y] |= std::uint64_t(1) << x;
+        }
+    });
+    return !(cancel && *cancel);
+}
+
+bool WriteSilhouetteTemplates(SilhouetteTemplates const& templates, std::string const& path)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+    std::int32_t header[3] = { Side, templates.AzimuthSteps, templates.ElevationSteps };
+    out.write(FileMagic, sizeof(FileMagic));
+    out.write(reinterpret_cast<char const*>(header), sizeof(header));
+    out.write(reinterpret_cast<char const*>(&templates.MaxElevation), sizeof(templates.MaxElevation));
+    out.write(reinterpret_cast<char const*>(&templates.MeshHash), sizeof(templates.MeshHash));
+    out.write(reinterpret_cast<char const*>(templates.Rows.data()), templates.Rows.size() * sizeof(std::uint64_t));
+    return static_cast<bool>(out);
+}
+
+bool ReadSilhouetteTemplates(std::string const& path, SilhouetteTemplates& templates)
+{
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(FileMagic)];
+    std::int32_t header[3];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, FileMagic, sizeof(magic)) != 0 ||
+        !in.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != Side ||
+        header[1] < 1 || header[2] < 1 || header[1] > 4096 || header[2] > 4096)
+        return false;
+
+    SilhouetteTemplates read;
+    read.AzimuthSteps = header[1];
+    read.ElevationSteps = header[2];
+    read.Rows.resize(static_cast<std::size_t>(read.GetNumberOfTemplates()) * Side);
+    in.read(reinterpret_cast<char*>(&read.MaxElevation), sizeof(read.MaxElevation));
+    in.read(reinterpret_cast<char*>(&read.MeshHash), sizeof(read.MeshHash));
+    in.read(reinterpret_cast<char*>(read.Rows.data()), read.Rows.size() * sizeof(std::uint64_t));
+    if (!in)
+        return false;
+    templates = std::move(read);
+    return true;
+}
+
+SilhouetteQuery MakeSilhouetteQuery(float const* gray)
+{
+    std::vector<float> magnitude(Side * Side, 0.0f);
+    for (int y = 1; y + 1 < Side; ++y)
+        for (int x = 1; x + 1 < Side; ++x)
+        {
+            auto g = [&](int dx, int dy) { return gray[(y + dy) * Side + x + dx]; };
+            float gx = g(1, -1) + 2 * g(1, 0) + g(1, 1) - g(-1, -1) - 2 * g(-1, 0) - g(-1, 1);
+            float gy = g(-1, 1) + 2 * g(0, 1) + g(1, 1) - g(-1, -1) - 2 * g(0, -1) - g(1, -1);
+            magnitude[y * Side + x] = std::sqrt(gx * gx + gy * gy);
+        }
+    auto sorted = magnitude;
+    auto nth = sorted.begin() + static_cast<std::ptrdiff_t>(EdgePercentile * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    float threshold = std::max(*nth, std::numeric_limits<float>::min());  // a flat crop has no edges
+
+    std::uint64_t edges[Side] = {};
+    for (int y = 0; y < Side; ++y)
+        for (int x = 0; x < Side; ++x)
+            if (magnitude[y * Side + x] >= threshold)
+                edges[y] |= std::uint64_t(1) << x;
+    SilhouetteQuery query;
+    std::copy_n(edges, Side, query.Edges);
+    Dilate(edges, query.NearEdges);
+    return query;
+}
+
+std::vector<SilhouetteMatch> FindBestViews(SilhouetteTemplates const& templates, SilhouetteQuery const& query, int count)
+{
+    int edgeCount = 0;
+    for (auto edge : query.Edges)
+        edgeCount += PopCount(edge);
+
+    std::vector<SilhouetteMatch> matches;
+    matches.reserve(templates.GetNumberOfTemplates());
+    for (int index = 0; index < templates.GetNumberOfTemplates(); ++index)
+    {
+        auto rows = templates.GetTemplate(index);
+        std::uint64_t contour[Side], nearContour[Side];
+        Erode(rows, contour);
+        for (int y = 0; y < Side; ++y)
+            contour[y] = rows[y] & ~contour[y];
+        Dilate(contour, nearContour);
+
+        int contourCount = 0, onEdges = 0, nearContourEdges = 0;
+        for (int y = 0; y < Side; ++y)
+        {
+            contourCount += PopCount(contour[y]);
+            onEdges += PopCount(contour[y] & query.NearEdges[y]);
+            nearContourEdges += PopCount(nearContour[y] & query.Edges[y]);
+        }
+        if (contourCount == 0 || edgeCount == 0)
+            continue;
+
+        double precision = double(onEdges) / contourCount, recall = double(nearContourEdges) / edgeCount;
+        SilhouetteMatch match;
+        match.Index = index;
+        match.Azimuth = templates.GetAzimuth(index);
+        match.Elevation = templates.GetElevation(index);
+        match.Score = precision + recall > 0 ? 2 * precision * recall / (precision + recall) : 0;
+        matches.push_back(match);
+    }
+
+    auto n = std::min(static_cast<std::size_t>(std::max(count, 0)), matches.size());
+    std::partial_sort(matches.begin(), matches.begin() + n, matches.end(),
+                      [](SilhouetteMatch const& a, SilhouetteMatch const& b) { return a.Score > b.Score; });
+    matches.resize(n);
+    return matches;
+}
\ No newline at end of file
@@ -0,0 +1,319 @@
+// Headless benchmark of the VolumeType mappers: voxelizes synthetic and user meshes at several resolutions, renders
+// every mapper offscreen along camera paths for a sweep of sample distances, and the extracted iso-surfaces of the same
+// ISO values for comparison, and writes frame-time percentiles, memory use and setup time as JSON
+// usage: VolumeBenchmark [--out results.json] [--size WxH] [--frames N] [mesh files ...]
+
+#include <vtkSmartPointer.h>
+#include <vtkNew.h>
+#include <vtkSphereSource.h>
+#include <vtkCylinderSource.h>
+#include <vtkRenderer.h>
+#include <vtkRenderWindow.h>
+#include <vtkCamera.h>
+#include <vtkAssembly.h>
+
+#include "my_pipeline.h"
+
+#include <json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <psapi.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "psapi.lib")
+#endif
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // current resident set size of the process in KiB, unlike the peak it goes down again when a configuration is freed
+    long long ResidentMemoryKB()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return static_cast<long long>(counters.WorkingSetSize / 1024);
+        return 0;
+#elif defined(__APPLE__)
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+            return static_cast<long long>(info.resident_size / 1024);
+        return 0;
+#else
+        long long pages = 0, resident = 0;
+        if (FILE* statm = fopen("/proc/self/statm", "r"))
+        {
+            if (fscanf(statm, "%lld %lld", &pages, &resident) != 2)
+                resident = 0;
+            fclose(statm);
+        }
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+    }
+
+    // nearest-rank percentile of sorted samples
+    double Percentile(std::vector<double> const& sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+        auto rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    std::vector<std::pair<std::string, vtkSmartPointer<vtkPolyData>>> GetSyntheticMeshes()
+    {
+        vtkNew<vtkSphereSource> sphere;
+        sphere->SetRadius(10);
+        sphere->SetThetaResolution(128);
+        sphere->SetPhiResolution(128);
+        sphere->Update();
+
+        vtkNew<vtkCylinderSource> cylinder;
+        cylinder->SetRadius(5);
+        cylinder->SetHeight(20);
+        cylinder->SetResolution(128);
+        cylinder->CappingOn();
+        cylinder->Update();
+
+        return { { "sphere", sphere->GetOutput() }, { "cylinder", cylinder->GetOutput() } };
+    }
+
+    // camera motion applied before every frame of a path
+    struct CameraPath
+    {
+        char const* name;
+        std::function<void(vtkCamera*, int frame, int frames)> step;
+    };
+
+    std::vector<CameraPath> GetCameraPaths()
+    {
+        return {
+            { "orbit", [](vtkCamera* camera, int, int frames) { camera->Azimuth(360.0 / frames); } },
+            { "elevation", [](vtkCamera* camera, int, int frames) {
+                camera->Elevation(180.0 / frames);
+                camera->OrthogonalizeViewUp();
+            } },
+            { "zoom", [](vtkCamera* camera, int frame, int frames) {
+                camera->Dolly(frame < frames / 2 ? 1.02 : 1 / 1.02);  // in, then back out
+            } },
+        };
+    }
+
+    struct Options
+    {
+        std::string out = "volume_benchmark.json";
+        int size[2] = { 800, 600 };
+        int frames = 60;
+        std::vector<std::string> meshes;
+    };
+
+    Options ParseOptions(int argc, char* argv[])
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (!strcmp(argv[i], "--out") && i + 1 < argc)
+                options.out = argv[++i];
+            else if (!strcmp(argv[i], "--size") && i + 1 < argc)
+                sscanf(argv[++i], "%dx%d", &options.size[0], &options.size[1]);
+            else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+                options.frames = std::max(2, atoi(argv[++i]));
+            else
+                options.meshes.emplace_back(argv[i]);
+        }
+        return options;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    auto options = ParseOptions(argc, argv);
+
+    auto meshes = GetSyntheticMeshes();
+    for (auto const& file : options.meshes)
+    {
+        // ReadPolyData falls back to a sphere for unknown formats, but not for missing files
+        vtkSmartPointer<vtkPolyData> polyData;
+        if (vtksys::SystemTools::FileExists(file, true))
+            polyData = ReadPolyData(file.c_str());
+        if (polyData == nullptr || polyData->GetNumberOfPoints() == 0)
+        {
+            fprintf(stderr, "Skipping %s: cannot read a mesh from it\n", file.c_str());
+            continue;
+        }
+        meshes.emplace_back(vtksys::SystemTools::GetFilenameName(file), polyData);
+    }
+
+    vtkNew<vtkRenderWindow> renderWindow;
+    renderWindow->SetOffScreenRendering(1);
+    renderWindow->SetSize(options.size[0], options.size[1]);
+    vtkNew<vtkRenderer> renderer;
+    renderer->SetBackground(0.45, 0.55, 0.60);
+    renderWindow->AddRenderer(renderer);
+
+    const char* volumeTypeName[] = { "FixedPointVolumeRayCast", "GPUVolumeRayCast", "SmartVolume", "CpuRayCast" };
+    double color1[3] = { 1.00, 0.96, 0.93 }, color2[3] = { 0.78, 0.47, 0.15 };
+    auto cameraPaths = GetCameraPaths();
+
+    json results = json::array();
+
+    // Render `prop` along one camera path, setupStart includes building the prop. The memory of a configuration is the
+    // resident set growth from residentBefore, taken before building it, to the first frame, with the mapper's
+    // buffers and uploads; memory the allocator kept from earlier configurations can make it smaller than the footprint
+    auto measure = [&](vtkProp* prop, CameraPath const& path, Clock::time_point setupStart, long long residentBefore, json result) {
+        renderer->AddViewProp(prop);
+        // every path starts from the same view along -z
+        auto camera = renderer->GetActiveCamera();
+        camera->SetFocalPoint(0, 0, 0);
+        camera->SetPosition(0, 0, 1);
+        camera->SetViewUp(0, 1, 0);
+        renderer->ResetCamera();
+        renderWindow->Render();  // first frame includes the data upload
+        renderWindow->WaitForCompletion();
+        double setupTime = MillisecondsSince(setupStart);
+        long long residentGrowth = ResidentMemoryKB() - residentBefore;
+        // the CpuRayCast gradients are built once per image data, the cache is cleared before every configuration
+        double gradientTime = GetGradientCache().GetStats().BuildMilliseconds;
+
+        std::vector<double> frameTimes;
+        frameTimes.reserve(static_cast<size_t>(options.frames));
+        for (int frame = 0; frame < options.frames; ++frame)
+        {
+            path.step(renderer->GetActiveCamera(), frame, options.frames);
+            renderer->ResetCameraClippingRange();
+            auto frameStart = Clock::now();
+            renderWindow->Render();
+            renderWindow->WaitForCompletion();
+            frameTimes.push_back(MillisecondsSince(frameStart));
+        }
+        renderer->RemoveViewProp(prop);
+        prop->ReleaseGraphicsResources(renderWindow);
+
+        std::sort(frameTimes.begin(), frameTimes.end());
+        result["camera_path"] = path.name;
+        result["setup_ms"] = setupTime;
+        result["frame_ms"] = { { "p50", Percentile(frameTimes, 50) },
+                               { "p90", Percentile(frameTimes, 90) },
+                               { "p99", Percentile(frameTimes, 99) },
+                               { "max", frameTimes.back() } };
+        result["gradient_build_ms"] = gradientTime;
+        result["rss_growth_kb"] = residentGrowth;
+        results.push_back(result);
+        printf("%-12s %4d %-24s sd %.4f isd %.1f %-9s setup %8.1f ms  p50 %7.2f ms  p99 %7.2f ms\n",
+               result["mesh"].get<std::string>().c_str(), result["resolution"].get<int>(),
+               result["volume_type"].get<std::string>().c_str(), result["sample_distance"].get<double>(),
+               result["img_sample_distance"].get<double>(), path.name, setupTime, Percentile(frameTimes, 50),
+               Percentile(frameTimes, 99));
+    };
+
+    for (auto const& mesh : meshes)
+    {
+        auto const& name = mesh.first;
+        auto const& polyData = mesh.second;
+        double bounds[6];
+        polyData->GetBounds(bounds);
+        double extent = std::max({ bounds[1] - bounds[0], bounds[3] - bounds[2], bounds[5] - bounds[4] });
+
+        for (int resolution : { 64, 128, 256 })
+        {
+            double voxelSize = extent / resolution;
+            double spacing[3] = { voxelSize, voxelSize, voxelSize };
+            auto voxelizeStart = Clock::now();
+            auto imgData = ConvertMeshPolyDataToImageData(polyData, spacing, 16, VoxelizeEngine::SimdParity);
+            double voxelizeTime = MillisecondsSince(voxelizeStart);
+            json common = {
+                { "mesh", name },
+                { "resolution", resolution },
+                { "dimensions", { imgData->GetDimensions()[0], imgData->GetDimensions()[1], imgData->GetDimensions()[2] } },
+                { "voxelize_ms", voxelizeTime },
+                { "volume_kb", static_cast<long long>(imgData->GetActualMemorySize()) },
+            };
+
+            for (int type = 0; type < static_cast<int>(std::size(volumeTypeName)); ++type)
+            {
+                for (double sampleFactor : { 0.5, 1.0, 2.0 })
+                {
+                    // the smart mapper has no image sample distance of its own
+                    std::vector<float> imgSampleDistances = { 1.f, 2.f, 4.f };
+                    if (static_cast<VolumeType>(type) == VolumeType::SmartVolume)
+                        imgSampleDistances = { 1.f };
+                    for (float imgSampleDistance : imgSampleDistances)
+                    {
+                        auto sampleDistance = static_cast<float>(sampleFactor * voxelSize);
+                        for (auto const& path : cameraPaths)
+                        {
+                            GetGradientCache().Clear();
+                            long long residentBefore = ResidentMemoryKB();
+                            auto setupStart = Clock::now();
+                            auto volume = GetVolume(imgData, static_cast<VolumeType>(type), sampleDistance, imgSampleDistance,
+                                                    0.5, 1.5, color1, color2);
+                            json result = common;
+                            result["volume_type"] = volumeTypeName[type];
+                            result["sample_distance"] = sampleDistance;
+                            result["img_sample_distance"] = imgSampleDistance;
+                            measure(volume, path, setupStart, residentBefore, result);
+                        }
+                    }
+                }
+            }
+
+            // the same ISO settings as surfaces, the setup time includes the extraction
+            for (auto const& path : cameraPaths)
+            {
+                GetGradientCache().Clear();
+                long long residentBefore = ResidentMemoryKB();
+                auto setupStart = Clock::now();
+                IsoSurfaceCache cache;
+                auto props = SetupMyActorsForIsoSurface(name, imgData, cache, 0.5, 1.5, color1, color2);
+                vtkNew<vtkAssembly> surfaces;
+                surfaces->AddPart(static_cast<vtkProp3D*>(props->GetItemAsObject(0)));
+                surfaces->AddPart(static_cast<vtkProp3D*>(props->GetItemAsObject(1)));
+                json result = common;
+                result["volume_type"] = "ExtractedIsoSurface";
+                result["sample_distance"] = 0.0;
+                result["img_sample_distance"] = 0.0;
+                measure(surfaces, path, setupStart, residentBefore, result);
+            }
+        }
+    }
+
+    std::ofstream out(options.out);
+    out << std::setw(4) << json{ { "window_size", { options.size[0], options.size[1] } },
+                                 { "frames_per_path", options.frames },
+                                 { "results", results } } << std::endl;
+    if (!out)
+    {
+        fprintf(stderr, "Failed to write %s\n", options.out.c_str());
+        return 1;
+    }
+    printf("results written to %s\n", options.out.c_str());
+    return 0;
+}
\ No newline at end of file
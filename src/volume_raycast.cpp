@@ -0,0 +1,1174 @@
+#include "volume_raycast.h"
+#include "bricked_volume.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+
+#if defined(IMGUIVTK_X86)
+#include <immintrin.h>
+#endif
+
+// The bricks of a BrickedVolume a caster has decompressed: constant bricks are read as their value and never
+// decompressed, any other is decompressed the first time a ray samples it and kept. Shared by the tiles of a frame
+class BrickCache
+{
+public:
+    explicit BrickCache(std::shared_ptr<BrickedVolume const> volume)
+        : Volume(std::move(volume)), Count(static_cast<size_t>(Volume->GetNumberOfBricks())),
+          Decompressed(new std::atomic<void const*>[Count]), Storage(Count), Constant(Count), IsConstant(Count)
+    {
+        std::copy_n(Volume->GetBrickDimensions(), 3, BrickDim);
+        for (size_t brick = 0; brick < Count; ++brick)
+        {
+            Decompressed[brick].store(nullptr, std::memory_order_relaxed);
+            float range[2];
+            Volume->GetBrickRange(brick, range);
+            Constant[brick] = range[0];
+            IsConstant[brick] = Volume->IsBrickConstant(brick);
+        }
+    }
+
+    // the voxels of a brick that is not constant
+    void const* Get(std::size_t brick)
+    {
+        if (void const* voxels = Decompressed[brick].load(std::memory_order_acquire))
+            return voxels;
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (void const* voxels = Decompressed[brick].load(std::memory_order_relaxed))
+            return voxels;
+        std::size_t bytes = GetScalarSize();
+        std::int64_t i = static_cast<std::int64_t>(brick);
+        for (int a = 0; a < 3; ++a)
+        {
+            bytes *= std::min(BrickedVolume::BrickSize, Volume->GetDimensions()[a] - static_cast<int>(i % BrickDim[a]) * BrickedVolume::BrickSize);
+            i /= BrickDim[a];
+        }
+        Storage[brick].reset(new std::uint8_t[bytes]);
+        Volume->DecompressBrick(brick, Storage[brick].get());
+        DecompressedBytes += bytes;
+        ++DecompressedBricks;
+        Decompressed[brick].store(Storage[brick].get(), std::memory_order_release);
+        return Storage[brick].get();
+    }
+
+    std::size_t GetScalarSize() const
+    {
+        switch (Volume->GetScalar()) {
+        case RayCastScalar::UnsignedShort: return sizeof(unsigned short);
+        case RayCastScalar::Float: return sizeof(float);
+        default: return sizeof(unsigned char);
+        }
+    }
+
+    std::shared_ptr<BrickedVolume const> Volume;
+    std::size_t Count;
+    int BrickDim[3];
+    std::unique_ptr<std::atomic<void const*>[]> Decompressed;  // the brick's Storage once it is filled
+    std::vector<std::unique_ptr<std::uint8_t[]>> Storage;      // written under Mutex
+    std::vector<float> Constant;                               // value of the constant bricks
+    std::vector<char> IsConstant;
+    std::atomic<std::size_t> DecompressedBytes{ 0 };
+    std::atomic<int> DecompressedBricks{ 0 };
+    std::mutex Mutex;
+};
+
+namespace {
+    constexpr int BrickSize = BrickMinMax::BrickSize;
+    constexpr int TileSize = 16;       // pixels per image tile side
+    constexpr float Opaque = 0.99f;    // early ray termination
+    constexpr double SphereTraceSafety = 0.9;
+
+    constexpr float NormalScale = 4095.0f;  // 12 bits per octahedral coordinate
+
+    // trilinear sample of the voxels of s.At in continuous index space, clamped to the volume
+    template <typename S>
+    float TrilinearSample(S const& s, double const p[3])
+    {
+        int i0[3], i1[3];
+        float f[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            double c = std::min(std::max(p[a], 0.0), static_cast<double>(s.Dim[a] - 1));
+            i0[a] = std::min(static_cast<int>(c), s.Dim[a] - 1);
+            i1[a] = std::min(i0[a] + 1, s.Dim[a] - 1);
+            f[a] = static_cast<float>(c - i0[a]);
+        }
+        float c00 = s.At(i0[0], i0[1], i0[2]) + f[0] * (s.At(i1[0], i0[1], i0[2]) - s.At(i0[0], i0[1], i0[2]));
+        float c10 = s.At(i0[0], i1[1], i0[2]) + f[0] * (s.At(i1[0], i1[1], i0[2]) - s.At(i0[0], i1[1], i0[2]));
+        float c01 = s.At(i0[0], i0[1], i1[2]) + f[0] * (s.At(i1[0], i0[1], i1[2]) - s.At(i0[0], i0[1], i1[2]));
+        float c11 = s.At(i0[0], i1[1], i1[2]) + f[0] * (s.At(i1[0], i1[1], i1[2]) - s.At(i0[0], i1[1], i1[2]));
+        float c0 = c00 + f[1] * (c10 - c00);
+        float c1 = c01 + f[1] * (c11 - c01);
+        return c0 + f[2] * (c1 - c0);
+    }
+
+    // central differences of trilinear samples one voxel apart
+    template <typename S>
+    void CentralDifferences(S const& s, double const p[3], double g[3])
+    {
+        for (int a = 0; a < 3; ++a)
+        {
+            double lo[3] = { p[0], p[1], p[2] }, hi[3] = { p[0], p[1], p[2] };
+            lo[a] -= 1;
+            hi[a] += 1;
+            g[a] = 0.5 * (s.Trilinear(hi) - s.Trilinear(lo));
+        }
+    }
+
+    // voxels of one scalar type with trilinear sampling in continuous index space
+    template <typename T>
+    struct Sampler
+    {
+        static constexpr bool Dense = true;  // Voxels index the whole volume, as the AVX2 packets need
+
+        T const* Voxels;
+        int Dim[3];
+        std::int64_t StrideY, StrideZ;
+        QuantizedGradients const* Gradients;  // of these voxels, or null
+
+        Sampler(void const* voxels, int const dim[3], QuantizedGradients const* gradients = nullptr)
+            : Voxels(static_cast<T const*>(voxels)), Dim{ dim[0], dim[1], dim[2] },
+              StrideY(dim[0]), StrideZ(static_cast<std::int64_t>(dim[0]) * dim[1]), Gradients(gradients)
+        {
+        }
+
+        float At(int x, int y, int z) const { return static_cast<float>(Voxels[x + y * StrideY + z * StrideZ]); }
+
+        float Trilinear(double const p[3]) const { return TrilinearSample(*this, p); }
+
+        // central differences of trilinear samples one voxel apart, or the precomputed gradients interpolated trilinearly
+        void Gradient(double const p[3], double g[3]) const
+        {
+            if (Gradients != nullptr)
+            {
+                int i0[3], i1[3];
+                float f[3];
+                for (int a = 0; a < 3; ++a)
+                {
+                    double c = std::min(std::max(p[a], 0.0), static_cast<double>(Dim[a] - 1));
+                    i0[a] = std::min(static_cast<int>(c), Dim[a] - 1);
+                    i1[a] = std::min(i0[a] + 1, Dim[a] - 1);
+                    f[a] = static_cast<float>(c - i0[a]);
+                }
+                g[0] = g[1] = g[2] = 0;
+                for (int corner = 0; corner < 8; ++corner)
+                {
+                    int x = corner & 1 ? i1[0] : i0[0], y = corner & 2 ? i1[1] : i0[1], z = corner & 4 ? i1[2] : i0[2];
+                    float w = (corner & 1 ? f[0] : 1 - f[0]) * (corner & 2 ? f[1] : 1 - f[1]) * (corner & 4 ? f[2] : 1 - f[2]);
+                    float gc[3];
+                    Gradients->Decode(x + y * StrideY + z * StrideZ, gc);
+                    for (int a = 0; a < 3; ++a)
+                        g[a] += w * gc[a];
+                }
+                return;
+            }
+            CentralDifferences(*this, p, g);
+        }
+    };
+
+    // voxels of a BrickedVolume sampled like Sampler<T>, read brick by brick through a BrickCache; shading takes
+    // central differences, precomputed gradients would be as large as the dense volume
+    template <typename T>
+    struct BrickedSampler
+    {
+        static constexpr bool Dense = false;
+        static constexpr int Side = BrickedVolume::BrickSize;
+
+        BrickCache* Cache;
+        int Dim[3];
+
+        explicit BrickedSampler(BrickCache& cache) : Cache(&cache)
+        {
+            std::copy_n(cache.Volume->GetDimensions(), 3, Dim);
+        }
+
+        float At(int x, int y, int z) const
+        {
+            int bx = x / Side, by = y / Side, bz = z / Side;
+            auto brick = (static_cast<size_t>(bz) * Cache->BrickDim[1] + by) * Cache->BrickDim[0] + bx;
+            if (Cache->IsConstant[brick])
+                return Cache->Constant[brick];
+            auto voxels = static_cast<T const*>(Cache->Get(brick));
+            // bricks at the upper borders are smaller
+            std::int64_t sizeX = std::min(Side, Dim[0] - bx * Side), sizeY = std::min(Side, Dim[1] - by * Side);
+            return static_cast<float>(voxels[(x - bx * Side) + ((z - bz * Side) * sizeY + (y - by * Side)) * sizeX]);
+        }
+
+        float Trilinear(double const p[3]) const { return TrilinearSample(*this, p); }
+        void Gradient(double const p[3], double g[3]) const { CentralDifferences(*this, p, g); }
+    };
+
+    template <typename T>
+    void BuildBricks(Sampler<T> const& s, BrickMinMax& bricks)
+    {
+        ParallelFor(0, bricks.Dim[2], 1, [&](std::int64_t begin, std::int64_t end) {
+            for (auto bz = begin; bz < end; ++bz)
+            {
+                for (int by = 0; by < bricks.Dim[1]; ++by)
+                {
+                    for (int bx = 0; bx < bricks.Dim[0]; ++bx)
+                    {
+                        // voxels [b * BrickSize, (b + 1) * BrickSize], the upper layer is shared with the neighbor
+                        int lo[3] = { bx * BrickSize, by * BrickSize, static_cast<int>(bz) * BrickSize };
+                        int hi[3];
+                        for (int a = 0; a < 3; ++a)
+                            hi[a] = std::min(lo[a] + BrickSize, s.Dim[a] - 1);
+
+                        float vmin = s.At(lo[0], lo[1], lo[2]), vmax = vmin;
+                        for (int z = lo[2]; z <= hi[2]; ++z)
+                        {
+                            for (int y = lo[1]; y <= hi[1]; ++y)
+                            {
+                                T const* row = s.Voxels + y * s.StrideY + z * s.StrideZ;
+                                for (int x = lo[0]; x <= hi[0]; ++x)
+                                {
+                                    float v = static_cast<float>(row[x]);
+                                    vmin = std::min(vmin, v);
+                                    vmax = std::max(vmax, v);
+                                }
+                            }
+                        }
+                        auto id = (static_cast<size_t>(bz) * bricks.Dim[1] + by) * bricks.Dim[0] + bx;
+                        bricks.Min[id] = vmin;
+                        bricks.Max[id] = vmax;
+                    }
+                }
+            }
+        });
+    }
+
+    // central differences on the voxel grid, clamped at the border like Sampler::Gradient
+    template <typename T>
+    void VoxelGradient(Sampler<T> const& s, int x, int y, int z, float g[3])
+    {
+        g[0] = 0.5f * (s.At(std::min(x + 1, s.Dim[0] - 1), y, z) - s.At(std::max(x - 1, 0), y, z));
+        g[1] = 0.5f * (s.At(x, std::min(y + 1, s.Dim[1] - 1), z) - s.At(x, std::max(y - 1, 0), z));
+        g[2] = 0.5f * (s.At(x, y, std::min(z + 1, s.Dim[2] - 1)) - s.At(x, y, std::max(z - 1, 0)));
+    }
+
+    // Octahedral normal: the direction projected onto |x| + |y| + |z| = 1, the lower half folded over the upper one.
+    // The magnitude is the L1 norm, so decoding is that point times the magnitude, without normalizing
+    std::uint32_t EncodeGradient(float const g[3], float maxMagnitude)
+    {
+        float l1 = std::abs(g[0]) + std::abs(g[1]) + std::abs(g[2]);
+        if (l1 == 0)
+            return 0;
+        float x = g[0] / l1, y = g[1] / l1;
+        if (g[2] < 0)
+        {
+            float fx = std::copysign(1 - std::abs(y), x), fy = std::copysign(1 - std::abs(x), y);
+            x = fx;
+            y = fy;
+        }
+        auto u = static_cast<std::uint32_t>(std::lround((x * 0.5f + 0.5f) * NormalScale));
+        auto v = static_cast<std::uint32_t>(std::lround((y * 0.5f + 0.5f) * NormalScale));
+        // any nonzero gradient keeps a nonzero magnitude, so it still shades
+        auto m = static_cast<std::uint32_t>(std::min(std::max(std::lround(l1 / maxMagnitude * 255), 1L), 255L));
+        return u | v << 12 | m << 24;
+    }
+
+    template <typename T>
+    void BuildGradients(Sampler<T> const& s, QuantizedGradients& gradients)
+    {
+        // largest magnitude first, it scales the quantized ones
+        std::vector<float> sliceMax(static_cast<size_t>(s.Dim[2]), 0.0f);
+        ParallelFor(0, s.Dim[2], 1, [&](std::int64_t begin, std::int64_t end) {
+            for (auto z = begin; z < end; ++z)
+            {
+                float m = 0;
+                for (int y = 0; y < s.Dim[1]; ++y)
+                {
+                    for (int x = 0; x < s.Dim[0]; ++x)
+                    {
+                        float g[3];
+                        VoxelGradient(s, x, y, static_cast<int>(z), g);
+                        m = std::max(m, std::abs(g[0]) + std::abs(g[1]) + std::abs(g[2]));
+                    }
+                }
+                sliceMax[z] = m;
+            }
+        });
+        gradients.MaxMagnitude = *std::max_element(sliceMax.begin(), sliceMax.end());
+
+        ParallelFor(0, s.Dim[2], 1, [&](std::int64_t begin, std::int64_t end) {
+            for (auto z = begin; z < end; ++z)
+            {
+                for (int y = 0; y < s.Dim[1]; ++y)
+                {
+                    std::uint32_t* row = gradients.Encoded.data() + y * s.StrideY + z * s.StrideZ;
+                    for (int x = 0; x < s.Dim[0]; ++x)
+                    {
+                        float g[3];
+                        VoxelGradient(s, x, y, static_cast<int>(z), g);
+                        row[x] = EncodeGradient(g, gradients.MaxMagnitude);
+                    }
+                }
+            }
+        });
+    }
+
+    void Transform(double const m[16], double const p[4], double out[3])
+    {
+        double h[4];
+        for (int r = 0; r < 4; ++r)
+            h[r] = m[r * 4] * p[0] + m[r * 4 + 1] * p[1] + m[r * 4 + 2] * p[2] + m[r * 4 + 3] * p[3];
+        for (int r = 0; r < 3; ++r)
+            out[r] = h[r] / h[3];
+    }
+
+    // transfer function tables prepared for one frame
+    struct FrameTables
+    {
+        int Entries;
+        double Offset, Scale;        // table index = (value - Offset) * Scale
+        std::vector<float> Alpha;    // composite: opacity per sample step
+        std::vector<float> IsoValues, IsoColor, IsoAlpha;  // iso-surface: ascending values, their rgb and opacity
+        std::vector<int> BrickVisible;
+
+        float Index(float value) const
+        {
+            auto i = static_cast<float>((value - Offset) * Scale);
+            return std::min(std::max(i, 0.0f), static_cast<float>(Entries - 1));
+        }
+    };
+
+    FrameTables PrepareTables(BrickMinMax const& bricks, RayCastView const& view, RayCastTransfer const& tf)
+    {
+        FrameTables tables;
+        int entries = tables.Entries = static_cast<int>(tf.Opacity.size());
+        tables.Offset = tf.Range[0];
+        tables.Scale = tf.Range[1] > tf.Range[0] ? (entries - 1) / (tf.Range[1] - tf.Range[0]) : 0.0;
+        tables.BrickVisible.resize(bricks.Min.size());
+
+        if (tf.Blend == RayCastBlend::IsoSurface)
+        {
+            // a surface is drawn with the table entries at its value, a brick is skipped when it holds no visible one
+            std::vector<double> isoValues = tf.IsoValues;
+            std::sort(isoValues.begin(), isoValues.end());
+            for (double iso : isoValues)
+            {
+                float index = tables.Index(static_cast<float>(iso));
+                int i0 = static_cast<int>(index);
+                int i1 = std::min(i0 + 1, entries - 1);
+                float f = index - i0;
+                float alpha = tf.Opacity[i0] + f * (tf.Opacity[i1] - tf.Opacity[i0]);
+                if (alpha <= 0)
+                    continue;
+                tables.IsoValues.push_back(static_cast<float>(iso));
+                tables.IsoAlpha.push_back(std::min(alpha, 1.0f));
+                for (int k = 0; k < 3; ++k)
+                    tables.IsoColor.push_back(tf.Color[3 * i0 + k] + f * (tf.Color[3 * i1 + k] - tf.Color[3 * i0 + k]));
+            }
+            for (size_t b = 0; b < bricks.Min.size(); ++b)
+            {
+                tables.BrickVisible[b] = 0;
+                for (float iso : tables.IsoValues)
+                    tables.BrickVisible[b] |= bricks.Min[b] <= iso && iso <= bricks.Max[b];
+            }
+            return tables;
+        }
+
+        // opacity corrected from the unit distance to the sample distance
+        double exponent = view.SampleDistance / std::max(tf.OpacityUnitDistance, 1e-12);
+        tables.Alpha.resize(static_cast<size_t>(entries));
+        std::vector<int> visibleBefore(static_cast<size_t>(entries) + 1, 0);
+        for (int i = 0; i < entries; ++i)
+        {
+            float opacity = std::min(std::max(tf.Opacity[i], 0.0f), 1.0f);
+            tables.Alpha[i] = static_cast<float>(1.0 - std::pow(1.0 - opacity, exponent));
+            visibleBefore[i + 1] = visibleBefore[i] + (tables.Alpha[i] > 0);
+        }
+
+        // a brick is skipped when no table entry its value range can interpolate to is visible
+        for (size_t b = 0; b < bricks.Min.size(); ++b)
+        {
+            auto lo = static_cast<int>(std::floor(tables.Index(bricks.Min[b])));
+            auto hi = static_cast<int>(std::ceil(tables.Index(bricks.Max[b])));
+            tables.BrickVisible[b] = visibleBefore[hi + 1] - visibleBefore[lo] > 0;
+        }
+        return tables;
+    }
+
+    // one pixel's ray in index space, starting where it enters the clipped voxel box: p(t) = Origin + t * Dir,
+    // t in world units from 0 to Length
+    struct Ray
+    {
+        double Origin[3], Dir[3];
+        double WorldDir[3];
+        double Length;
+    };
+
+    bool SetupRay(RayCastView const& view, int const dim[3], int px, int py, Ray& ray)
+    {
+        // world ray between the near and far plane
+        double ndcX = 2.0 * (px + 0.5) / view.ImageSize[0] - 1;
+        double ndcY = 2.0 * (py + 0.5) / view.ImageSize[1] - 1;
+        double nearNdc[4] = { ndcX, ndcY, -1, 1 }, farNdc[4] = { ndcX, ndcY, 1, 1 };
+        double origin[3], far[3], dir[3];
+        Transform(view.NdcToWorld, nearNdc, origin);
+        Transform(view.NdcToWorld, farNdc, far);
+        for (int a = 0; a < 3; ++a)
+            dir[a] = far[a] - origin[a];
+        double length = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+        if (length == 0)
+            return false;
+        for (int a = 0; a < 3; ++a)
+            dir[a] /= length;
+        double tmin = 0, tmax = length;
+
+        for (auto const& plane : view.ClipPlanes)
+        {
+            double f0 = plane[0] * origin[0] + plane[1] * origin[1] + plane[2] * origin[2] + plane[3];
+            double fd = plane[0] * dir[0] + plane[1] * dir[1] + plane[2] * dir[2];
+            if (fd == 0)
+            {
+                if (f0 < 0)
+                    return false;
+            }
+            else if (fd > 0)
+                tmin = std::max(tmin, -f0 / fd);
+            else
+                tmax = std::min(tmax, -f0 / fd);
+        }
+
+        // the same ray in index space, clipped to the voxel box
+        double const* w2i = view.WorldToIndex;
+        double p0[3], d[3];
+        for (int r = 0; r < 3; ++r)
+        {
+            p0[r] = w2i[r * 4] * origin[0] + w2i[r * 4 + 1] * origin[1] + w2i[r * 4 + 2] * origin[2] + w2i[r * 4 + 3];
+            d[r] = w2i[r * 4] * dir[0] + w2i[r * 4 + 1] * dir[1] + w2i[r * 4 + 2] * dir[2];
+        }
+        for (int a = 0; a < 3; ++a)
+        {
+            double hi = dim[a] - 1;
+            if (d[a] == 0)
+            {
+                if (p0[a] < 0 || p0[a] > hi)
+                    return false;
+                continue;
+            }
+            double ta = -p0[a] / d[a], tb = (hi - p0[a]) / d[a];
+            tmin = std::max(tmin, std::min(ta, tb));
+            tmax = std::min(tmax, std::max(ta, tb));
+        }
+        if (tmin >= tmax)
+            return false;
+
+        for (int a = 0; a < 3; ++a)
+        {
+            ray.Origin[a] = p0[a] + tmin * d[a];
+            ray.Dir[a] = d[a];
+            ray.WorldDir[a] = dir[a];
+        }
+        ray.Length = tmax - tmin;
+        return true;
+    }
+
+    // t where the ray leaves brick b
+    double BrickExit(Ray const& ray, int const b[3])
+    {
+        double exit = ray.Length;
+        for (int a = 0; a < 3; ++a)
+        {
+            if (ray.Dir[a] > 0)
+                exit = std::min(exit, ((b[a] + 1) * BrickSize - ray.Origin[a]) / ray.Dir[a]);
+            else if (ray.Dir[a] < 0)
+                exit = std::min(exit, (b[a] * BrickSize - ray.Origin[a]) / ray.Dir[a]);
+        }
+        return exit;
+    }
+
+    // Phong with a two-sided headlight, the world gradient is the transposed linear part of WorldToIndex applied to
+    // the index space gradient
+    template <typename S>
+    void ShadeSample(S const& s, RayCastTransfer const& tf, double const w2i[12], Ray const& ray,
+                     double const p[3], float c[3])
+    {
+        double gi[3], n[3];
+        s.Gradient(p, gi);
+        for (int k = 0; k < 3; ++k)
+            n[k] = w2i[k] * gi[0] + w2i[4 + k] * gi[1] + w2i[8 + k] * gi[2];
+        double norm = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (norm == 0)
+            return;
+        auto ndl = static_cast<float>(std::abs(n[0] * ray.WorldDir[0] + n[1] * ray.WorldDir[1] + n[2] * ray.WorldDir[2]) / norm);
+        float specular = tf.Specular * std::pow(ndl, tf.SpecularPower);
+        for (int k = 0; k < 3; ++k)
+            c[k] = std::min(c[k] * (tf.Ambient + tf.Diffuse * ndl) + specular, 1.0f);
+    }
+
+    template <typename S>
+    void CastRay(S const& s, BrickMinMax const& bricks, FrameTables const& tables, RayCastTransfer const& tf,
+                 double const w2i[12], Ray const& ray, double step, float out[4])
+    {
+        bool isoSurface = tf.Blend == RayCastBlend::IsoSurface;
+        float color[3] = { 0, 0, 0 }, alpha = 0;
+        auto composite = [&](float c[3], float a, double const p[3]) {
+            if (tf.Shade)
+                ShadeSample(s, tf, w2i, ray, p, c);
+            float weight = (1 - alpha) * a;
+            for (int k = 0; k < 3; ++k)
+                color[k] += weight * c[k];
+            alpha += weight;
+        };
+
+        double tPrev = 0;
+        float vPrev = 0;
+        bool hasPrev = false;
+        for (double t = 0; t <= ray.Length && alpha <= Opaque;)
+        {
+            double p[3] = { ray.Origin[0] + t * ray.Dir[0], ray.Origin[1] + t * ray.Dir[1], ray.Origin[2] + t * ray.Dir[2] };
+            int b[3];
+            for (int a = 0; a < 3; ++a)
+                b[a] = std::min(std::max(static_cast<int>(p[a] / BrickSize), 0), bricks.Dim[a] - 1);
+            auto brick = (static_cast<size_t>(b[2]) * bricks.Dim[1] + b[1]) * bricks.Dim[0] + b[0];
+            bool visible = tables.BrickVisible[brick] != 0;
+
+            if (!isoSurface)
+            {
+                if (!visible)
+                {
+                    // jump to the first sample past the brick, keeping samples on the ray's step grid
+                    double next = std::ceil(BrickExit(ray, b) / step) * step;
+                    t = next > t ? next : t + step;
+                    continue;
+                }
+                float index = tables.Index(s.Trilinear(p));
+                int i0 = static_cast<int>(index);
+                int i1 = std::min(i0 + 1, tables.Entries - 1);
+                float f = index - i0;
+                float a = tables.Alpha[i0] + f * (tables.Alpha[i1] - tables.Alpha[i0]);
+                if (a > 0)
+                {
+                    float c[3];
+                    for (int k = 0; k < 3; ++k)
+                        c[k] = tf.Color[3 * i0 + k] + f * (tf.Color[3 * i1 + k] - tf.Color[3 * i0 + k]);
+                    composite(c, a, p);
+                }
+                t += step;
+                continue;
+            }
+
+            // iso-surface: surfaces crossed since the previous sample, nearest first.
+            // Invisible bricks are sampled as well, a surface may lie between the last sample before them and their border.
+            // All of their values are on the same side of every iso value, so a BrickedVolume stands in their minimum
+            // rather than decompressing them
+            float v = S::Dense || visible ? s.Trilinear(p) : bricks.Min[brick];
+            int isoCount = static_cast<int>(tables.IsoValues.size());
+            if (hasPrev && v != vPrev)
+            {
+                bool rising = v > vPrev;
+                for (int k = 0; k < isoCount && alpha <= Opaque; ++k)
+                {
+                    int i = rising ? k : isoCount - 1 - k;
+                    float iso = tables.IsoValues[i];
+                    if ((vPrev < iso) == (v < iso))
+                        continue;
+                    double tHit = tPrev + (iso - vPrev) / (v - vPrev) * (t - tPrev);
+                    double hit[3] = { ray.Origin[0] + tHit * ray.Dir[0], ray.Origin[1] + tHit * ray.Dir[1], ray.Origin[2] + tHit * ray.Dir[2] };
+                    float c[3] = { tables.IsoColor[3 * i], tables.IsoColor[3 * i + 1], tables.IsoColor[3 * i + 2] };
+                    composite(c, tables.IsoAlpha[i], hit);
+                }
+            }
+            tPrev = t;
+            vPrev = v;
+            hasPrev = true;
+
+            if (!visible)
+            {
+                // just past the border, so the next sample tests the rest of this brick and the head of the next one
+                t = std::max(BrickExit(ray, b), t) + 0.01 * step;
+                continue;
+            }
+            double advance = step;
+            if (tf.DistanceField && isoCount != 0)
+            {
+                float nearest = std::numeric_limits<float>::max();
+                for (float iso : tables.IsoValues)
+                    nearest = std::min(nearest, std::abs(v - iso));
+                advance = std::max(step, SphereTraceSafety * nearest);
+            }
+            t += advance;
+        }
+
+        for (int k = 0; k < 3; ++k)
+            out[k] = color[k];
+        out[3] = alpha;
+    }
+
+#if defined(IMGUIVTK_X86)
+    // rays of a 4x2 pixel packet, structure of arrays, lanes without a ray have a negative Length
+    struct alignas(32) RayPacket
+    {
+        float Origin[3][8], Dir[3][8], WorldDir[3][8];
+        float Length[8];
+    };
+
+    // trilinear pairs (x, x + 1) of 8 voxels, x < Dim[0] - 1. Narrow scalars are fetched as one 32-bit word per pair;
+    // for 8 bit the last words start up to 3 bytes early and are shifted, so no fetch reads past the voxels
+    template <typename T>
+    IMGUIVTK_TARGET("avx2")
+    void FetchPairs(T const* voxels, __m256i index, __m256i lastWord, __m256& v0, __m256& v1)
+    {
+        if constexpr (std::is_same_v<T, unsigned char>)
+        {
+            __m256i clamped = _mm256_min_epi32(index, lastWord);
+            __m256i word = _mm256_i32gather_epi32(reinterpret_cast<int const*>(voxels), clamped, 1);
+            word = _mm256_srlv_epi32(word, _mm256_slli_epi32(_mm256_sub_epi32(index, clamped), 3));
+            __m256i byte = _mm256_set1_epi32(0xff);
+            v0 = _mm256_cvtepi32_ps(_mm256_and_si256(word, byte));
+            v1 = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(word, 8), byte));
+        }
+        else if constexpr (std::is_same_v<T, unsigned short>)
+        {
+            __m256i word = _mm256_i32gather_epi32(reinterpret_cast<int const*>(voxels), index, 2);
+            v0 = _mm256_cvtepi32_ps(_mm256_and_si256(word, _mm256_set1_epi32(0xffff)));
+            v1 = _mm256_cvtepi32_ps(_mm256_srli_epi32(word, 16));
+        }
+        else
+        {
+            v0 = _mm256_i32gather_ps(voxels, index, 4);
+            v1 = _mm256_i32gather_ps(voxels, _mm256_add_epi32(index, _mm256_set1_epi32(1)), 4);
+        }
+    }
+
+    template <typename T>
+    IMGUIVTK_TARGET("avx2")
+    __m256 Trilinear8(Sampler<T> const& s, __m256 x, __m256 y, __m256 z)
+    {
+        __m256 zero = _mm256_setzero_ps();
+        __m256 cx = _mm256_min_ps(_mm256_max_ps(x, zero), _mm256_set1_ps(static_cast<float>(s.Dim[0] - 1)));
+        __m256 cy = _mm256_min_ps(_mm256_max_ps(y, zero), _mm256_set1_ps(static_cast<float>(s.Dim[1] - 1)));
+        __m256 cz = _mm256_min_ps(_mm256_max_ps(z, zero), _mm256_set1_ps(static_cast<float>(s.Dim[2] - 1)));
+        __m256i x0 = _mm256_min_epi32(_mm256_cvttps_epi32(cx), _mm256_set1_epi32(s.Dim[0] - 2));
+        __m256i y0 = _mm256_cvttps_epi32(cy), z0 = _mm256_cvttps_epi32(cz);
+        __m256i y1 = _mm256_min_epi32(_mm256_add_epi32(y0, _mm256_set1_epi32(1)), _mm256_set1_epi32(s.Dim[1] - 1));
+        __m256i z1 = _mm256_min_epi32(_mm256_add_epi32(z0, _mm256_set1_epi32(1)), _mm256_set1_epi32(s.Dim[2] - 1));
+        __m256 fx = _mm256_sub_ps(cx, _mm256_cvtepi32_ps(x0));
+        __m256 fy = _mm256_sub_ps(cy, _mm256_cvtepi32_ps(y0));
+        __m256 fz = _mm256_sub_ps(cz, _mm256_cvtepi32_ps(z0));
+
+        __m256i strideY = _mm256_set1_epi32(static_cast<int>(s.StrideY));
+        __m256i strideZ = _mm256_set1_epi32(static_cast<int>(s.StrideZ));
+        __m256i row0 = _mm256_add_epi32(x0, _mm256_mullo_epi32(y0, strideY));
+        __m256i row1 = _mm256_add_epi32(x0, _mm256_mullo_epi32(y1, strideY));
+        __m256i slice0 = _mm256_mullo_epi32(z0, strideZ), slice1 = _mm256_mullo_epi32(z1, strideZ);
+        __m256i lastWord = _mm256_set1_epi32(static_cast<int>(s.StrideZ * s.Dim[2] - 4));
+
+        __m256 v0, v1, c00, c10, c01, c11;
+        FetchPairs(s.Voxels, _mm256_add_epi32(row0, slice0), lastWord, v0, v1);
+        c00 = _mm256_add_ps(v0, _mm256_mul_ps(fx, _mm256_sub_ps(v1, v0)));
+        FetchPairs(s.Voxels, _mm256_add_epi32(row1, slice0), lastWord, v0, v1);
+        c10 = _mm256_add_ps(v0, _mm256_mul_ps(fx, _mm256_sub_ps(v1, v0)));
+        FetchPairs(s.Voxels, _mm256_add_epi32(row0, slice1), lastWord, v0, v1);
+        c01 = _mm256_add_ps(v0, _mm256_mul_ps(fx, _mm256_sub_ps(v1, v0)));
+        FetchPairs(s.Voxels, _mm256_add_epi32(row1, slice1), lastWord, v0, v1);
+        c11 = _mm256_add_ps(v0, _mm256_mul_ps(fx, _mm256_sub_ps(v1, v0)));
+        __m256 c0 = _mm256_add_ps(c00, _mm256_mul_ps(fy, _mm256_sub_ps(c10, c00)));
+        __m256 c1 = _mm256_add_ps(c01, _mm256_mul_ps(fy, _mm256_sub_ps(c11, c01)));
+        return _mm256_add_ps(c0, _mm256_mul_ps(fz, _mm256_sub_ps(c1, c0)));
+    }
+
+    // QuantizedGradients::Decode of 8 voxels, accumulated with weights into g
+    IMGUIVTK_TARGET("avx2")
+    void AccumulateGradient8(QuantizedGradients const& gradients, __m256i index, __m256 weight, __m256 g[3])
+    {
+        __m256i word = _mm256_i32gather_epi32(reinterpret_cast<int const*>(gradients.Encoded.data()), index, 4);
+        __m256i coordinate = _mm256_set1_epi32(0xfff);
+        __m256 toUnit = _mm256_set1_ps(2 / NormalScale), one = _mm256_set1_ps(1.0f), sign = _mm256_set1_ps(-0.0f);
+        __m256 x = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(word, coordinate)), toUnit), one);
+        __m256 y = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(word, 12), coordinate)), toUnit), one);
+        __m256 z = _mm256_sub_ps(_mm256_sub_ps(one, _mm256_andnot_ps(sign, x)), _mm256_andnot_ps(sign, y));
+        __m256 fold = _mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(), z), _mm256_setzero_ps());
+        x = _mm256_sub_ps(x, _mm256_or_ps(fold, _mm256_and_ps(x, sign)));
+        y = _mm256_sub_ps(y, _mm256_or_ps(fold, _mm256_and_ps(y, sign)));
+        __m256 magnitude = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(word, 24)), _mm256_set1_ps(gradients.MaxMagnitude / 255));
+        __m256 scale = _mm256_mul_ps(magnitude, weight);
+        g[0] = _mm256_add_ps(g[0], _mm256_mul_ps(scale, x));
+        g[1] = _mm256_add_ps(g[1], _mm256_mul_ps(scale, y));
+        g[2] = _mm256_add_ps(g[2], _mm256_mul_ps(scale, z));
+    }
+
+    // Sampler::Gradient from precomputed gradients for 8 lanes
+    template <typename T>
+    IMGUIVTK_TARGET("avx2")
+    void Gradient8(Sampler<T> const& s, __m256 const p[3], __m256 g[3])
+    {
+        __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+        __m256i i0[3], i1[3];
+        __m256 f[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            __m256 c = _mm256_min_ps(_mm256_max_ps(p[a], zero), _mm256_set1_ps(static_cast<float>(s.Dim[a] - 1)));
+            i0[a] = _mm256_cvttps_epi32(c);
+            i1[a] = _mm256_min_epi32(_mm256_add_epi32(i0[a], _mm256_set1_epi32(1)), _mm256_set1_epi32(s.Dim[a] - 1));
+            f[a] = _mm256_sub_ps(c, _mm256_cvtepi32_ps(i0[a]));
+        }
+        __m256i strideY = _mm256_set1_epi32(static_cast<int>(s.StrideY));
+        __m256i strideZ = _mm256_set1_epi32(static_cast<int>(s.StrideZ));
+        g[0] = g[1] = g[2] = zero;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            __m256i x = corner & 1 ? i1[0] : i0[0], y = corner & 2 ? i1[1] : i0[1], z = corner & 4 ? i1[2] : i0[2];
+            __m256 w = _mm256_mul_ps(_mm256_mul_ps(corner & 1 ? f[0] : _mm256_sub_ps(one, f[0]),
+                                                   corner & 2 ? f[1] : _mm256_sub_ps(one, f[1])),
+                                     corner & 4 ? f[2] : _mm256_sub_ps(one, f[2]));
+            __m256i index = _mm256_add_epi32(_mm256_add_epi32(x, _mm256_mullo_epi32(y, strideY)), _mm256_mullo_epi32(z, strideZ));
+            AccumulateGradient8(*s.Gradients, index, w, g);
+        }
+    }
+
+    // ShadeSample for 8 lanes, lanes outside `mask` are left alone
+    template <typename T>
+    IMGUIVTK_TARGET("avx2")
+    void Shade8(Sampler<T> const& s, RayCastTransfer const& tf, double const w2i[12], RayPacket const& rays,
+                __m256 const p[3], __m256 mask, __m256 c[3])
+    {
+        __m256 one = _mm256_set1_ps(1.0f), half = _mm256_set1_ps(0.5f);
+        __m256 g[3];
+        if (s.Gradients != nullptr)
+            Gradient8(s, p, g);
+        else
+        {
+            g[0] = _mm256_mul_ps(half, _mm256_sub_ps(Trilinear8(s, _mm256_add_ps(p[0], one), p[1], p[2]),
+                                                     Trilinear8(s, _mm256_sub_ps(p[0], one), p[1], p[2])));
+            g[1] = _mm256_mul_ps(half, _mm256_sub_ps(Trilinear8(s, p[0], _mm256_add_ps(p[1], one), p[2]),
+                                                     Trilinear8(s, p[0], _mm256_sub_ps(p[1], one), p[2])));
+            g[2] = _mm256_mul_ps(half, _mm256_sub_ps(Trilinear8(s, p[0], p[1], _mm256_add_ps(p[2], one)),
+                                                     Trilinear8(s, p[0], p[1], _mm256_sub_ps(p[2], one))));
+        }
+        __m256 dot = _mm256_setzero_ps(), norm2 = _mm256_setzero_ps();
+        for (int k = 0; k < 3; ++k)
+        {
+            __m256 n = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(static_cast<float>(w2i[k])), g[0]),
+                                                   _mm256_mul_ps(_mm256_set1_ps(static_cast<float>(w2i[4 + k])), g[1])),
+                                     _mm256_mul_ps(_mm256_set1_ps(static_cast<float>(w2i[8 + k])), g[2]));
+            dot = _mm256_add_ps(dot, _mm256_mul_ps(n, _mm256_load_ps(rays.WorldDir[k])));
+            norm2 = _mm256_add_ps(norm2, _mm256_mul_ps(n, n));
+        }
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(norm2, _mm256_setzero_ps(), _CMP_GT_OQ));
+        __m256 absDot = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), dot);
+        __m256 ndl = _mm256_div_ps(absDot, _mm256_sqrt_ps(_mm256_max_ps(norm2, _mm256_set1_ps(1e-30f))));
+
+        // no vector pow, the specular term is taken per lane
+        alignas(32) float ndlLanes[8], specular[8];
+        _mm256_store_ps(ndlLanes, ndl);
+        for (int l = 0; l < 8; ++l)
+            specular[l] = tf.Specular > 0 ? tf.Specular * std::pow(ndlLanes[l], tf.SpecularPower) : 0.0f;
+        __m256 light = _mm256_add_ps(_mm256_set1_ps(tf.Ambient), _mm256_mul_ps(_mm256_set1_ps(tf.Diffuse), ndl));
+        __m256 spec = _mm256_load_ps(specular);
+        for (int k = 0; k < 3; ++k)
+        {
+            __m256 shaded = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(c[k], light), spec), one);
+            c[k] = _mm256_blendv_ps(c[k], shaded, mask);
+        }
+    }
+
+    IMGUIVTK_TARGET("avx2")
+    void Composite8(__m256 color[3], __m256& alpha, __m256 const c[3], __m256 a, __m256 mask)
+    {
+        __m256 weight = _mm256_and_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), alpha), a), mask);
+        for (int k = 0; k < 3; ++k)
+            color[k] = _mm256_add_ps(color[k], _mm256_mul_ps(weight, c[k]));
+        alpha = _mm256_add_ps(alpha, weight);
+    }
+
+    // BrickExit for 8 lanes
+    IMGUIVTK_TARGET("avx2")
+    __m256 BrickExit8(RayPacket const& rays, __m256i const b[3], __m256 length)
+    {
+        __m256 exit = length;
+        __m256 brick = _mm256_set1_ps(static_cast<float>(BrickSize));
+        __m256 inf = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+        for (int a = 0; a < 3; ++a)
+        {
+            __m256 d = _mm256_load_ps(rays.Dir[a]);
+            __m256 lo = _mm256_mul_ps(_mm256_cvtepi32_ps(b[a]), brick);
+            __m256 bound = _mm256_blendv_ps(lo, _mm256_add_ps(lo, brick), _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GT_OQ));
+            __m256 te = _mm256_div_ps(_mm256_sub_ps(bound, _mm256_load_ps(rays.Origin[a])), d);
+            exit = _mm256_min_ps(exit, _mm256_blendv_ps(te, inf, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_EQ_OQ)));
+        }
+        return exit;
+    }
+
+    // CastRay for a packet of 8 rays. They step in lockstep, but every lane keeps its own t, so lanes in skipped bricks
+    // jump ahead on their own and finished lanes are masked out until the whole packet is done
+    template <typename T>
+    IMGUIVTK_TARGET("avx2")
+    void CastPacketAVX2(Sampler<T> const& s, BrickMinMax const& bricks, FrameTables const& tables, RayCastTransfer const& tf,
+                        double const w2i[12], RayPacket const& rays, float step, float out[4][8])
+    {
+        bool isoSurface = tf.Blend == RayCastBlend::IsoSurface;
+        __m256 zero = _mm256_setzero_ps();
+        __m256 stepV = _mm256_set1_ps(step);
+        __m256 opaque = _mm256_set1_ps(Opaque);
+        __m256 length = _mm256_load_ps(rays.Length);
+        __m256 invBrick = _mm256_set1_ps(1.0f / BrickSize);
+        __m256i brickMax[3] = { _mm256_set1_epi32(bricks.Dim[0] - 1), _mm256_set1_epi32(bricks.Dim[1] - 1), _mm256_set1_epi32(bricks.Dim[2] - 1) };
+        __m256i brickStrideY = _mm256_set1_epi32(bricks.Dim[0]);
+        __m256i brickStrideZ = _mm256_set1_epi32(bricks.Dim[0] * bricks.Dim[1]);
+        __m256 entryMax = _mm256_set1_ps(static_cast<float>(tables.Entries - 1));
+        int isoCount = static_cast<int>(tables.IsoValues.size());
+
+        __m256 color[3] = { zero, zero, zero }, alpha = zero;
+        __m256 t = zero;
+        __m256 active = _mm256_cmp_ps(t, length, _CMP_LE_OQ);
+        __m256 tPrev = zero, vPrev = zero, hasPrev = zero;
+
+        while (_mm256_movemask_ps(active) != 0)
+        {
+            __m256 p[3];
+            __m256i b[3];
+            for (int a = 0; a < 3; ++a)
+            {
+                p[a] = _mm256_add_ps(_mm256_load_ps(rays.Origin[a]), _mm256_mul_ps(t, _mm256_load_ps(rays.Dir[a])));
+                b[a] = _mm256_cvttps_epi32(_mm256_mul_ps(p[a], invBrick));
+                b[a] = _mm256_min_epi32(_mm256_max_epi32(b[a], _mm256_setzero_si256()), brickMax[a]);
+            }
+            __m256i brickId = _mm256_add_epi32(_mm256_add_epi32(b[0], _mm256_mullo_epi32(b[1], brickStrideY)),
+                                               _mm256_mullo_epi32(b[2], brickStrideZ));
+            __m256i visibleBits = _mm256_i32gather_epi32(tables.BrickVisible.data(), brickId, 4);
+            __m256 invisible = _mm256_castsi256_ps(_mm256_cmpeq_epi32(visibleBits, _mm256_setzero_si256()));
+            __m256 visible = _mm256_andnot_ps(invisible, active);
+            invisible = _mm256_and_ps(invisible, active);
+
+            __m256 next = _mm256_add_ps(t, stepV);
+            if (!isoSurface)
+            {
+                if (_mm256_movemask_ps(visible) != 0)
+                {
+                    __m256 v = Trilinear8(s, p[0], p[1], p[2]);
+                    __m256 index = _mm256_mul_ps(_mm256_sub_ps(v, _mm256_set1_ps(static_cast<float>(tables.Offset))),
+                                                 _mm256_set1_ps(static_cast<float>(tables.Scale)));
+                    index = _mm256_min_ps(_mm256_max_ps(index, zero), entryMax);
+                    __m256i i0 = _mm256_cvttps_epi32(index);
+                    __m256i i1 = _mm256_min_epi32(_mm256_add_epi32(i0, _mm256_set1_epi32(1)), _mm256_set1_epi32(tables.Entries - 1));
+                    __m256 f = _mm256_sub_ps(index, _mm256_cvtepi32_ps(i0));
+                    __m256 a0 = _mm256_i32gather_ps(tables.Alpha.data(), i0, 4);
+                    __m256 a1 = _mm256_i32gather_ps(tables.Alpha.data(), i1, 4);
+                    __m256 a = _mm256_add_ps(a0, _mm256_mul_ps(f, _mm256_sub_ps(a1, a0)));
+                    __m256 contributes = _mm256_and_ps(visible, _mm256_cmp_ps(a, zero, _CMP_GT_OQ));
+                    if (_mm256_movemask_ps(contributes) != 0)
+                    {
+                        __m256 c[3];
+                        __m256i e0 = _mm256_mullo_epi32(i0, _mm256_set1_epi32(3)), e1 = _mm256_mullo_epi32(i1, _mm256_set1_epi32(3));
+                        for (int k = 0; k < 3; ++k)
+                        {
+                            __m256i offset = _mm256_set1_epi32(k);
+                            __m256 lo = _mm256_i32gather_ps(tf.Color.data(), _mm256_add_epi32(e0, offset), 4);
+                            __m256 hi = _mm256_i32gather_ps(tf.Color.data(), _mm256_add_epi32(e1, offset), 4);
+                            c[k] = _mm256_add_ps(lo, _mm256_mul_ps(f, _mm256_sub_ps(hi, lo)));
+                        }
+                        if (tf.Shade)
+                            Shade8(s, tf, w2i, rays, p, contributes, c);
+                        Composite8(color, alpha, c, a, contributes);
+                    }
+                }
+                if (_mm256_movemask_ps(invisible) != 0)
+                {
+                    // first sample past the brick on the ray's step grid
+                    __m256 exit = BrickExit8(rays, b, length);
+                    __m256 jump = _mm256_mul_ps(_mm256_ceil_ps(_mm256_div_ps(exit, stepV)), stepV);
+                    jump = _mm256_blendv_ps(next, jump, _mm256_cmp_ps(jump, t, _CMP_GT_OQ));
+                    next = _mm256_blendv_ps(next, jump, invisible);
+                }
+            }
+            else
+            {
+                __m256 v = Trilinear8(s, p[0], p[1], p[2]);
+                __m256 rising = _mm256_cmp_ps(v, vPrev, _CMP_GT_OQ);
+                __m256 crossing = _mm256_and_ps(_mm256_and_ps(active, hasPrev), _mm256_cmp_ps(v, vPrev, _CMP_NEQ_OQ));
+                for (int k = 0; k < isoCount && _mm256_movemask_ps(crossing) != 0; ++k)
+                {
+                    // surfaces in the order the ray meets them: ascending values when rising, descending when falling
+                    int up = k, down = isoCount - 1 - k;
+                    __m256 iso = _mm256_blendv_ps(_mm256_set1_ps(tables.IsoValues[down]), _mm256_set1_ps(tables.IsoValues[up]), rising);
+                    __m256 hit = _mm256_xor_ps(_mm256_cmp_ps(vPrev, iso, _CMP_LT_OQ), _mm256_cmp_ps(v, iso, _CMP_LT_OQ));
+                    hit = _mm256_and_ps(_mm256_and_ps(hit, crossing), _mm256_cmp_ps(alpha, opaque, _CMP_LE_OQ));
+                    if (_mm256_movemask_ps(hit) == 0)
+                        continue;
+                    __m256 u = _mm256_div_ps(_mm256_sub_ps(iso, vPrev), _mm256_sub_ps(v, vPrev));
+                    __m256 tHit = _mm256_blendv_ps(t, _mm256_add_ps(tPrev, _mm256_mul_ps(u, _mm256_sub_ps(t, tPrev))), hit);
+                    __m256 q[3], c[3];
+                    for (int a = 0; a < 3; ++a)
+                        q[a] = _mm256_add_ps(_mm256_load_ps(rays.Origin[a]), _mm256_mul_ps(tHit, _mm256_load_ps(rays.Dir[a])));
+                    for (int j = 0; j < 3; ++j)
+                        c[j] = _mm256_blendv_ps(_mm256_set1_ps(tables.IsoColor[3 * down + j]), _mm256_set1_ps(tables.IsoColor[3 * up + j]), rising);
+                    __m256 a = _mm256_blendv_ps(_mm256_set1_ps(tables.IsoAlpha[down]), _mm256_set1_ps(tables.IsoAlpha[up]), rising);
+                    if (tf.Shade)
+                        Shade8(s, tf, w2i, rays, q, hit, c);
+                    Composite8(color, alpha, c, a, hit);
+                }
+                tPrev = _mm256_blendv_ps(tPrev, t, active);
+                vPrev = _mm256_blendv_ps(vPrev, v, active);
+                hasPrev = _mm256_or_ps(hasPrev, active);
+
+                if (tf.DistanceField && isoCount != 0)
+                {
+                    __m256 nearest = _mm256_set1_ps(std::numeric_limits<float>::max());
+                    for (float isoValue : tables.IsoValues)
+                        nearest = _mm256_min_ps(nearest, _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _mm256_sub_ps(v, _mm256_set1_ps(isoValue))));
+                    __m256 advance = _mm256_max_ps(stepV, _mm256_mul_ps(nearest, _mm256_set1_ps(static_cast<float>(SphereTraceSafety))));
+                    next = _mm256_add_ps(t, advance);
+                }
+                if (_mm256_movemask_ps(invisible) != 0)
+                {
+                    // just past the border, so the next sample tests the rest of this brick and the head of the next one
+                    __m256 exit = _mm256_max_ps(BrickExit8(rays, b, length), t);
+                    next = _mm256_blendv_ps(next, _mm256_add_ps(exit, _mm256_set1_ps(0.01f * step)), invisible);
+                }
+            }
+
+            t = _mm256_blendv_ps(t, next, active);
+            active = _mm256_and_ps(active, _mm256_cmp_ps(t, length, _CMP_LE_OQ));
+            active = _mm256_and_ps(active, _mm256_cmp_ps(alpha, opaque, _CMP_LE_OQ));
+        }
+
+        for (int k = 0; k < 3; ++k)
+            _mm256_store_ps(out[k], color[k]);
+        _mm256_store_ps(out[3], alpha);
+    }
+#endif
+
+    void StorePixel(float const rgba[4], unsigned char* out)
+    {
+        for (int k = 0; k < 4; ++k)
+            out[k] = static_cast<unsigned char>(std::min(rgba[k], 1.0f) * 255 + 0.5f);
+    }
+
+    template <typename S>
+    void RenderVolume(S const& s, BrickMinMax const& bricks, SimdLevel level, RayCastView const& view,
+                      RayCastTransfer const& tf, unsigned char* rgba)
+    {
+        int entries = static_cast<int>(tf.Opacity.size());
+        if (entries == 0 || static_cast<int>(tf.Color.size()) < 3 * entries)
+            return;
+        FrameTables tables = PrepareTables(bricks, view, tf);
+        double const* w2i = view.WorldToIndex;
+        double step = view.SampleDistance;
+
+        // packets index voxels and table entries with 32-bit gathers and fetch x pairs, from dense voxels only
+        auto voxelCount = static_cast<std::int64_t>(s.Dim[0]) * s.Dim[1] * s.Dim[2];
+        bool packets = S::Dense && level >= SimdLevel::AVX2 && s.Dim[0] >= 2 && voxelCount >= 4
+                    && voxelCount <= std::numeric_limits<int>::max() && 3 * static_cast<std::int64_t>(entries) <= std::numeric_limits<int>::max();
+#if !defined(IMGUIVTK_X86)
+        packets = false;
+#endif
+
+        int tilesX = (view.ImageSize[0] + TileSize - 1) / TileSize;
+        int tilesY = (view.ImageSize[1] + TileSize - 1) / TileSize;
+        WorkStealingFor(static_cast<std::int64_t>(tilesX) * tilesY, [&](std::int64_t tile) {
+            int x0 = static_cast<int>(tile % tilesX) * TileSize, y0 = static_cast<int>(tile / tilesX) * TileSize;
+            int x1 = std::min(x0 + TileSize, view.ImageSize[0]), y1 = std::min(y0 + TileSize, view.ImageSize[1]);
+            Ray ray;
+            float pixel[4];
+
+            if (!packets)
+            {
+                for (int py = y0; py < y1; ++py)
+                {
+                    unsigned char* out = rgba + 4 * (static_cast<std::int64_t>(py) * view.ImageStride + x0);
+                    for (int px = x0; px < x1; ++px, out += 4)
+                    {
+                        out[0] = out[1] = out[2] = out[3] = 0;
+                        if (!SetupRay(view, s.Dim, px, py, ray))
+                            continue;
+                        CastRay(s, bricks, tables, tf, w2i, ray, step, pixel);
+                        StorePixel(pixel, out);
+                    }
+                }
+                return;
+            }
+
+#if defined(IMGUIVTK_X86)
+            if constexpr (S::Dense)
+            {
+                RayPacket rays;
+                alignas(32) float result[4][8];
+                for (int py = y0; py < y1; py += 2)
+                {
+                    for (int px = x0; px < x1; px += 4)
+                    {
+                        bool any = false;
+                        for (int l = 0; l < 8; ++l)
+                        {
+                            int x = px + l % 4, y = py + l / 4;
+                            // unused lanes still sample, at the first voxel
+                            rays.Length[l] = -1;
+                            for (int a = 0; a < 3; ++a)
+                                rays.Origin[a][l] = rays.Dir[a][l] = rays.WorldDir[a][l] = 0;
+                            if (x >= x1 || y >= y1)
+                                continue;
+                            std::fill_n(rgba + 4 * (static_cast<std::int64_t>(y) * view.ImageStride + x), 4, static_cast<unsigned char>(0));
+                            if (!SetupRay(view, s.Dim, x, y, ray))
+                                continue;
+                            for (int a = 0; a < 3; ++a)
+                            {
+                                rays.Origin[a][l] = static_cast<float>(ray.Origin[a]);
+                                rays.Dir[a][l] = static_cast<float>(ray.Dir[a]);
+                                rays.WorldDir[a][l] = static_cast<float>(ray.WorldDir[a]);
+                            }
+                            rays.Length[l] = static_cast<float>(ray.Length);
+                            any = true;
+                        }
+                        if (!any)
+                            continue;
+
+                        CastPacketAVX2(s, bricks, tables, tf, w2i, rays, static_cast<float>(step), result);
+                        for (int l = 0; l < 8; ++l)
+                        {
+                            if (rays.Length[l] < 0)
+                                continue;
+                            float lane[4] = { result[0][l], result[1][l], result[2][l], result[3][l] };
+                            StorePixel(lane, rgba + 4 * (static_cast<std::int64_t>(py + l / 4) * view.ImageStride + px + l % 4));
+                        }
+                    }
+                }
+            }
+#endif
+        });
+    }
+}
+
+void BrickMinMax::Build(void const* voxels, RayCastScalar scalar, int const dim[3])
+{
+    for (int a = 0; a < 3; ++a)
+        Dim[a] = std::max((dim[a] - 1 + BrickSize - 1) / BrickSize, 1);
+    auto count = static_cast<size_t>(Dim[0]) * Dim[1] * Dim[2];
+    Min.assign(count, 0.0f);
+    Max.assign(count, 0.0f);
+
+    switch (scalar) {
+    case RayCastScalar::UnsignedShort: BuildBricks(Sampler<unsigned short>(voxels, dim), *this); break;
+    case RayCastScalar::Float: BuildBricks(Sampler<float>(voxels, dim), *this); break;
+    default: BuildBricks(Sampler<unsigned char>(voxels, dim), *this); break;
+    }
+}
+
+void BrickMinMax::Build(BrickedVolume const& volume)
+{
+    int const* dim = volume.GetDimensions();
+    int const* stored = volume.GetBrickDimensions();
+    for (int a = 0; a < 3; ++a)
+        Dim[a] = std::max((dim[a] - 1 + BrickSize - 1) / BrickSize, 1);
+    auto count = static_cast<size_t>(Dim[0]) * Dim[1] * Dim[2];
+    Min.assign(count, 0.0f);
+    Max.assign(count, 0.0f);
+
+    constexpr int Side = BrickedVolume::BrickSize;
+    for (int bz = 0; bz < Dim[2]; ++bz)
+        for (int by = 0; by < Dim[1]; ++by)
+            for (int bx = 0; bx < Dim[0]; ++bx)
+            {
+                // voxels [b * BrickSize, (b + 1) * BrickSize] like BuildBricks, in one or two compressed bricks per axis
+                int b[3] = { bx, by, bz }, first[3], last[3];
+                for (int a = 0; a < 3; ++a)
+                {
+                    first[a] = b[a] * BrickSize / Side;
+                    last[a] = std::min(std::min(b[a] * BrickSize + BrickSize, dim[a] - 1) / Side, stored[a] - 1);
+                }
+                float vmin = std::numeric_limits<float>::max(), vmax = std::numeric_limits<float>::lowest();
+                for (int z = first[2]; z <= last[2]; ++z)
+                    for (int y = first[1]; y <= last[1]; ++y)
+                        for (int x = first[0]; x <= last[0]; ++x)
+                        {
+                            float range[2];
+                            volume.GetBrickRange((static_cast<size_t>(z) * stored[1] + y) * stored[0] + x, range);
+                            vmin = std::min(vmin, range[0]);
+                            vmax = std::max(vmax, range[1]);
+                        }
+                auto id = (static_cast<size_t>(bz) * Dim[1] + by) * Dim[0] + bx;
+                Min[id] = vmin;
+                Max[id] = vmax;
+            }
+}
+
+void QuantizedGradients::Build(void const* voxels, RayCastScalar scalar, int const dim[3])
+{
+    std::copy(dim, dim + 3, Dim);
+    Encoded.resize(static_cast<size_t>(dim[0]) * dim[1] * dim[2]);
+    MaxMagnitude = 0;
+    if (Encoded.empty())
+        return;
+
+    switch (scalar) {
+    case RayCastScalar::UnsignedShort: BuildGradients(Sampler<unsigned short>(voxels, dim), *this); break;
+    case RayCastScalar::Float: BuildGradients(Sampler<float>(voxels, dim), *this); break;
+    default: BuildGradients(Sampler<unsigned char>(voxels, dim), *this); break;
+    }
+}
+
+void QuantizedGradients::Decode(std::int64_t voxel, float g[3]) const
+{
+    std::uint32_t word = Encoded[static_cast<size_t>(voxel)];
+    float x = (word & 0xfff) * (2 / NormalScale) - 1;
+    float y = (word >> 12 & 0xfff) * (2 / NormalScale) - 1;
+    float z = 1 - std::abs(x) - std::abs(y);
+    float fold = std::max(-z, 0.0f);
+    x -= std::copysign(fold, x);
+    y -= std::copysign(fold, y);
+    float scale = (word >> 24) * (MaxMagnitude / 255);
+    g[0] = scale * x;
+    g[1] = scale * y;
+    g[2] = scale * z;
+}
+
+void VolumeRayCaster::SetVolume(void const* voxels, RayCastScalar scalar, int const dim[3])
+{
+    Bricked = nullptr;
+    Voxels = voxels;
+    Scalar = scalar;
+    std::copy(dim, dim + 3, Dim);
+    Bricks.Build(voxels, scalar, dim);
+}
+
+void VolumeRayCaster::SetVolume(std::shared_ptr<BrickedVolume const> volume)
+{
+    Voxels = nullptr;
+    Bricked = nullptr;
+    if (volume == nullptr)
+        return;
+    Scalar = volume->GetScalar();
+    std::copy_n(volume->GetDimensions(), 3, Dim);
+    Bricks.Build(*volume);
+    Bricked = std::make_shared<BrickCache>(std::move(volume));
+}
+
+int VolumeRayCaster::GetDecompressedBricks() const
+{
+    return Bricked != nullptr ? Bricked->DecompressedBricks.load() : 0;
+}
+
+std::size_t VolumeRayCaster::GetDecompressedBrickBytes() const
+{
+    return Bricked != nullptr ? Bricked->DecompressedBytes.load() : 0;
+}
+
+void VolumeRayCaster::Render(RayCastView const& view, RayCastTransfer const& transfer, unsigned char* rgba) const
+{
+    if (Bricked != nullptr && view.SampleDistance > 0)
+    {
+        switch (Scalar) {
+        case RayCastScalar::UnsignedShort: RenderVolume(BrickedSampler<unsigned short>(*Bricked), Bricks, Level, view, transfer, rgba); break;
+        case RayCastScalar::Float: RenderVolume(BrickedSampler<float>(*Bricked), Bricks, Level, view, transfer, rgba); break;
+        default: RenderVolume(BrickedSampler<unsigned char>(*Bricked), Bricks, Level, view, transfer, rgba); break;
+        }
+        return;
+    }
+    if (Voxels == nullptr || view.SampleDistance <= 0)
+        return;
+    QuantizedGradients const* gradients = Gradients.get();
+    if (gradients != nullptr && !std::equal(Dim, Dim + 3, gradients->Dim))
+        gradients = nullptr;
+    switch (Scalar) {
+    case RayCastScalar::UnsignedShort: RenderVolume(Sampler<unsigned short>(Voxels, Dim, gradients), Bricks, Level, view, transfer, rgba); break;
+    case RayCastScalar::Float: RenderVolume(Sampler<float>(Voxels, Dim, gradients), Bricks, Level, view, transfer, rgba); break;
+    default: RenderVolume(Sampler<unsigned char>(Voxels, Dim, gradients), Bricks, Level, view, transfer, rgba); break;
+    }
+}
\ No newline at end of file
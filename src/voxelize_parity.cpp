@@ -0,0 +1,340 @@
+#include "voxelize_parity.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+#if defined(IMGUIVTK_X86)
+#include <immintrin.h>
+#endif
+
+// edge functions of one triangle along one row: w_k(px) = A[k] * px + C[k], a column is inside when every
+// w_k > T[k], T encodes the top-left fill rule so a column on a shared edge belongs to exactly one triangle
+struct ParityVoxelizer::RowSetup
+{
+    double A[3], C[3], T[3];
+    double ZC[3];  // z of the vertex opposite to edge k
+    double InvArea;
+};
+
+namespace {
+    constexpr std::int64_t SubVoxel = 256;  // xy snapping resolution
+
+    std::int64_t FloorDiv(std::int64_t a, std::int64_t b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+    std::int64_t CeilDiv(std::int64_t a, std::int64_t b) { return -FloorDiv(-a, b); }
+
+    using Crossing = ParityVoxelizer::Crossing;
+    using RowSetup = ParityVoxelizer::RowSetup;
+    using RowKernel = ParityVoxelizer::RowKernel;
+
+    void RowKernelScalar(RowSetup const& s, int ilo, int ihi, std::vector<Crossing>& out)
+    {
+        for (int i = ilo; i <= ihi; ++i)
+        {
+            double px = static_cast<double>(i) * SubVoxel;
+            double w0 = s.A[0] * px + s.C[0];
+            double w1 = s.A[1] * px + s.C[1];
+            double w2 = s.A[2] * px + s.C[2];
+            if (w0 > s.T[0] && w1 > s.T[1] && w2 > s.T[2])
+                out.push_back({ i, static_cast<float>((w0 * s.ZC[0] + w1 * s.ZC[1] + w2 * s.ZC[2]) * s.InvArea) });
+        }
+    }
+
+#if defined(IMGUIVTK_X86)
+    template <int Lanes>
+    void EmitCrossings(int i, int ihi, int mask, double const* z, std::vector<Crossing>& out)
+    {
+        int valid = std::min(Lanes, ihi - i + 1);
+        for (int l = 0; l < valid; ++l)
+            if (mask & (1 << l))
+                out.push_back({ i + l, static_cast<float>(z[l]) });
+    }
+
+    IMGUIVTK_TARGET("sse2")
+    void RowKernelSSE2(RowSetup const& s, int ilo, int ihi, std::vector<Crossing>& out)
+    {
+        __m128d lane = _mm_set_pd(1.0 * SubVoxel, 0.0);
+        __m128d a0 = _mm_set1_pd(s.A[0]), a1 = _mm_set1_pd(s.A[1]), a2 = _mm_set1_pd(s.A[2]);
+        __m128d c0 = _mm_set1_pd(s.C[0]), c1 = _mm_set1_pd(s.C[1]), c2 = _mm_set1_pd(s.C[2]);
+        __m128d t0 = _mm_set1_pd(s.T[0]), t1 = _mm_set1_pd(s.T[1]), t2 = _mm_set1_pd(s.T[2]);
+        __m128d z0 = _mm_set1_pd(s.ZC[0]), z1 = _mm_set1_pd(s.ZC[1]), z2 = _mm_set1_pd(s.ZC[2]);
+        __m128d invArea = _mm_set1_pd(s.InvArea);
+        alignas(16) double z[2];
+        for (int i = ilo; i <= ihi; i += 2)
+        {
+            __m128d px = _mm_add_pd(_mm_set1_pd(static_cast<double>(i) * SubVoxel), lane);
+            __m128d w0 = _mm_add_pd(_mm_mul_pd(a0, px), c0);
+            __m128d w1 = _mm_add_pd(_mm_mul_pd(a1, px), c1);
+            __m128d w2 = _mm_add_pd(_mm_mul_pd(a2, px), c2);
+            __m128d inside = _mm_and_pd(_mm_and_pd(_mm_cmpgt_pd(w0, t0), _mm_cmpgt_pd(w1, t1)), _mm_cmpgt_pd(w2, t2));
+            int mask = _mm_movemask_pd(inside);
+            if (mask == 0)
+                continue;
+            __m128d zs = _mm_add_pd(_mm_add_pd(_mm_mul_pd(w0, z0), _mm_mul_pd(w1, z1)), _mm_mul_pd(w2, z2));
+            _mm_store_pd(z, _mm_mul_pd(zs, invArea));
+            EmitCrossings<2>(i, ihi, mask, z, out);
+        }
+    }
+
+    IMGUIVTK_TARGET("avx2")
+    void RowKernelAVX2(RowSetup const& s, int ilo, int ihi, std::vector<Crossing>& out)
+    {
+        __m256d lane = _mm256_set_pd(3.0 * SubVoxel, 2.0 * SubVoxel, 1.0 * SubVoxel, 0.0);
+        __m256d a0 = _mm256_set1_pd(s.A[0]), a1 = _mm256_set1_pd(s.A[1]), a2 = _mm256_set1_pd(s.A[2]);
+        __m256d c0 = _mm256_set1_pd(s.C[0]), c1 = _mm256_set1_pd(s.C[1]), c2 = _mm256_set1_pd(s.C[2]);
+        __m256d t0 = _mm256_set1_pd(s.T[0]), t1 = _mm256_set1_pd(s.T[1]), t2 = _mm256_set1_pd(s.T[2]);
+        __m256d z0 = _mm256_set1_pd(s.ZC[0]), z1 = _mm256_set1_pd(s.ZC[1]), z2 = _mm256_set1_pd(s.ZC[2]);
+        __m256d invArea = _mm256_set1_pd(s.InvArea);
+        alignas(32) double z[4];
+        for (int i = ilo; i <= ihi; i += 4)
+        {
+            __m256d px = _mm256_add_pd(_mm256_set1_pd(static_cast<double>(i) * SubVoxel), lane);
+            __m256d w0 = _mm256_add_pd(_mm256_mul_pd(a0, px), c0);
+            __m256d w1 = _mm256_add_pd(_mm256_mul_pd(a1, px), c1);
+            __m256d w2 = _mm256_add_pd(_mm256_mul_pd(a2, px), c2);
+            __m256d inside = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(w0, t0, _CMP_GT_OQ),
+                                                         _mm256_cmp_pd(w1, t1, _CMP_GT_OQ)),
+                                           _mm256_cmp_pd(w2, t2, _CMP_GT_OQ));
+            int mask = _mm256_movemask_pd(inside);
+            if (mask == 0)
+                continue;
+            __m256d zs = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(w0, z0), _mm256_mul_pd(w1, z1)), _mm256_mul_pd(w2, z2));
+            _mm256_store_pd(z, _mm256_mul_pd(zs, invArea));
+            EmitCrossings<4>(i, ihi, mask, z, out);
+        }
+    }
+
+    IMGUIVTK_TARGET("avx512f")
+    void RowKernelAVX512(RowSetup const& s, int ilo, int ihi, std::vector<Crossing>& out)
+    {
+        __m512d lane = _mm512_set_pd(7.0 * SubVoxel, 6.0 * SubVoxel, 5.0 * SubVoxel, 4.0 * SubVoxel,
+                                     3.0 * SubVoxel, 2.0 * SubVoxel, 1.0 * SubVoxel, 0.0);
+        __m512d a0 = _mm512_set1_pd(s.A[0]), a1 = _mm512_set1_pd(s.A[1]), a2 = _mm512_set1_pd(s.A[2]);
+        __m512d c0 = _mm512_set1_pd(s.C[0]), c1 = _mm512_set1_pd(s.C[1]), c2 = _mm512_set1_pd(s.C[2]);
+        __m512d t0 = _mm512_set1_pd(s.T[0]), t1 = _mm512_set1_pd(s.T[1]), t2 = _mm512_set1_pd(s.T[2]);
+        __m512d z0 = _mm512_set1_pd(s.ZC[0]), z1 = _mm512_set1_pd(s.ZC[1]), z2 = _mm512_set1_pd(s.ZC[2]);
+        __m512d invArea = _mm512_set1_pd(s.InvArea);
+        alignas(64) double z[8];
+        for (int i = ilo; i <= ihi; i += 8)
+        {
+            __m512d px = _mm512_add_pd(_mm512_set1_pd(static_cast<double>(i) * SubVoxel), lane);
+            __m512d w0 = _mm512_add_pd(_mm512_mul_pd(a0, px), c0);
+            __m512d w1 = _mm512_add_pd(_mm512_mul_pd(a1, px), c1);
+            __m512d w2 = _mm512_add_pd(_mm512_mul_pd(a2, px), c2);
+            __mmask8 inside = _mm512_cmp_pd_mask(w0, t0, _CMP_GT_OQ)
+                            & _mm512_cmp_pd_mask(w1, t1, _CMP_GT_OQ)
+                            & _mm512_cmp_pd_mask(w2, t2, _CMP_GT_OQ);
+            if (inside == 0)
+                continue;
+            __m512d zs = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(w0, z0), _mm512_mul_pd(w1, z1)), _mm512_mul_pd(w2, z2));
+            _mm512_store_pd(z, _mm512_mul_pd(zs, invArea));
+            EmitCrossings<8>(i, ihi, static_cast<int>(inside), z, out);
+        }
+    }
+#endif
+
+    RowKernel GetRowKernel(SimdLevel level)
+    {
+#if defined(IMGUIVTK_X86)
+        switch (level) {
+        case SimdLevel::AVX512: return RowKernelAVX512;
+        case SimdLevel::AVX2: return RowKernelAVX2;
+        case SimdLevel::SSE2: return RowKernelSSE2;
+        default: break;
+        }
+#endif
+        return RowKernelScalar;
+    }
+
+    // top-left rule for a counter-clockwise triangle (y up): left edges go down, top edges go left
+    bool IsTopLeft(std::int64_t dx, std::int64_t dy) { return dy < 0 || (dy == 0 && dx < 0); }
+}
+
+ParityVoxelizer::ParityVoxelizer(std::vector<double> const& points,
+                                 std::vector<int> const& triangles,
+                                 int const dim[3], double const origin[3], double const spacing[3],
+                                 SimdLevel level,
+                                 int subsamples)
+    : Dim{ dim[0], dim[1], dim[2] }, Subsamples(std::max(subsamples, 1)), Level(level)
+{
+    // rays of the subsampled grid are spread evenly inside every voxel footprint
+    RayDim[0] = Dim[0] * Subsamples;
+    RayDim[1] = Dim[1] * Subsamples;
+    double rayOrigin[2], raySpacing[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        raySpacing[i] = spacing[i] / Subsamples;
+        rayOrigin[i] = origin[i] - spacing[i] / 2 + raySpacing[i] / 2;
+    }
+
+    RowBins.resize(static_cast<size_t>(std::max(RayDim[1], 0)));
+    Triangles.reserve(triangles.size() / 3);
+
+    for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+    {
+        Triangle tri;
+        for (int k = 0; k < 3; ++k)
+        {
+            double const* p = &points[3 * static_cast<size_t>(triangles[t + k])];
+            tri.X[k] = std::llround((p[0] - rayOrigin[0]) / raySpacing[0] * SubVoxel);
+            tri.Y[k] = std::llround((p[1] - rayOrigin[1]) / raySpacing[1] * SubVoxel);
+            tri.Z[k] = (p[2] - origin[2]) / spacing[2];
+        }
+
+        // parallel to the rays: never crossed, its neighbours carry the parity
+        std::int64_t area = (tri.X[1] - tri.X[0]) * (tri.Y[2] - tri.Y[0]) - (tri.Y[1] - tri.Y[0]) * (tri.X[2] - tri.X[0]);
+        if (area == 0)
+            continue;
+        if (area < 0)
+        {
+            std::swap(tri.X[1], tri.X[2]);
+            std::swap(tri.Y[1], tri.Y[2]);
+            std::swap(tri.Z[1], tri.Z[2]);
+        }
+
+        auto ymin = std::min({ tri.Y[0], tri.Y[1], tri.Y[2] });
+        auto ymax = std::max({ tri.Y[0], tri.Y[1], tri.Y[2] });
+        auto jlo = std::max<std::int64_t>(CeilDiv(ymin, SubVoxel), 0);
+        auto jhi = std::min<std::int64_t>(FloorDiv(ymax, SubVoxel), RayDim[1] - 1);
+        if (jlo > jhi)
+            continue;
+
+        auto id = static_cast<std::uint32_t>(Triangles.size());
+        Triangles.push_back(tri);
+        for (auto j = jlo; j <= jhi; ++j)
+            RowBins[static_cast<size_t>(j)].push_back(id);
+    }
+}
+
+void ParityVoxelizer::GatherRowCrossings(std::int64_t j, RowKernel kernel, std::vector<Crossing>& crossings) const
+{
+    crossings.clear();
+    std::int64_t py = j * SubVoxel;
+    for (auto id : RowBins[static_cast<size_t>(j)])
+    {
+        auto const& tri = Triangles[id];
+
+        RowSetup s;
+        double xmin = 1e300, xmax = -1e300;
+        for (int k = 0; k < 3; ++k)
+        {
+            int n = (k + 1) % 3;
+            std::int64_t dx = tri.X[n] - tri.X[k], dy = tri.Y[n] - tri.Y[k];
+            // w_k = dx * (py - Y[k]) - dy * (px - X[k]), exact in double for |coordinates| < 2^26
+            s.A[k] = static_cast<double>(-dy);
+            s.C[k] = static_cast<double>(dx * (py - tri.Y[k]) + dy * tri.X[k]);
+            s.T[k] = IsTopLeft(dx, dy) ? -0.5 : 0.5;  // w_k is integral: >= 0 or > 0
+            s.ZC[k] = tri.Z[(k + 2) % 3];
+
+            // x extent of the triangle along this row, from the edges spanning it
+            if ((tri.Y[k] <= py && py <= tri.Y[n]) || (tri.Y[n] <= py && py <= tri.Y[k]))
+            {
+                double x = dy == 0 ? static_cast<double>(tri.X[k])
+                                   : tri.X[k] + static_cast<double>(dx) * (py - tri.Y[k]) / dy;
+                double x2 = dy == 0 ? static_cast<double>(tri.X[n]) : x;
+                xmin = std::min({ xmin, x, x2 });
+                xmax = std::max({ xmax, x, x2 });
+            }
+        }
+        if (xmin > xmax)
+            continue;
+        s.InvArea = 1.0 / (s.C[0] + s.C[1] + s.C[2]);  // sum of the edge functions is twice the area
+
+        // one column of slack each side, the edge functions decide exactly
+        int ilo = std::max(static_cast<int>(std::floor(xmin / SubVoxel)) - 1, 0);
+        int ihi = std::min(static_cast<int>(std::ceil(xmax / SubVoxel)) + 1, RayDim[0] - 1);
+        if (ilo <= ihi)
+            kernel(s, ilo, ihi, crossings);
+    }
+
+    std::sort(crossings.begin(), crossings.end(), [](Crossing const& a, Crossing const& b) {
+        return a.column != b.column ? a.column < b.column : a.z < b.z;
+    });
+}
+
+namespace {
+    // visit the inside intervals [za, zb] of every ray, a dangling odd crossing (open mesh) is dropped
+    template <typename Fn>
+    void ForEachInsideInterval(std::vector<Crossing> const& crossings, Fn&& fn)
+    {
+        for (size_t a = 0; a + 1 < crossings.size();)
+        {
+            if (crossings[a].column != crossings[a + 1].column)
+            {
+                ++a;
+                continue;
+            }
+            fn(crossings[a].column, crossings[a].z, crossings[a + 1].z);
+            a += 2;
+        }
+    }
+}
+
+template <typename T>
+void ParityVoxelizer::VoxelizeSlab(int z0, int z1, T full_scale, T* slab) const
+{
+    RowKernel kernel = GetRowKernel(Level);
+    std::int64_t sliceSize = static_cast<std::int64_t>(Dim[0]) * Dim[1];
+    int depth = z1 - z0 + 1;
+
+    ParallelFor(0, Dim[1], 4, [&](std::int64_t begin, std::int64_t end) {
+        std::vector<Crossing> crossings;
+        std::vector<float> coverage;  // summed ray overlaps of one voxel row of the slab, depth x Dim[0]
+        for (auto j = begin; j < end; ++j)
+        {
+            T* row = slab + j * Dim[0];
+
+            // binary: voxels whose centers lie inside
+            if (Subsamples == 1)
+            {
+                GatherRowCrossings(j, kernel, crossings);
+                ForEachInsideInterval(crossings, [&](int column, float za, float zb) {
+                    int kb = std::max(static_cast<int>(std::ceil(za)), z0);
+                    int ke = std::min(static_cast<int>(std::ceil(zb)) - 1, z1);
+                    for (int k = kb; k <= ke; ++k)
+                        row[(k - z0) * sliceSize + column] = full_scale;
+                });
+                continue;
+            }
+
+            // coverage: overlap of every ray's inside intervals with the voxel z range [k - 0.5, k + 0.5]
+            coverage.assign(static_cast<size_t>(depth) * Dim[0], 0.0f);
+            for (int sub = 0; sub < Subsamples; ++sub)
+            {
+                GatherRowCrossings(j * Subsamples + sub, kernel, crossings);
+                ForEachInsideInterval(crossings, [&](int column, float za, float zb) {
+                    int x = column / Subsamples;
+                    int kb = std::max(static_cast<int>(std::floor(za + 0.5f)), z0);
+                    int ke = std::min(static_cast<int>(std::ceil(zb - 0.5f)), z1);
+                    for (int k = kb; k <= ke; ++k)
+                    {
+                        float overlap = std::min(zb, k + 0.5f) - std::max(za, k - 0.5f);
+                        if (overlap > 0)
+                            coverage[static_cast<size_t>(k - z0) * Dim[0] + x] += overlap;
+                    }
+                });
+            }
+
+            float norm = 1.0f / static_cast<float>(Subsamples * Subsamples);
+            for (int k = 0; k < depth; ++k)
+            {
+                for (int x = 0; x < Dim[0]; ++x)
+                {
+                    float c = coverage[static_cast<size_t>(k) * Dim[0] + x];
+                    if (c <= 0)
+                        continue;
+                    float value = std::min(c * norm, 1.0f) * static_cast<float>(full_scale);
+                    if constexpr (std::is_integral_v<T>)
+                        row[k * sliceSize + x] = static_cast<T>(value + 0.5f);
+                    else
+                        row[k * sliceSize + x] = static_cast<T>(value);
+                }
+            }
+        }
+    });
+}
+
+template void ParityVoxelizer::VoxelizeSlab<unsigned char>(int, int, unsigned char, unsigned char*) const;
+template void ParityVoxelizer::VoxelizeSlab<unsigned short>(int, int, unsigned short, unsigned short*) const;
+template void ParityVoxelizer::VoxelizeSlab<float>(int, int, float, float*) const;